@@ -0,0 +1,97 @@
+#!/bin/bash
+# make check - diffs the single thread SELF output of each sample config and
+# url file against the expected output of the original DP matcher, runs
+# url-engine every other way it can read the config and the urls, the serve
+# daemon through query too, and diffs each output against SELF, then checks
+# a reload with url-check. Prints one line per run, exits 1 on any
+# difference.
+
+CC=${CC:-gcc}
+ENGINE=./url-engine
+TMP=$(mktemp -d /tmp/url-check.XXXXXX)
+trap 'rm -rf "$TMP"' EXIT
+failed=0
+
+# check name expected actual
+check() {
+    if cmp -s "$2" "$3"; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        diff "$2" "$3" | head -5
+        failed=1
+    fi
+}
+
+for pair in "config-large.xml urlFile-large.txt expected-large.txt" \
+        "config-small.xml urlFile-small.txt expected-small.txt"; do
+    set -- $pair
+    config=$1
+    urls=$2
+    expected=$3
+    name=${config%.xml}
+
+    for mode in all any first boolean; do
+        $ENGINE self $config $urls mode $mode > $TMP/ref_$mode.txt
+        for algo in posix dfa; do
+            $ENGINE $algo $config $urls mode $mode > $TMP/out.txt
+            check "$name $algo mode $mode" $TMP/ref_$mode.txt $TMP/out.txt
+        done
+    done
+    ref=$TMP/ref_all.txt
+    check "$name self expected" $expected $ref
+
+    $ENGINE codegen $config $TMP/url_matcher.c > /dev/null &&
+        $CC -O2 -shared -fPIC -o $TMP/url_matcher.so $TMP/url_matcher.c
+    $ENGINE native $config $urls matcher $TMP/url_matcher.so > $TMP/out.txt
+    check "$name native" $ref $TMP/out.txt
+
+    for algo in posix self dfa; do
+        $ENGINE $algo $config $urls thread 3 ordered > $TMP/out.txt
+        check "$name $algo thread 3 ordered" $ref $TMP/out.txt
+    done
+
+    gzip -c $urls > $TMP/urls.gz
+    for algo in self dfa; do
+        $ENGINE $algo $config $TMP/urls.gz > $TMP/out.txt
+        check "$name $algo gzip" $ref $TMP/out.txt
+        $ENGINE $algo $config - < $urls > $TMP/out.txt
+        check "$name $algo stdin" $ref $TMP/out.txt
+        $ENGINE $algo $config - thread 2 ordered < $urls > $TMP/out.txt
+        check "$name $algo stdin thread 2 ordered" $ref $TMP/out.txt
+    done
+
+    for algo in self dfa; do
+        $ENGINE serve $algo $config $TMP/serve.sock thread 2 > /dev/null 2>&1 &
+        serve_pid=$!
+        for i in $(seq 50); do
+            [ -S $TMP/serve.sock ] && break
+            sleep 0.1
+        done
+        $ENGINE query $TMP/serve.sock $urls batch 64 > $TMP/out.txt
+        check "$name $algo serve query" $ref $TMP/out.txt
+        kill -TERM $serve_pid
+        wait $serve_pid
+    done
+
+    $ENGINE compile $config $TMP/rules.img > /dev/null
+    for algo in posix self dfa; do
+        $ENGINE $algo $TMP/rules.img $urls > $TMP/out.txt
+        check "$name $algo image" $ref $TMP/out.txt
+    done
+done
+
+# a reload: a pattern changed, a set gone and a set added, recompiled over
+# the live ruleset and back, must match like a fresh compile
+sed -e 's|<pattern>\*\.yahoo\.com</pattern>|<pattern>*.yahoo.org</pattern>|' \
+    -e '/<set id="5">/,/<\/set>/d' \
+    -e 's|</patterns>|  <set id="100">\n    <pattern>*.naveen.*</pattern>\n    <pattern>ww*.aaa*</pattern>\n  </set>\n</patterns>|' \
+    config-large.xml > $TMP/config-reload.xml
+if ./url-check config-large.xml $TMP/config-reload.xml urlFile-large.txt > $TMP/out.txt; then
+    echo "ok   recompile over the live ruleset"
+else
+    echo "FAIL recompile over the live ruleset"
+    failed=1
+fi
+
+exit $failed
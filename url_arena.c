@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+#include "url_arena.h"
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to set up an empty arena
+ *
+ * @Param arena
+ * @Param size - bytes to start with, the arena grows past it
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_arena_init(url_arena_t * arena, size_t size)
+{
+    arena->used = 0;
+    arena->size = size ? size : 1;
+    arena->data = malloc(arena->size);
+    return NULL != arena->data;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to copy a string at the end of the arena, the block
+ * doubles when full
+ *
+ * @Param arena
+ * @Param str - len bytes, not NUL terminated
+ * @Param len
+ *
+ * @Returns   offset of the string, URL_ARENA_FAIL on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+size_t url_arena_add(url_arena_t * arena, const char * str, size_t len)
+{
+    size_t off = arena->used, size = arena->size;
+    char *data;
+
+    if (off + len + 1 > size) {
+        while (off + len + 1 > size) {
+            size *= 2;
+        }
+        data = realloc(arena->data, size);
+        if (NULL == data) {
+            return URL_ARENA_FAIL;
+        }
+        arena->data = data;
+        arena->size = size;
+    }
+
+    memcpy(arena->data + off, str, len);
+    arena->data[off + len] = '\0';
+    arena->used += len + 1;
+    return off;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to give back the unused end of the arena once no more
+ * strings are added
+ *
+ * @Param arena
+ */
+/* ----------------------------------------------------------------------------*/
+void url_arena_shrink(url_arena_t * arena)
+{
+    char *data;
+
+    if (arena->used && arena->used < arena->size) {
+        data = realloc(arena->data, arena->used);
+        if (data) {
+            arena->data = data;
+            arena->size = arena->used;
+        }
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the strings of the arena
+ *
+ * @Param arena
+ */
+/* ----------------------------------------------------------------------------*/
+void url_arena_free(url_arena_t * arena)
+{
+    free(arena->data);
+    arena->data = NULL;
+    arena->used = arena->size = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef _URL_ARENA_H_
+#define _URL_ARENA_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Returned by url_arena_add() when the arena can't grow */
+#define URL_ARENA_FAIL  ((size_t)-1)
+
+/*! \struct _url_arena_t
+ *  Strings packed one after the other in one block, each NUL terminated.
+ *  A string is known by its offset, which stays valid when the block grows.
+ */
+typedef struct _url_arena_t {
+    char *data;
+    size_t used;
+    size_t size;
+} url_arena_t;
+
+bool url_arena_init(url_arena_t * arena, size_t size);
+size_t url_arena_add(url_arena_t * arena, const char * str, size_t len);
+void url_arena_shrink(url_arena_t * arena);
+void url_arena_free(url_arena_t * arena);
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get a string of the arena, the pointer is valid
+ * till the next url_arena_add()
+ *
+ * @Param arena
+ * @Param off
+ *
+ * @Returns   string
+ */
+/* ----------------------------------------------------------------------------*/
+static inline const char * url_arena_str(const url_arena_t * arena, size_t off)
+{
+    return arena->data + off;
+}
+
+#endif /* ifndef _URL_ARENA_H_ */
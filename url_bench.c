@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "url_bench.h"
+
+/* Words the generated hosts, paths and patterns are made of. A small shared
+ * vocabulary makes the patterns hit the urls. */
+static const char *bench_words[] = {
+    "aaa", "yahoo", "google", "news", "mail", "maps", "shop", "cart",
+    "login", "video", "music", "sport", "blog", "wiki", "docs", "api",
+    "cdn", "static", "img", "search", "home", "user", "admin", "data",
+    "cloud", "store", "play", "edu", "bank", "travel", "food", "games",
+};
+#define BENCH_NUM_WORDS (int)(sizeof(bench_words) / sizeof(bench_words[0]))
+
+static const char *bench_tlds[] = { "com", "org", "net", "uk", "io", "cc" };
+#define BENCH_NUM_TLDS (int)(sizeof(bench_tlds) / sizeof(bench_tlds[0]))
+
+/* Longest generated url or pattern */
+#define BENCH_LINE_MAX  96
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to read the monotonic clock, not affected by time of
+ * day changes and counting while the thread sleeps
+ *
+ * @Returns   ns
+ */
+/* ----------------------------------------------------------------------------*/
+unsigned long long bench_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the bucket of a latency. Below 16 ns the bucket
+ * is the value, above each power of 2 is cut in 16 buckets.
+ *
+ * @Param ns
+ *
+ * @Returns   bucket
+ */
+/* ----------------------------------------------------------------------------*/
+static inline int bench_hist_bucket(unsigned long long ns)
+{
+    int exp;
+
+    if (ns < (1 << BENCH_HIST_SUB_BITS)) {
+        return ns;
+    }
+    exp = 63 - __builtin_clzll(ns);
+    return ((exp - BENCH_HIST_SUB_BITS + 1) << BENCH_HIST_SUB_BITS) +
+        ((ns >> (exp - BENCH_HIST_SUB_BITS)) & ((1 << BENCH_HIST_SUB_BITS) - 1));
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the smallest latency of a bucket
+ *
+ * @Param bucket
+ *
+ * @Returns   ns
+ */
+/* ----------------------------------------------------------------------------*/
+static inline unsigned long long bench_hist_value(int bucket)
+{
+    int exp = (bucket >> BENCH_HIST_SUB_BITS) + BENCH_HIST_SUB_BITS - 1;
+    unsigned long long sub = bucket & ((1 << BENCH_HIST_SUB_BITS) - 1);
+
+    if (bucket < (1 << BENCH_HIST_SUB_BITS)) {
+        return bucket;
+    }
+    return ((1ULL << BENCH_HIST_SUB_BITS) + sub) << (exp - BENCH_HIST_SUB_BITS);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add one latency to the histogram
+ *
+ * @Param hist
+ * @Param ns
+ */
+/* ----------------------------------------------------------------------------*/
+void bench_hist_record(bench_hist_t * hist, unsigned long long ns)
+{
+    hist->counts[bench_hist_bucket(ns)]++;
+    hist->count++;
+    hist->total_ns += ns;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add the histogram of a thread to the total
+ *
+ * @Param dst
+ * @Param src
+ */
+/* ----------------------------------------------------------------------------*/
+void bench_hist_merge(bench_hist_t * dst, const bench_hist_t * src)
+{
+    int i;
+
+    for (i=0;i<BENCH_HIST_BUCKETS;i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->count += src->count;
+    dst->total_ns += src->total_ns;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get a percentile of the latency
+ *
+ * @Param hist
+ * @Param percentile - 0 to 100
+ *
+ * @Returns   ns, lower bound of the bucket holding the percentile
+ */
+/* ----------------------------------------------------------------------------*/
+unsigned long long bench_hist_percentile(const bench_hist_t * hist, double percentile)
+{
+    unsigned long rank, seen = 0;
+    int i;
+
+    if (0 == hist->count) {
+        return 0;
+    }
+    rank = (unsigned long)(percentile / 100.0 * hist->count);
+    if (rank >= hist->count) {
+        rank = hist->count - 1;
+    }
+    for (i=0;i<BENCH_HIST_BUCKETS;i++) {
+        seen += hist->counts[i];
+        if (seen > rank) {
+            return bench_hist_value(i);
+        }
+    }
+    return bench_hist_value(BENCH_HIST_BUCKETS - 1);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  xorshift64* generator, the corpora only depend on the seed
+ *
+ * @Param state
+ *
+ * @Returns   random number
+ */
+/* ----------------------------------------------------------------------------*/
+static inline unsigned long long bench_rand(unsigned long long * state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get true with the given probability
+ *
+ * @Param state
+ * @Param probability
+ *
+ * @Returns   true or false
+ */
+/* ----------------------------------------------------------------------------*/
+static inline bool bench_chance(unsigned long long * state, double probability)
+{
+    return (bench_rand(state) >> 11) * (1.0 / 9007199254740992.0) < probability;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write one url shaped line: 2 or 3 host labels, a
+ * tld and up to 3 path segments. With wildcard > 0 every label and segment
+ * is replaced by '*' with that probability, making a pattern.
+ *
+ * @Param state
+ * @Param wildcard
+ * @Param line - BENCH_LINE_MAX bytes
+ *
+ * @Returns   length of the line
+ */
+/* ----------------------------------------------------------------------------*/
+static int bench_gen_line(unsigned long long * state, double wildcard, char * line)
+{
+    int i, len = 0, num_labels, num_segments;
+    const char *part;
+
+    num_labels = 1 + bench_rand(state) % 2;
+    if (bench_chance(state, 0.5)) {
+        len += snprintf(line + len, BENCH_LINE_MAX - len, "www.");
+    }
+    for (i=0;i<num_labels;i++) {
+        part = bench_chance(state, wildcard) ? "*" : bench_words[bench_rand(state) % BENCH_NUM_WORDS];
+        len += snprintf(line + len, BENCH_LINE_MAX - len, "%s.", part);
+    }
+    part = bench_chance(state, wildcard) ? "*" : bench_tlds[bench_rand(state) % BENCH_NUM_TLDS];
+    len += snprintf(line + len, BENCH_LINE_MAX - len, "%s", part);
+
+    num_segments = bench_rand(state) % 4;
+    for (i=0;i<num_segments;i++) {
+        part = bench_chance(state, wildcard) ? "*" : bench_words[bench_rand(state) % BENCH_NUM_WORDS];
+        len += snprintf(line + len, BENCH_LINE_MAX - len, "/%s", part);
+    }
+    return len;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to generate the url corpus, one url per line. With
+ * num_unique the urls are drawn from that many distinct ones, like the
+ * repeated urls of proxy traffic.
+ *
+ * @Param seed
+ * @Param num_urls
+ * @Param num_unique - 0 for all the urls distinct
+ * @Param size - bytes in the corpus
+ *
+ * @Returns   corpus to free, NULL on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+char * bench_gen_urls(unsigned long long seed, long num_urls, long num_unique, size_t * size)
+{
+    unsigned long long state = seed * 2 + 1;
+    char *data, *unique = NULL;
+    long i, pick;
+    int len;
+
+    data = malloc((size_t)num_urls * (BENCH_LINE_MAX + 1) + 1);
+    if (num_unique > 0) {
+        unique = malloc((size_t)num_unique * (BENCH_LINE_MAX + 1));
+    }
+    if (NULL == data || (num_unique > 0 && NULL == unique)) {
+        free(data);
+        free(unique);
+        return NULL;
+    }
+
+    /* a distinct url per BENCH_LINE_MAX + 1 bytes, NUL terminated */
+    for (i=0;i<num_unique;i++) {
+        len = bench_gen_line(&state, 0, unique + i * (BENCH_LINE_MAX + 1));
+        unique[i * (BENCH_LINE_MAX + 1) + len] = '\0';
+    }
+
+    *size = 0;
+    for (i=0;i<num_urls;i++) {
+        if (unique) {
+            pick = bench_rand(&state) % num_unique;
+            len = strlen(unique + pick * (BENCH_LINE_MAX + 1));
+            memcpy(data + *size, unique + pick * (BENCH_LINE_MAX + 1), len);
+        } else {
+            len = bench_gen_line(&state, 0, data + *size);
+        }
+        data[*size + len] = '\n';
+        *size += len + 1;
+    }
+    free(unique);
+    return data;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to generate the pattern corpus into sets of 10 or more
+ * patterns. wildcard is the probability of a label or segment being '*'.
+ * Domain rules (*.label.tld) are a part of it, so the host trie is used too.
+ *
+ * @Param seed
+ * @Param num_patterns
+ * @Param wildcard
+ * @Param max_sets
+ * @Param num_sets
+ *
+ * @Returns   sets to free with bench_free_patterns(), NULL on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+url_engine_set_t * bench_gen_patterns(unsigned long long seed, int num_patterns, double wildcard,
+        int max_sets, int * num_sets)
+{
+    unsigned long long state = seed * 2 + 3;
+    int i, per_set, set, len;
+    char line[BENCH_LINE_MAX];
+    url_engine_set_t *sets;
+    char **patterns = NULL;
+
+    per_set = (num_patterns + max_sets - 1) / max_sets;
+    if (per_set < 10) {
+        per_set = 10;
+    }
+
+    sets = calloc(max_sets, sizeof(url_engine_set_t));
+    if (NULL == sets) {
+        return NULL;
+    }
+
+    *num_sets = 0;
+    for (i=0;i<num_patterns;i++) {
+        set = i / per_set;
+        if (set == *num_sets) {
+            patterns = calloc(per_set, sizeof(char *));
+            if (NULL == patterns) {
+                bench_free_patterns(sets, *num_sets);
+                return NULL;
+            }
+            sets[set].key = set + 1;
+            sets[set].patterns = (const char * const *)patterns;
+            (*num_sets)++;
+        }
+
+        if (bench_chance(&state, wildcard / 4)) {
+            len = snprintf(line, sizeof(line), "*.%s.%s", bench_words[bench_rand(&state) % BENCH_NUM_WORDS],
+                    bench_tlds[bench_rand(&state) % BENCH_NUM_TLDS]);
+        } else {
+            len = bench_gen_line(&state, wildcard, line);
+        }
+
+        patterns[sets[set].num_patterns] = strndup(line, len);
+        if (NULL == patterns[sets[set].num_patterns]) {
+            bench_free_patterns(sets, *num_sets);
+            return NULL;
+        }
+        sets[set].num_patterns++;
+    }
+    return sets;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the generated pattern corpus
+ *
+ * @Param sets
+ * @Param num_sets
+ */
+/* ----------------------------------------------------------------------------*/
+void bench_free_patterns(url_engine_set_t * sets, int num_sets)
+{
+    int i, j;
+
+    for (i=0;i<num_sets;i++) {
+        for (j=0;j<sets[i].num_patterns;j++) {
+            free((char *)sets[i].patterns[j]);
+        }
+        free((char **)sets[i].patterns);
+    }
+    free(sets);
+}
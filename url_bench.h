@@ -0,0 +1,34 @@
+#ifndef _URL_BENCH_H_
+#define _URL_BENCH_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "url_lib.h"
+
+/* Sets the generated patterns are spread over */
+#define BENCH_MAX_SETS      1000
+
+/* Latency histogram: 16 linear sub buckets per power of 2, about 6% error */
+#define BENCH_HIST_SUB_BITS 4
+#define BENCH_HIST_BUCKETS  (64 << BENCH_HIST_SUB_BITS)
+
+/*! \struct _bench_hist_t
+ *  Histogram of the per URL latency in ns, one per thread merged at the end
+ */
+typedef struct _bench_hist_t {
+    unsigned long count;
+    unsigned long long total_ns;
+    unsigned long counts[BENCH_HIST_BUCKETS];
+} bench_hist_t;
+
+unsigned long long bench_now_ns();
+void bench_hist_record(bench_hist_t * hist, unsigned long long ns);
+void bench_hist_merge(bench_hist_t * dst, const bench_hist_t * src);
+unsigned long long bench_hist_percentile(const bench_hist_t * hist, double percentile);
+
+char * bench_gen_urls(unsigned long long seed, long num_urls, long num_unique, size_t * size);
+url_engine_set_t * bench_gen_patterns(unsigned long long seed, int num_patterns, double wildcard,
+        int max_sets, int * num_sets);
+void bench_free_patterns(url_engine_set_t * sets, int num_sets);
+
+#endif /* ifndef _URL_BENCH_H_ */
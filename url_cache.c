@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "url_cache.h"
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to create the cache within the given memory
+ *
+ * @Param bytes - memory of the slots, rounded down to a power of 2 sets
+ *
+ * @Returns   cache, NULL on failure
+ */
+/* ----------------------------------------------------------------------------*/
+url_cache_t * url_cache_create(size_t bytes)
+{
+    url_cache_t *cache;
+    size_t num_sets = 1;
+
+    while (num_sets * 2 * URL_CACHE_WAYS * sizeof(url_cache_slot_t) <= bytes) {
+        num_sets *= 2;
+    }
+
+    cache = calloc(1, sizeof(url_cache_t));
+    if (NULL == cache) {
+        return NULL;
+    }
+    cache->slots = calloc(num_sets * URL_CACHE_WAYS, sizeof(url_cache_slot_t));
+    cache->hand = calloc(num_sets, sizeof(unsigned char));
+    if (!cache->slots || !cache->hand) {
+        url_cache_free(cache);
+        return NULL;
+    }
+    cache->set_mask = num_sets - 1;
+
+    return cache;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the cache
+ *
+ * @Param cache
+ */
+/* ----------------------------------------------------------------------------*/
+void url_cache_free(url_cache_t * cache)
+{
+    if (!cache) {
+        return;
+    }
+    free(cache->slots);
+    free(cache->hand);
+    free(cache);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to hash the url 8 bytes at a time
+ *
+ * @Param url
+ * @Param len
+ *
+ * @Returns   hash
+ */
+/* ----------------------------------------------------------------------------*/
+unsigned long long url_cache_hash(const char * url, size_t len)
+{
+    unsigned long long h = 0x9e3779b97f4a7c15ULL ^ len, word;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&word, url + i, 8);
+        h = (h ^ word) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    if (i < len) {
+        word = 0;
+        memcpy(&word, url + i, len - i);
+        h = (h ^ word) * 0xff51afd7ed558ccdULL;
+    }
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to find the matching ids of the url. A slot filled
+ * with an older ruleset does not count.
+ *
+ * @Param cache
+ * @Param generation - of the current ruleset
+ * @Param url
+ * @Param len
+ * @Param hash - url_cache_hash() of the url
+ * @Param ids - matching ids in config order
+ *
+ * @Returns   number of ids, -1 on a miss
+ */
+/* ----------------------------------------------------------------------------*/
+int url_cache_lookup(url_cache_t * cache, unsigned int generation, const char * url, size_t len,
+        unsigned long long hash, const int ** ids)
+{
+    url_cache_slot_t *slot = &cache->slots[(hash & cache->set_mask) * URL_CACHE_WAYS];
+    int w;
+
+    for (w = 0; w < URL_CACHE_WAYS; w++, slot++) {
+        if (slot->hash == hash && slot->generation == generation && slot->url_len == len &&
+                !memcmp((const char *)(slot->data + slot->num_ids), url, len)) {
+            slot->ref = 1;
+            cache->hits++;
+            *ids = slot->data;
+            return slot->num_ids;
+        }
+    }
+
+    cache->misses++;
+    return -1;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add the url after a miss. A slot of an older
+ * ruleset is taken first, else the clock hand of the set moves past the
+ * slots hit since its last turn and evicts the first one that was not.
+ * A result too large for a slot is not cached.
+ *
+ * @Param cache
+ * @Param generation
+ * @Param url
+ * @Param len
+ * @Param hash
+ * @Param ids
+ * @Param num_ids
+ */
+/* ----------------------------------------------------------------------------*/
+void url_cache_insert(url_cache_t * cache, unsigned int generation, const char * url, size_t len,
+        unsigned long long hash, const int * ids, int num_ids)
+{
+    size_t set = hash & cache->set_mask;
+    url_cache_slot_t *slots = &cache->slots[set * URL_CACHE_WAYS], *slot = NULL;
+    int w;
+
+    if (num_ids * sizeof(int) + len > URL_CACHE_PAYLOAD || num_ids > UINT8_MAX) {
+        cache->bypass++;
+        return;
+    }
+
+    for (w = 0; w < URL_CACHE_WAYS; w++) {
+        if (slots[w].generation != generation) {
+            slot = &slots[w];
+            break;
+        }
+    }
+
+    if (NULL == slot) {
+        for (;;) {
+            slot = &slots[cache->hand[set]];
+            cache->hand[set] = (cache->hand[set] + 1) % URL_CACHE_WAYS;
+            if (!slot->ref) {
+                break;
+            }
+            slot->ref = 0;
+        }
+        cache->evictions++;
+    }
+
+    slot->hash = hash;
+    slot->generation = generation;
+    slot->url_len = len;
+    slot->num_ids = num_ids;
+    slot->ref = 0;
+    memcpy(slot->data, ids, num_ids * sizeof(int));
+    memcpy((char *)(slot->data + num_ids), url, len);
+}
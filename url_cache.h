@@ -0,0 +1,53 @@
+#ifndef _URL_CACHE_H_
+#define _URL_CACHE_H_
+
+#include <stddef.h>
+#include <string.h>
+
+/* Slots per set, the victim is picked among them */
+#define URL_CACHE_WAYS          8
+#define URL_CACHE_SLOT_BYTES    256
+#define URL_CACHE_HEADER_BYTES  16
+/* Room for the matching ids followed by the url in one slot */
+#define URL_CACHE_PAYLOAD       (URL_CACHE_SLOT_BYTES - URL_CACHE_HEADER_BYTES)
+
+/*! \struct _url_cache_slot_t
+ *  One cached url and its matching pattern ids, in config order.
+ *  generation - generation of the ruleset the result was found with,
+ *  0 for an empty slot
+ *  ref - set on every hit, cleared by the clock hand
+ *  data - num_ids ints then url_len bytes of url
+ */
+typedef struct _url_cache_slot_t {
+    unsigned long long hash;
+    unsigned int generation;
+    unsigned short url_len;
+    unsigned char num_ids;
+    unsigned char ref;
+    int data[URL_CACHE_PAYLOAD / sizeof(int)];
+} url_cache_slot_t;
+
+/*! \struct _url_cache_t
+ *  Set associative cache from a url to its matching patterns, one per
+ *  thread so no lock is taken. The memory is fixed at create time, a full
+ *  set evicts with the CLOCK algorithm.
+ */
+typedef struct _url_cache_t {
+    url_cache_slot_t *slots;
+    unsigned char *hand;
+    size_t set_mask;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long bypass;
+} url_cache_t;
+
+url_cache_t * url_cache_create(size_t bytes);
+void url_cache_free(url_cache_t * cache);
+unsigned long long url_cache_hash(const char * url, size_t len);
+int url_cache_lookup(url_cache_t * cache, unsigned int generation, const char * url, size_t len,
+        unsigned long long hash, const int ** ids);
+void url_cache_insert(url_cache_t * cache, unsigned int generation, const char * url, size_t len,
+        unsigned long long hash, const int * ids, int num_ids);
+
+#endif /* ifndef _URL_CACHE_H_ */
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "url_lib.h"
+
+/*
+ * url-check - used by make check to compare a ruleset recompiled over a live
+ * one with a fresh compile of the same config. Both must give the same
+ * patterns and the same matches for every algorithm and mode.
+ *  url-check old.xml new.xml urlFile.txt
+ */
+
+static const char *algo_names[] = { "posix", "self", "dfa" };
+static const char *mode_names[] = { "all", "any", "first", "boolean" };
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to read the whole url file
+ *
+ * @Param path
+ * @Param size
+ *
+ * @Returns  file content NUL terminated, NULL on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static char * read_file(const char * path, size_t * size)
+{
+    FILE *fp = fopen(path, "r");
+    char *data;
+    long len;
+
+    if (NULL == fp) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = malloc(len + 1);
+    if (data && fread(data, 1, len, fp) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    if (data) {
+        data[len] = '\0';
+        *size = len;
+    }
+    return data;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to compare the patterns of two rulesets id by id
+ *
+ * @Param a
+ * @Param b
+ *
+ * @Returns  true when the same
+ */
+/* ----------------------------------------------------------------------------*/
+static bool same_patterns(const url_engine_t * a, const url_engine_t * b)
+{
+    const char *pa, *pb;
+    int i, key_a, key_b, len_a, len_b;
+
+    if (url_engine_num_sets(a) != url_engine_num_sets(b) ||
+            url_engine_num_patterns(a) != url_engine_num_patterns(b) ||
+            url_engine_num_duplicates(a) != url_engine_num_duplicates(b) ||
+            url_engine_num_subsumed(a) != url_engine_num_subsumed(b)) {
+        fprintf(stderr, "counts differ: %d/%d sets, %d/%d patterns, %d/%d duplicates, %d/%d subsumed\n",
+                url_engine_num_sets(a), url_engine_num_sets(b),
+                url_engine_num_patterns(a), url_engine_num_patterns(b),
+                url_engine_num_duplicates(a), url_engine_num_duplicates(b),
+                url_engine_num_subsumed(a), url_engine_num_subsumed(b));
+        return false;
+    }
+    for (i=0;i<url_engine_num_patterns(a);i++) {
+        pa = url_engine_pattern(a, i, &key_a, &len_a);
+        pb = url_engine_pattern(b, i, &key_b, &len_b);
+        if (key_a != key_b || len_a != len_b || memcmp(pa, pb, len_a)) {
+            fprintf(stderr, "pattern %d differs: %.*s in set %d, %.*s in set %d\n",
+                    i, len_a, pa, key_a, len_b, pb, key_b);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to match every url with both rulesets and compare the
+ * matching pattern ids
+ *
+ * @Param a
+ * @Param b
+ * @Param algo
+ * @Param mode
+ * @Param urls - url file content, one url per line
+ * @Param size
+ *
+ * @Returns  number of urls matched, -1 on a difference or a failure
+ */
+/* ----------------------------------------------------------------------------*/
+static long same_matches(const url_engine_t * a, const url_engine_t * b, MATCH_TYPE algo,
+        MATCH_MODE mode, const char * urls, size_t size)
+{
+    url_engine_scratch_t *sa = url_engine_scratch_create(algo), *sb = url_engine_scratch_create(algo);
+    const char *url = urls, *end = urls + size, *nl;
+    const int *ids_a, *ids_b;
+    int na, nb = 0;
+    size_t len;
+    long num_urls = 0;
+
+    if (!sa || !sb) {
+        url_engine_scratch_free(sa);
+        url_engine_scratch_free(sb);
+        return -1;
+    }
+    url_engine_scratch_set_mode(sa, mode);
+    url_engine_scratch_set_mode(sb, mode);
+
+    for (; url < end; url = nl + 1) {
+        nl = memchr(url, '\n', end - url);
+        nl = nl ? nl : end;
+        len = nl - url;
+        if (len && url[len-1] == '\r') {
+            len--;
+        }
+        if (!len) {
+            continue;
+        }
+        na = url_engine_match_ids(a, sa, url, len, &ids_a);
+        if (na >= 0) {
+            /* ids_a stays valid, the other scratch is used */
+            nb = url_engine_match_ids(b, sb, url, len, &ids_b);
+        }
+        if (na < 0 || nb < 0 || na != nb || memcmp(ids_a, ids_b, na * sizeof(int))) {
+            fprintf(stderr, "url %.*s: %d patterns recompiled, %d compiled\n", (int)len, url, na, nb);
+            num_urls = -1;
+            break;
+        }
+        num_urls++;
+    }
+
+    url_engine_scratch_free(sa);
+    url_engine_scratch_free(sb);
+    return num_urls;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to compare the ruleset recompiled from the config over
+ * live with a fresh compile of the config
+ *
+ * @Param config
+ * @Param live
+ * @Param urls
+ * @Param size
+ *
+ * @Returns  recompiled ruleset, NULL on a difference or a failure
+ */
+/* ----------------------------------------------------------------------------*/
+static url_engine_t * check_recompile(const char * config, const url_engine_t * live, const char * urls, size_t size)
+{
+    url_engine_t *recompiled, *fresh;
+    int algo, mode;
+    long n = 0;
+
+    recompiled = url_engine_recompile_file(config, live);
+    fresh = url_engine_compile_file(config);
+    if (!recompiled || !fresh) {
+        fprintf(stderr, "Could not compile the config %s\n", config);
+        url_engine_free(recompiled);
+        url_engine_free(fresh);
+        return NULL;
+    }
+
+    if (!same_patterns(recompiled, fresh)) {
+        n = -1;
+    }
+    for (algo=POSIX; n >= 0 && algo<=DFA; algo++) {
+        for (mode=MATCH_ALL; n >= 0 && mode<=MATCH_BOOLEAN; mode++) {
+            n = same_matches(recompiled, fresh, algo, mode, urls, size);
+            if (n < 0) {
+                fprintf(stderr, "%s mode %s differs\n", algo_names[algo], mode_names[mode]);
+            }
+        }
+    }
+    url_engine_free(fresh);
+    if (n < 0) {
+        url_engine_free(recompiled);
+        return NULL;
+    }
+    printf("%s recompiled over the live ruleset: %d patterns, %ld urls the same\n",
+            config, url_engine_num_patterns(recompiled), n);
+    return recompiled;
+}
+
+int main(int argc, char **argv)
+{
+    url_engine_t *live, *next, *back;
+    char *urls;
+    size_t size = 0;
+
+    if (argc != 4) {
+        fprintf(stderr, "Usage: url-check old.xml new.xml urlFile.txt\n");
+        return 1;
+    }
+    urls = read_file(argv[3], &size);
+    if (NULL == urls) {
+        fprintf(stderr, "Could not read %s\n", argv[3]);
+        return 1;
+    }
+    live = url_engine_compile_file(argv[1]);
+    if (NULL == live) {
+        fprintf(stderr, "Could not compile the config %s\n", argv[1]);
+        free(urls);
+        return 1;
+    }
+
+    /* to the new config and back, both ways over a live ruleset */
+    next = check_recompile(argv[2], live, urls, size);
+    back = next ? check_recompile(argv[1], next, urls, size) : NULL;
+
+    url_engine_free(back);
+    url_engine_free(next);
+    url_engine_free(live);
+    free(urls);
+    return back ? 0 : 1;
+}
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <dlfcn.h>
+#include "url_engine.h"
+#include "url_codegen.h"
+
+/* Greedy matcher of the generated source, self_glob_match() of url_lib.c,
+ * for the patterns having a '|' after their first '/' */
+static const char *codegen_glob =
+"__attribute__((unused))\n"
+"static int glob(const unsigned char *url, size_t url_len, const char *pattern, size_t pattern_len)\n"
+"{\n"
+"    const unsigned char *star_url = NULL, *url_end = url + url_len;\n"
+"    const char *star_pattern = NULL, *pattern_end = pattern + pattern_len;\n"
+"\n"
+"    while (url < url_end) {\n"
+"        if (pattern < pattern_end && (*pattern == '*' || *pattern == '|')) {\n"
+"            star_pattern = pattern++;\n"
+"            star_url = url;\n"
+"        } else if (pattern < pattern_end && (unsigned char)*pattern == *url) {\n"
+"            pattern++;\n"
+"            url++;\n"
+"        } else if (star_pattern && !(*star_pattern == '|' && *star_url == '/')) {\n"
+"            url = ++star_url;\n"
+"            pattern = star_pattern + 1;\n"
+"        } else {\n"
+"            return 0;\n"
+"        }\n"
+"    }\n"
+"    while (pattern < pattern_end && (*pattern == '*' || *pattern == '|')) {\n"
+"        pattern++;\n"
+"    }\n"
+"    return pattern == pattern_end;\n"
+"}\n"
+"\n"
+"__attribute__((unused))\n"
+"static int none(const unsigned char *u, size_t n, size_t h)\n"
+"{\n"
+"    (void)u, (void)n, (void)h;\n"
+"    return 0;\n"
+"}\n";
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to hash what a generated matcher depends on: the
+ * number of patterns and the SELF form of each, in id order (FNV-1a)
+ *
+ * @Param rs
+ *
+ * @Returns   hash
+ */
+/* ----------------------------------------------------------------------------*/
+static unsigned long long codegen_hash(const ruleset_t * rs)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    const unsigned char *p;
+    int id, i;
+
+    for (id = -1; id < rs->num_patterns; id++) {
+        p = (id < 0) ? (const unsigned char *)&rs->num_patterns :
+            (const unsigned char *)url_arena_str(&rs->strings, rs->self_off[id]);
+        for (i = 0; i < (id < 0 ? (int)sizeof(int) : rs->self_len[id] + 1); i++) {
+            hash = (hash ^ p[i]) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write the test of a literal at a place of the text,
+ * one comparison per byte, true when any byte differs
+ *
+ * @Param fp
+ * @Param place - C expression of the index of the first byte, "%zu" of i
+ * added to it
+ * @Param literal
+ * @Param len
+ */
+/* ----------------------------------------------------------------------------*/
+static void codegen_differs(FILE * fp, const char * place, const char * literal, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        fprintf(fp, "%st[%s + %zu] != %u", i ? " || " : "", place, i, (unsigned char)literal[i]);
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write the match of a text with a part of a pattern
+ * whose '|' can't meet a '/', segment_glob_match() of url_lib.c unrolled:
+ * the first literal must start the text, the last one end it and each one
+ * in between is looked for from where the previous one ended. Returns 0
+ * from the generated function when the text does not match.
+ *
+ * @Param fp
+ * @Param text - C expression of the text
+ * @Param text_len - C expression of its length
+ * @Param pattern
+ * @Param len
+ */
+/* ----------------------------------------------------------------------------*/
+static void codegen_segments(FILE * fp, const char * text, const char * text_len, const char * pattern, size_t len)
+{
+    size_t first, last, head, tail, start, end, seg;
+    int middles;
+    char place[64];
+
+    first = strcspn(pattern, "*|");
+    if (0 == len) {
+        fprintf(fp, "    if (%s != 0) return 0;\n", text_len);
+        return;
+    }
+    if (first >= len) {
+        fprintf(fp, "    {\n        const unsigned char *t = %s;\n\n", text);
+        fprintf(fp, "        if (%s != %zu || ", text_len, len);
+        codegen_differs(fp, "0", pattern, len);
+        fprintf(fp, ") return 0;\n    }\n");
+        return;
+    }
+    for (last = len - 1; pattern[last] != '*' && pattern[last] != '|'; last--);
+    head = first;
+    tail = len - last - 1;
+
+    /* literals between the first and the last wildcard */
+    for (start = first + 1, middles = 0; start < last; start = end + 1) {
+        for (end = start; pattern[end] != '*' && pattern[end] != '|'; end++);
+        middles += (end > start);
+    }
+
+    /* only wildcards, and a segment never holds the '/' a '|' stops at */
+    if (!head && !tail && !middles) {
+        return;
+    }
+
+    fprintf(fp, "    {\n        const unsigned char *t = %s;\n        size_t tl = %s;\n", text, text_len);
+    if (middles) {
+        fprintf(fp, "        size_t pos = %zu, end = tl - %zu;\n", head, tail);
+        fprintf(fp, "        const unsigned char *f;\n");
+    }
+    fprintf(fp, "\n");
+    if (head + tail) {
+        fprintf(fp, "        if (tl < %zu) return 0;\n", head + tail);
+    }
+    if (head) {
+        fprintf(fp, "        if (");
+        codegen_differs(fp, "0", pattern, head);
+        fprintf(fp, ") return 0;\n");
+    }
+    if (tail) {
+        snprintf(place, sizeof(place), "tl - %zu", tail);
+        fprintf(fp, "        if (");
+        codegen_differs(fp, place, pattern + last + 1, tail);
+        fprintf(fp, ") return 0;\n");
+    }
+
+    for (start = first + 1; start < last; start = end + 1) {
+        for (end = start; pattern[end] != '*' && pattern[end] != '|'; end++);
+        seg = end - start;
+        if (1 == seg) {
+            fprintf(fp, "        if (!(f = memchr(t + pos, %u, end - pos))) return 0;\n", (unsigned char)pattern[start]);
+            fprintf(fp, "        pos = f - t + 1;\n");
+        } else if (seg > 1) {
+            /* first byte by memchr, then the last byte, then the rest */
+            fprintf(fp, "        for (;; pos++) {\n");
+            fprintf(fp, "            if (pos + %zu > end || !(f = memchr(t + pos, %u, end - pos - %zu))) return 0;\n",
+                    seg, (unsigned char)pattern[start], seg - 1);
+            fprintf(fp, "            pos = f - t;\n");
+            fprintf(fp, "            if (t[pos + %zu] == %u", seg - 1, (unsigned char)pattern[end - 1]);
+            if (seg > 2) {
+                fprintf(fp, " && !(");
+                codegen_differs(fp, "pos + 1", pattern + start + 1, seg - 2);
+                fprintf(fp, ")");
+            }
+            fprintf(fp, ") break;\n        }\n        pos += %zu;\n", seg);
+        }
+    }
+    fprintf(fp, "    }\n");
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write the matcher of one pattern, the same test
+ * as self_verify() with the pattern built in
+ *
+ * @Param fp
+ * @Param rs
+ * @Param id
+ */
+/* ----------------------------------------------------------------------------*/
+static void codegen_pattern(FILE * fp, const ruleset_t * rs, int id)
+{
+    const char *pattern = url_arena_str(&rs->strings, rs->self_off[id]);
+    size_t len = rs->self_len[id], host = rs->self_host[id], i;
+
+    fprintf(fp, "\nstatic int m%d(const unsigned char *u, size_t n, size_t h)\n{\n", id);
+    if (!(rs->pattern_flags[id] & PATTERN_SPLIT)) {
+        fprintf(fp, "    (void)h;\n    return glob(u, n, \"");
+        for (i = 0; i < len; i++) {
+            fprintf(fp, "\\%03o", (unsigned char)pattern[i]);
+        }
+        fprintf(fp, "\", %zu);\n}\n", len);
+        return;
+    }
+
+    /* a path in the pattern exactly when the url has one, u is unused when
+     * both parts are wildcards only */
+    fprintf(fp, "    (void)u;\n    if (h %s n) return 0;\n", (host < len) ? "==" : "<");
+    codegen_segments(fp, "u", "h", pattern, host);
+    if (host < len) {
+        codegen_segments(fp, "u + h", "n - h", pattern + host, len - host);
+    }
+    fprintf(fp, "    return 1;\n}\n");
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write the C source of a matcher specialized for the
+ * ruleset: one function per pattern verified (the first of its duplicates),
+ * literals compared byte by byte against constants, and a table of them by
+ * pattern id. The candidates still come from the prefilter and host trie of
+ * the ruleset, the matches are the ones of SELF.
+ *
+ * @Param rs
+ * @Param c_file
+ *
+ * @Returns   false on failure
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_engine_codegen(const ruleset_t * rs, const char * c_file)
+{
+    FILE *fp;
+    bool ok;
+    int id;
+
+    fp = fopen(c_file, "w");
+    if (NULL == fp) {
+        fprintf(stderr, "Could not open file %s\n", c_file);
+        return false;
+    }
+    fprintf(fp, "/* Generated by url-engine codegen, do not edit. Built by make matcher:\n"
+            " *  cc -O2 -shared -fPIC -o url_matcher.so %s\n */\n", c_file);
+    fprintf(fp, "#include <stddef.h>\n#include <string.h>\n\n");
+    fprintf(fp, "const int url_matcher_abi = %d;\n", URL_MATCHER_ABI);
+    fprintf(fp, "const unsigned long long url_matcher_hash = 0x%016llxULL;\n", codegen_hash(rs));
+    fprintf(fp, "const int url_matcher_num_patterns = %d;\n\n", rs->num_patterns);
+    fputs(codegen_glob, fp);
+
+    for (id = 0; id < rs->num_patterns; id++) {
+        if (rs->pattern_canon[id] == id) {
+            codegen_pattern(fp, rs, id);
+        }
+    }
+
+    fprintf(fp, "\nstatic int (*const matchers[])(const unsigned char *, size_t, size_t) = {");
+    for (id = 0; id < rs->num_patterns; id++) {
+        if (rs->pattern_canon[id] == id) {
+            fprintf(fp, "%s\n    m%d", id ? "," : "", id);
+        } else {
+            fprintf(fp, "%s\n    none", id ? "," : "");
+        }
+    }
+    fprintf(fp, "%s\n};\n\n", rs->num_patterns ? "" : "\n    none");
+    fprintf(fp, "int url_matcher_verify(const char *url, size_t url_len, size_t host_len, int id)\n{\n"
+            "    return matchers[id]((const unsigned char *)url, url_len, host_len);\n}\n");
+
+    ok = !ferror(fp);
+    ok = !fclose(fp) && ok;
+    if (!ok) {
+        fprintf(stderr, "Could not write file %s\n", c_file);
+    }
+    return ok;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to load a matcher built from the source of
+ * url_engine_codegen() over the ruleset, for the NATIVE algorithm. It must
+ * have been generated from the same patterns. Done before the ruleset is
+ * shared with other threads, the matcher is unloaded by url_engine_free().
+ *
+ * @Param rs
+ * @Param so_file - path of the shared object, with a '/' to not search the
+ * library path
+ *
+ * @Returns   false on failure, the ruleset is left as it was
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_engine_load_matcher(ruleset_t * rs, const char * so_file)
+{
+    const unsigned long long *hash;
+    const int *abi, *num_patterns;
+    url_matcher_verify_fn verify;
+    void *handle;
+
+    handle = dlopen(so_file, RTLD_NOW | RTLD_LOCAL);
+    if (NULL == handle) {
+        fprintf(stderr, "Could not load matcher %s: %s\n", so_file, dlerror());
+        return false;
+    }
+    abi = dlsym(handle, "url_matcher_abi");
+    hash = dlsym(handle, "url_matcher_hash");
+    num_patterns = dlsym(handle, "url_matcher_num_patterns");
+    *(void **)&verify = dlsym(handle, "url_matcher_verify");
+    if (!abi || !hash || !num_patterns || !verify || URL_MATCHER_ABI != *abi) {
+        fprintf(stderr, "%s is not a matcher of this url-engine\n", so_file);
+        dlclose(handle);
+        return false;
+    }
+    if (*num_patterns != rs->num_patterns || *hash != codegen_hash(rs)) {
+        fprintf(stderr, "Matcher %s was generated from another config, run codegen again\n", so_file);
+        dlclose(handle);
+        return false;
+    }
+
+    if (rs->matcher_handle) {
+        dlclose(rs->matcher_handle);
+    }
+    rs->matcher_handle = handle;
+    rs->matcher_verify = verify;
+    return true;
+}
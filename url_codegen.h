@@ -0,0 +1,22 @@
+#ifndef _URL_CODEGEN_H_
+#define _URL_CODEGEN_H_
+
+#include <stddef.h>
+
+/*
+ * Matcher generated by url-engine codegen and built as a shared object. It
+ * exports, by these names:
+ *  url_matcher_abi          - const int, URL_MATCHER_ABI it was generated for
+ *  url_matcher_hash         - const unsigned long long, codegen_hash() of the
+ *                             ruleset it was generated from
+ *  url_matcher_num_patterns - const int
+ *  url_matcher_verify       - url_matcher_verify_fn, the SELF verifier of a
+ *                             pattern: 1 on a match, else 0
+ * The engine loads it over a ruleset compiled from the same config and uses
+ * it in place of the SELF verifier.
+ */
+#define URL_MATCHER_ABI     1
+
+typedef int (*url_matcher_verify_fn)(const char * url, size_t url_len, size_t host_len, int id);
+
+#endif /* ifndef _URL_CODEGEN_H_ */
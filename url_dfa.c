@@ -0,0 +1,666 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "url_dfa.h"
+
+static unsigned int dfa_generation = 0;
+
+/*-----------------------------------------------------------------------------
+ |                          COMBINED NFA                                    |
+ |                                                                          |
+ |                                                                          |
+ |--------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to compile the SELF patterns into the NFA of each
+ * group. Each pattern is a chain of states, one per character plus an
+ * accept state. '*' and '|' states loop on themselves, a literal state
+ * moves to the next one.
+ *
+ * @Param patterns - SELF patterns, '|' being the wildcard before first '/',
+ * a NULL pattern is left out (it never matches)
+ * @Param num_patterns
+ * @Param group_of - group of each pattern, 0 .. num_groups-1 or -1 to leave
+ * it out
+ * @Param num_groups
+ *
+ * @Returns  NFA, NULL on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+dfa_t * dfa_compile(const char * const * patterns, int num_patterns, const int * group_of, int num_groups)
+{
+    dfa_t *dfa;
+    int p, g, i, j, n, len, s=0, total=0, *order, *first;
+    unsigned char *cls;
+
+    for (p=0;p<num_patterns;p++) {
+        total += (patterns[p] && group_of[p] >= 0) ? strlen(patterns[p]) + 1 : 0;
+    }
+
+    dfa = calloc(1, sizeof(dfa_t));
+    if (NULL == dfa) {
+        return NULL;
+    }
+    dfa->token = malloc(total ? total : 1);
+    dfa->ch = malloc(total ? total : 1);
+    dfa->pattern_id = malloc((total ? total : 1) * sizeof(int));
+    dfa->start = malloc((total ? total : 1) * sizeof(int));
+    dfa->group_state = malloc((num_groups + 1) * sizeof(int));
+    dfa->group_start = malloc((num_groups + 1) * sizeof(int));
+    dfa->num_classes = malloc((num_groups ? num_groups : 1) * sizeof(int));
+    dfa->classes = calloc(num_groups ? num_groups : 1, 256);
+    dfa->pattern_group = malloc((num_patterns ? num_patterns : 1) * sizeof(int));
+    order = malloc((num_patterns ? num_patterns : 1) * sizeof(int));
+    first = calloc(num_groups + 1, sizeof(int));
+    if (!dfa->token || !dfa->ch || !dfa->pattern_id || !dfa->start || !dfa->group_state ||
+            !dfa->group_start || !dfa->num_classes || !dfa->classes || !dfa->pattern_group ||
+            !order || !first) {
+        free(order);
+        free(first);
+        dfa_free(dfa);
+        return NULL;
+    }
+
+    /* patterns by group, config order within a group */
+    for (p=0;p<num_patterns;p++) {
+        dfa->pattern_group[p] = group_of[p];
+        if (group_of[p] >= 0) {
+            first[group_of[p] + 1]++;
+        }
+    }
+    for (g=0;g<num_groups;g++) {
+        first[g+1] += first[g];
+    }
+    for (p=0;p<num_patterns;p++) {
+        if (group_of[p] >= 0) {
+            order[first[group_of[p]]++] = p;
+        }
+    }
+
+    for (g=0, i=0;g<num_groups;g++) {
+        dfa->group_state[g] = s;
+        dfa->group_start[g] = dfa->num_start;
+        for (;i<first[g];i++) {
+            p = order[i];
+            if (!patterns[p]) {
+                continue;
+            }
+            len = strlen(patterns[p]);
+
+            /* start state of the pattern along with its epsilon closure */
+            dfa->start[dfa->num_start++] = s;
+            for (j=0;j<len && (patterns[p][j]=='*' || patterns[p][j]=='|');j++) {
+                dfa->start[dfa->num_start++] = s+j+1;
+            }
+
+            for (j=0;j<len;j++,s++) {
+                if (patterns[p][j] == '*') {
+                    dfa->token[s] = NFA_STAR;
+                } else if (patterns[p][j] == '|') {
+                    dfa->token[s] = NFA_BAR;
+                } else {
+                    dfa->token[s] = NFA_LITERAL;
+                }
+                dfa->ch[s] = patterns[p][j];
+                dfa->pattern_id[s] = p;
+            }
+            dfa->token[s] = NFA_ACCEPT;
+            dfa->ch[s] = '\0';
+            dfa->pattern_id[s] = p;
+            s++;
+        }
+
+        /* class 0 is every byte the group has no literal of, '/' ends a '|' */
+        cls = dfa->classes + (size_t)g * 256;
+        n = 1;
+        cls['/'] = n++;
+        for (j=dfa->group_state[g];j<s;j++) {
+            if (NFA_LITERAL == dfa->token[j] && !cls[dfa->ch[j]]) {
+                cls[dfa->ch[j]] = n++;
+            }
+        }
+        dfa->num_classes[g] = n;
+    }
+    dfa->group_state[num_groups] = s;
+    dfa->group_start[num_groups] = dfa->num_start;
+    free(order);
+    free(first);
+
+    dfa->num_states = s;
+    dfa->num_patterns = num_patterns;
+    dfa->num_groups = num_groups;
+    dfa->generation = dfa_new_generation();
+
+    return dfa;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get a generation for a new NFA, also used for one
+ * read back from a ruleset image
+ *
+ * @Returns   generation, never 0
+ */
+/* ----------------------------------------------------------------------------*/
+unsigned int dfa_new_generation()
+{
+    return __sync_add_and_fetch(&dfa_generation, 1);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the NFA
+ *
+ * @Param dfa
+ */
+/* ----------------------------------------------------------------------------*/
+void dfa_free(dfa_t * dfa)
+{
+    if (!dfa) {
+        return;
+    }
+    free(dfa->token);
+    free(dfa->ch);
+    free(dfa->pattern_id);
+    free(dfa->start);
+    free(dfa->group_state);
+    free(dfa->group_start);
+    free(dfa->num_classes);
+    free(dfa->classes);
+    free(dfa->pattern_group);
+    free(dfa);
+}
+
+/*-----------------------------------------------------------------------------
+ |                          LAZY DFA CACHE                                  |
+ |                                                                          |
+ |                                                                          |
+ |--------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to create an empty per thread DFA cache
+ *
+ * @Returns   cache, NULL on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+dfa_cache_t * dfa_cache_create()
+{
+    return calloc(1, sizeof(dfa_cache_t));
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the DFA of a group
+ *
+ * @Param gc
+ */
+/* ----------------------------------------------------------------------------*/
+static void group_cache_free(dfa_group_cache_t * gc)
+{
+    if (!gc) {
+        return;
+    }
+    free(gc->trans);
+    free(gc->set_off);
+    free(gc->set_len);
+    free(gc->acc_off);
+    free(gc->acc_len);
+    free(gc->set_hash);
+    free(gc->pool);
+    free(gc->hash);
+    free(gc);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to throw away the DFA of every group, they are built
+ * again as they are run
+ *
+ * @Param cache
+ */
+/* ----------------------------------------------------------------------------*/
+static void dfa_cache_flush(dfa_cache_t * cache)
+{
+    int g;
+
+    for (g=0;g<cache->num_groups;g++) {
+        group_cache_free(cache->groups[g]);
+        cache->groups[g] = NULL;
+    }
+    cache->num_states = 0;
+    cache->pool_used = 0;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the per thread DFA cache
+ *
+ * @Param cache
+ */
+/* ----------------------------------------------------------------------------*/
+void dfa_cache_free(dfa_cache_t * cache)
+{
+    if (!cache) {
+        return;
+    }
+    dfa_cache_flush(cache);
+    free(cache->groups);
+    free(cache->group_mark);
+    free(cache->run);
+    free(cache->mark);
+    free(cache->scratch);
+    free(cache->saved);
+    free(cache->matches);
+    free(cache);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to size the cache for a new NFA, called on the first
+ * use and when the NFA changed
+ *
+ * @Param cache
+ * @Param dfa
+ *
+ * @Returns   true on success
+ */
+/* ----------------------------------------------------------------------------*/
+static bool dfa_cache_reset(dfa_cache_t * cache, const dfa_t * dfa)
+{
+    int g, size = 1, groups = dfa->num_groups ? dfa->num_groups : 1;
+    void *p;
+
+    dfa_cache_flush(cache);
+    cache->num_groups = 0;
+    for (g=0;g<dfa->num_groups;g++) {
+        if (dfa->group_state[g+1] - dfa->group_state[g] > size) {
+            size = dfa->group_state[g+1] - dfa->group_state[g];
+        }
+    }
+
+    if (NULL == (p = realloc(cache->groups, groups * sizeof(dfa_group_cache_t *)))) return false;
+    cache->groups = p;
+    if (NULL == (p = realloc(cache->group_mark, groups * sizeof(unsigned int)))) return false;
+    cache->group_mark = p;
+    if (NULL == (p = realloc(cache->run, groups * sizeof(int)))) return false;
+    cache->run = p;
+    if (NULL == (p = realloc(cache->matches, (dfa->num_patterns ? dfa->num_patterns : 1) * sizeof(int)))) return false;
+    cache->matches = p;
+    if (size > cache->mark_size) {
+        if (NULL == (p = realloc(cache->mark, size * sizeof(unsigned int)))) return false;
+        cache->mark = p;
+        if (NULL == (p = realloc(cache->scratch, size * sizeof(int)))) return false;
+        cache->scratch = p;
+        if (NULL == (p = realloc(cache->saved, size * sizeof(int)))) return false;
+        cache->saved = p;
+        cache->mark_size = size;
+    }
+    memset(cache->groups, 0, groups * sizeof(dfa_group_cache_t *));
+    memset(cache->group_mark, 0, groups * sizeof(unsigned int));
+    memset(cache->mark, 0, cache->mark_size * sizeof(unsigned int));
+    cache->group_stamp = 0;
+    cache->stamp = 0;
+    cache->num_groups = dfa->num_groups;
+    cache->generation = dfa->generation;
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  FNV-1a hash of a sorted NFA state set
+ *
+ * @Param set
+ * @Param len
+ *
+ * @Returns   hash
+ */
+/* ----------------------------------------------------------------------------*/
+static inline unsigned int hash_set(const int * set, int len)
+{
+    unsigned int h = 2166136261u;
+    int i;
+
+    for (i=0;i<len;i++) {
+        h = (h ^ (unsigned int)set[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to check if the cache has room for one more state of
+ * len NFA states in a group, growing the arrays of the group while the
+ * whole cache is below its bounds
+ *
+ * @Param cache
+ * @Param gc
+ * @Param len
+ *
+ * @Returns   true if the state can be added
+ */
+/* ----------------------------------------------------------------------------*/
+static bool group_cache_reserve(dfa_cache_t * cache, dfa_group_cache_t * gc, int len)
+{
+    int i, max_states, pool_size, hash_size;
+    unsigned int slot;
+    void *p;
+
+    /* a single state always fits into an empty cache */
+    if (cache->num_states && (cache->num_states >= DFA_CACHE_MAX_STATES ||
+                cache->pool_used + 2*len > DFA_CACHE_MAX_NFA_IDS)) {
+        return false;
+    }
+
+    if (gc->num_states == gc->max_states) {
+        max_states = gc->max_states ? 2*gc->max_states : 16;
+        if (NULL == (p = realloc(gc->trans, (size_t)max_states * gc->num_classes * sizeof(int)))) return false;
+        gc->trans = p;
+        if (NULL == (p = realloc(gc->set_off, max_states * sizeof(int)))) return false;
+        gc->set_off = p;
+        if (NULL == (p = realloc(gc->set_len, max_states * sizeof(int)))) return false;
+        gc->set_len = p;
+        if (NULL == (p = realloc(gc->acc_off, max_states * sizeof(int)))) return false;
+        gc->acc_off = p;
+        if (NULL == (p = realloc(gc->acc_len, max_states * sizeof(int)))) return false;
+        gc->acc_len = p;
+        if (NULL == (p = realloc(gc->set_hash, max_states * sizeof(unsigned int)))) return false;
+        gc->set_hash = p;
+
+        /* the hash keeps at least half of its slots free */
+        hash_size = 2 * max_states;
+        if (NULL == (p = realloc(gc->hash, hash_size * sizeof(int)))) return false;
+        gc->hash = p;
+        gc->hash_mask = hash_size - 1;
+        memset(gc->hash, 0xff, hash_size * sizeof(int));
+        for (i=0;i<gc->num_states;i++) {
+            for (slot = gc->set_hash[i] & gc->hash_mask; gc->hash[slot] >= 0; slot = (slot+1) & gc->hash_mask);
+            gc->hash[slot] = i;
+        }
+        gc->max_states = max_states;
+    }
+
+    /* set and accepting pattern ids go into the pool */
+    if (gc->pool_used + 2*len > gc->pool_size) {
+        pool_size = gc->pool_size ? gc->pool_size : 256;
+        while (gc->pool_used + 2*len > pool_size) {
+            pool_size *= 2;
+        }
+        if (NULL == (p = realloc(gc->pool, pool_size * sizeof(int)))) return false;
+        gc->pool = p;
+        gc->pool_size = pool_size;
+    }
+
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add a new DFA state for the sorted NFA set
+ *
+ * @Param cache
+ * @Param gc
+ * @Param dfa
+ * @Param set
+ * @Param len
+ * @Param h - hash of the set
+ *
+ * @Returns   index of the new state
+ */
+/* ----------------------------------------------------------------------------*/
+static int group_cache_add(dfa_cache_t * cache, dfa_group_cache_t * gc, const dfa_t * dfa,
+        const int * set, int len, unsigned int h)
+{
+    int i, state = gc->num_states++, *acc, used = gc->pool_used;
+    unsigned int slot;
+
+    gc->set_off[state] = gc->pool_used;
+    gc->set_len[state] = len;
+    gc->set_hash[state] = h;
+    memcpy(gc->pool + gc->pool_used, set, len * sizeof(int));
+    gc->pool_used += len;
+
+    gc->acc_off[state] = gc->pool_used;
+    acc = gc->pool + gc->pool_used;
+    for (i=0;i<len;i++) {
+        if (NFA_ACCEPT == dfa->token[set[i]]) {
+            *acc++ = dfa->pattern_id[set[i]];
+        }
+    }
+    gc->acc_len[state] = acc - (gc->pool + gc->pool_used);
+    gc->pool_used += gc->acc_len[state];
+
+    memset(gc->trans + (size_t)state * gc->num_classes, 0xff, gc->num_classes * sizeof(int));
+    if (0 == len) {
+        gc->dead_row = state * gc->num_classes;
+    }
+
+    for (slot = h & gc->hash_mask; gc->hash[slot] >= 0; slot = (slot+1) & gc->hash_mask);
+    gc->hash[slot] = state;
+
+    cache->num_states++;
+    cache->pool_used += gc->pool_used - used;
+    return state;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to look up the DFA state of a sorted NFA set
+ *
+ * @Returns   state index or -1 when not cached
+ */
+/* ----------------------------------------------------------------------------*/
+static int group_cache_lookup(const dfa_group_cache_t * gc, const int * set, int len, unsigned int h)
+{
+    unsigned int slot;
+    int state;
+
+    for (slot = h & gc->hash_mask; (state = gc->hash[slot]) >= 0; slot = (slot+1) & gc->hash_mask) {
+        if (gc->set_hash[state] == h && gc->set_len[state] == len &&
+                !memcmp(gc->pool + gc->set_off[state], set, len * sizeof(int))) {
+            return state;
+        }
+    }
+    return -1;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to start the DFA of a group with its start state as
+ * state 0, the whole cache is flushed first when it is full
+ *
+ * @Param cache
+ * @Param dfa
+ * @Param g
+ *
+ * @Returns   DFA of the group, NULL on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static dfa_group_cache_t * group_cache_create(dfa_cache_t * cache, const dfa_t * dfa, int g)
+{
+    const int *start = dfa->start + dfa->group_start[g];
+    int len = dfa->group_start[g+1] - dfa->group_start[g];
+    dfa_group_cache_t *gc;
+
+    gc = calloc(1, sizeof(dfa_group_cache_t));
+    if (NULL == gc) {
+        return NULL;
+    }
+    gc->num_classes = dfa->num_classes[g];
+    gc->dead_row = -1;
+    if (!group_cache_reserve(cache, gc, len)) {
+        dfa_cache_flush(cache);
+        cache->flushes++;
+        if (!group_cache_reserve(cache, gc, len)) {
+            group_cache_free(gc);
+            return NULL;
+        }
+    }
+    group_cache_add(cache, gc, dfa, start, len, hash_set(start, len));
+    cache->groups[g] = gc;
+    return gc;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to build the transition of a DFA state of a group on
+ * character c by running the NFA states of the set. When the cache is full
+ * it is flushed, the caller takes cache->groups[g] again.
+ *
+ * @Param cache
+ * @Param dfa
+ * @Param g
+ * @Param state
+ * @Param c
+ *
+ * @Returns   row of the next state in trans, -1 on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static int dfa_step(dfa_cache_t * cache, const dfa_t * dfa, int g, int state, unsigned char c)
+{
+    dfa_group_cache_t *gc = cache->groups[g];
+    const int *set = gc->pool + gc->set_off[state];
+    int i, k, s, len = gc->set_len[state], n = 0, next, base = dfa->group_state[g];
+    int *out = cache->scratch;
+    unsigned int h;
+
+    if (0 == ++cache->stamp) {
+        memset(cache->mark, 0, cache->mark_size * sizeof(unsigned int));
+        cache->stamp = 1;
+    }
+
+    for (i=0;i<len;i++) {
+        s = set[i];
+        switch (dfa->token[s]) {
+            case NFA_LITERAL:
+                if (dfa->ch[s] != c) {
+                    continue;
+                }
+                s++;
+                break;
+            case NFA_STAR:
+                break;
+            case NFA_BAR:
+                if ('/' == c) {
+                    continue;
+                }
+                break;
+            default:
+                continue;
+        }
+
+        /* add the state along with its epsilon closure */
+        for (;;) {
+            if (cache->mark[s - base] != cache->stamp) {
+                cache->mark[s - base] = cache->stamp;
+                /* output is nearly sorted, insertion keeps it sorted */
+                for (k=n++;k>0 && out[k-1]>s;k--) {
+                    out[k] = out[k-1];
+                }
+                out[k] = s;
+            }
+            if (NFA_STAR != dfa->token[s] && NFA_BAR != dfa->token[s]) {
+                break;
+            }
+            s++;
+        }
+    }
+
+    h = hash_set(out, n);
+    next = group_cache_lookup(gc, out, n, h);
+    if (next < 0) {
+        if (!group_cache_reserve(cache, gc, n)) {
+            /* cache is full, start over keeping only the start states */
+            memcpy(cache->saved, out, n * sizeof(int));
+            dfa_cache_flush(cache);
+            cache->flushes++;
+            if (NULL == (gc = group_cache_create(cache, dfa, g)) || !group_cache_reserve(cache, gc, n)) {
+                return -1;
+            }
+            return group_cache_add(cache, gc, dfa, cache->saved, n, h) * gc->num_classes;
+        }
+        next = group_cache_add(cache, gc, dfa, out, n, h);
+    }
+
+    gc->trans[(size_t)state * gc->num_classes + dfa->classes[(size_t)g * 256 + c]] = next * gc->num_classes;
+    return next * gc->num_classes;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to match the url against the patterns of the groups
+ * holding one of ids, one left to right scan per group
+ *
+ * @Param cache - DFA cache of the calling thread
+ * @Param dfa
+ * @Param url
+ * @Param len
+ * @Param ids - patterns that may match, e.g. the prefilter candidates: every
+ *              matching pattern of the NFA has to be in a group of one,
+ *              NULL to run every group
+ * @Param num_ids
+ * @Param matches - ids of the matching patterns of the NFA in no order,
+ *                  valid till the next call on the cache
+ *
+ * @Returns   number of matching patterns, -1 on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+int dfa_match(dfa_cache_t * cache, const dfa_t * dfa, const char * url, size_t len,
+        const int * ids, int num_ids, const int ** matches)
+{
+    const unsigned char *cls;
+    const dfa_group_cache_t *gc;
+    const int *trans;
+    int i, g, r, row, next, num_run = 0, num_matches = 0;
+    size_t j;
+
+    if (cache->generation != dfa->generation && !dfa_cache_reset(cache, dfa)) {
+        return -1;
+    }
+
+    if (0 == ++cache->group_stamp) {
+        memset(cache->group_mark, 0, cache->num_groups * sizeof(unsigned int));
+        cache->group_stamp = 1;
+    }
+    for (i=0;!ids && i<dfa->num_groups;i++) {
+        cache->run[num_run++] = i;
+    }
+    for (i=0;ids && i<num_ids;i++) {
+        g = dfa->pattern_group[ids[i]];
+        if (g >= 0 && cache->group_mark[g] != cache->group_stamp) {
+            cache->group_mark[g] = cache->group_stamp;
+            cache->run[num_run++] = g;
+        }
+    }
+
+    for (r=0;r<num_run;r++) {
+        g = cache->run[r];
+        if (NULL == (gc = cache->groups[g]) && NULL == (gc = group_cache_create(cache, dfa, g))) {
+            return -1;
+        }
+        cls = dfa->classes + (size_t)g * 256;
+        trans = gc->trans;
+        row = 0;
+        for (j=0;j<len && row != gc->dead_row;j++) {
+            next = trans[row + cls[(unsigned char)url[j]]];
+            if (next < 0) {
+                if ((next = dfa_step(cache, dfa, g, row / gc->num_classes, url[j])) < 0) {
+                    return -1;
+                }
+                gc = cache->groups[g];
+                trans = gc->trans;
+            }
+            row = next;
+        }
+        row /= gc->num_classes;
+        memcpy(cache->matches + num_matches, gc->pool + gc->acc_off[row], gc->acc_len[row] * sizeof(int));
+        num_matches += gc->acc_len[row];
+    }
+
+    *matches = cache->matches;
+    return num_matches;
+}
@@ -0,0 +1,116 @@
+#ifndef _URL_DFA_H_
+#define _URL_DFA_H_
+
+#include <stddef.h>
+
+/* Patterns put in one group by the caller of dfa_compile() */
+#define DFA_GROUP_PATTERNS      8
+/* Up to this many groups a url runs them all, a prefilter scan to pick them
+ * costs more */
+#define DFA_UNGATED_GROUPS      4
+/* Upper bound of DFA states cached by each thread, all the groups together,
+ * before the cache is flushed */
+#define DFA_CACHE_MAX_STATES    (64 * 1024)
+/* Upper bound of NFA state ids held by the cached DFA states */
+#define DFA_CACHE_MAX_NFA_IDS   (4 << 20)
+
+typedef enum nfa_token{
+    NFA_LITERAL=0,
+    NFA_STAR,       /* '*' - any run of characters */
+    NFA_BAR,        /* '|' - any run of characters without '/' */
+    NFA_ACCEPT      /* end of the pattern */
+}NFA_TOKEN;
+
+/*! \struct _dfa_t
+ *  NFA of the SELF patterns, shared read only by the threads. The patterns
+ *  are split in groups, each group is a separate automaton run only on the
+ *  urls where one of its patterns may match. A pattern starting with '*'
+ *  stays alive in every state of its automaton, a small group keeps the
+ *  states small and few.
+ *  NFA state base+j of a pattern means its first j tokens are matched, the
+ *  states of group g are group_state[g] .. group_state[g+1]-1 and its start
+ *  states start[group_start[g]] .. start[group_start[g+1]-1].
+ *  pattern_group - group of each pattern, -1 when it is in none; a pattern
+ *                  left out of the NFA (NULL) can share the group of its twin
+ *  classes - 256 bytes per group: the byte class of each character, the
+ *            bytes no pattern of the group tells apart share a class
+ *  generation - unique id so that a thread cache built for an older
+ *               ruleset is thrown away
+ */
+typedef struct _dfa_t {
+    unsigned int generation;
+    int num_patterns;
+    int num_states;
+    unsigned char *token;
+    unsigned char *ch;
+    int *pattern_id;
+    int num_start;
+    int *start;
+    int num_groups;
+    int *group_state;
+    int *group_start;
+    int *num_classes;
+    unsigned char *classes;
+    int *pattern_group;
+} dfa_t;
+
+/*! \struct _dfa_group_cache_t
+ *  Lazily built DFA of one group. Each DFA state is a sorted set of NFA
+ *  states kept in pool along with the ids of the patterns it accepts.
+ *  trans - num_states x num_classes transitions, each the row of the next
+ *          state (state x num_classes), -1 when not built yet
+ *  dead_row - row of the state with no NFA state left, -1 until built
+ */
+typedef struct _dfa_group_cache_t {
+    int num_states;
+    int max_states;
+    int num_classes;
+    int *trans;
+    int dead_row;
+    int *set_off;
+    int *set_len;
+    int *acc_off;
+    int *acc_len;
+    unsigned int *set_hash;
+    int *pool;
+    int pool_used;
+    int pool_size;
+    int *hash;
+    int hash_mask;
+} dfa_group_cache_t;
+
+/*! \struct _dfa_cache_t
+ *  DFA states of the groups, owned by one thread. A group gets its cache
+ *  the first time it is run.
+ *  group_mark - group_stamp when the group is to be run for the url
+ *  run - groups to run for the url
+ *  num_states, pool_used - of all the groups, bounded by
+ *  DFA_CACHE_MAX_STATES and DFA_CACHE_MAX_NFA_IDS
+ */
+typedef struct _dfa_cache_t {
+    unsigned int generation;
+    int num_groups;
+    dfa_group_cache_t **groups;
+    unsigned int *group_mark;
+    unsigned int group_stamp;
+    int *run;
+    int num_states;
+    long pool_used;
+    unsigned int *mark;
+    unsigned int stamp;
+    int *scratch;
+    int *saved;
+    int mark_size;
+    int *matches;
+    long flushes;
+} dfa_cache_t;
+
+dfa_t * dfa_compile(const char * const * patterns, int num_patterns, const int * group_of, int num_groups);
+void dfa_free(dfa_t * dfa);
+unsigned int dfa_new_generation();
+dfa_cache_t * dfa_cache_create();
+void dfa_cache_free(dfa_cache_t * cache);
+int dfa_match(dfa_cache_t * cache, const dfa_t * dfa, const char * url, size_t len,
+        const int * ids, int num_ids, const int ** matches);
+
+#endif /* ifndef _URL_DFA_H_ */
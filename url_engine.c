@@ -1,710 +1,1748 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include <libxml/parser.h>
-#include <regex.h>
-#include <time.h>
 #include "url_engine.h"
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <unistd.h>
+#include <stdatomic.h>
+#include "url_queue.h"
+#include "url_output.h"
+#include "url_input.h"
+#include "url_epoch.h"
+#include "url_bench.h"
+#include "url_cache.h"
+#include "url_serve.h"
+#include "url_stats.h"
+#include "url_steal.h"
+#include "url_stream.h"
 #include <semaphore.h>
-
-pattern_t config_pattern[SET_MAX_SIZE];
-int num_sets=0;
-bool debug_enabled=false;
-bool is_sighandler_rcvd=false;
-bool is_thread_finished = false;
-bool fileRead_end = false;
+#include <errno.h>
+#include <fcntl.h>
+
+/* current ruleset, swapped as a whole on reload and read under an epoch */
+_Atomic(url_engine_t *) ruleset = NULL;
+epoch_t *ruleset_epoch = NULL;
+atomic_bool fileRead_end = false;
+/* the URL stream waits for its source, the writer flushes what it has */
+atomic_bool input_idle = false;
 char *configFile;
+/* posted by the SIGUSR1 and SIGUSR2 handlers, waited on by the reload thread */
+sem_t reload_sem;
+atomic_bool reload_exit = false;
+atomic_bool reload_wanted = false;
+atomic_bool stats_wanted = false;
 
 
-pthread_mutex_t lock;
-
 struct thread_info { 
 	pthread_t thread_id;
 	int       thread_num;
 	MATCH_TYPE algo;
+	bool      timed;
+	size_t    url_cache_bytes;
+	url_engine_scratch_t *scratch;
+	out_buf_t *out;
+	int reader;
+	const url_engine_t *rs;
+	bench_hist_t *hist;
+	url_cache_t *url_cache;
+	/* held while matching when the stats are on, the stats read the scratch under it */
+	pthread_mutex_t stats_lock;
+	unsigned long long read_ns, match_ns, output_ns, urls;
 };
 
 
-#define NUM_BUFFERS 100
-sem_t empty_sem, full_sem;
-char buffer[NUM_BUFFERS][BUFF_SIZE];
-int buffer_index;
-pthread_mutex_t buffer_lock;
+/* URL batches in flight between the file reader and the workers, power of 2 */
+#define NUM_BATCHES 64
+url_queue_t *work_queue, *free_queue, *done_queue;
+atomic_bool workers_end = false;
+atomic_int workers_running;
+/* a thread of the match could not be started, the others stop at their
+ * next batch */
+atomic_bool match_stop = false;
+bool ordered_output = false;
+/* mapped URL file, NULL when the URLs are read through the file reader */
+url_input_t *url_input = NULL;
+atomic_long next_chunk = 0;
+/* chunks of the mapped URL file per worker, stolen by the idle workers.
+ * NULL with ordered output, the chunks are then taken in order from next_chunk */
+steal_pool_t *chunk_pool = NULL;
+/* workers pinned one per cpu, "affinity" option */
+bool pin_threads = false;
+/* results go to output_fd, the bench sends them to /dev/null */
+int output_fd = STDOUT_FILENO;
+unsigned long long output_bytes = 0;
+/* how much of the match is printed, "mode" option */
+MATCH_MODE match_mode = MATCH_ALL;
+static const char *mode_names[] = { "all", "any", "first", "boolean" };
+static const char *algo_names[] = { "posix", "self", "dfa", "native" };
+/* generated matcher loaded over every ruleset of the native algorithm, NULL
+ * with the other algorithms, "matcher" option */
+const char *matcher_file = NULL;
+#define DEFAULT_MATCHER "./url_matcher.so"
+/* URL_NORMALIZE_* of the urls before the match, "normalize" option */
+int normalize_flags = 0;
+/* debug prints of the threads, the ruleset and the scratches,
+ * "debug_enable" option */
+bool debug_enabled = false;
+/* memory of the url result cache of all the threads, 0 when off */
+size_t url_cache_bytes = 0;
+url_cache_t url_cache_total;
+/* file of the stats, written at the end and on SIGUSR2, NULL when off */
+const char *stats_file = NULL;
+int stats_top = URL_STATS_TOP;
+stage_stats_t stage_stats;
+/* threads of the match in progress for the stats, the ruleset is not freed
+ * while the stats hold the lock */
+pthread_mutex_t stats_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+struct thread_info *stats_threads = NULL;
+int stats_num_threads = 0;
+MATCH_TYPE stats_algo;
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Function to read the pattern from config.xml and save in pattern structure 
+ * @Synopsis  Function to read the clock of the stage stats
  *
- * @Param doc
- * @Param a_node
+ * @Returns   ns, 0 when the stats are off
  */
 /* ----------------------------------------------------------------------------*/
-static void construct_pattern_from_xml(xmlDocPtr doc, xmlNodePtr  a_node)
+static inline unsigned long long stats_clock()
 {
-    xmlNodePtr temp, cur_node = NULL;
-    xmlAttrPtr attr; 
-    xmlChar * key;
+    return stats_file ? bench_now_ns() : 0;
+}
 
-    int set=0, i=0;
-    memset(config_pattern, 0, sizeof(config_pattern));
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add the time since start to a stage
+ *
+ * @Param counter - of stage_stats
+ * @Param start - stats_clock()
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void stats_since(atomic_ullong * counter, unsigned long long start)
+{
+    if (stats_file) {
+        stage_stats_add(counter, bench_now_ns() - start);
+    }
+}
 
-    for (cur_node = a_node; cur_node; cur_node = cur_node->next) {
-        if (cur_node->type == XML_ELEMENT_NODE) {
-            TM_PRINTF("node type: Element, name: %s\n", cur_node->name);
-            if ((!xmlStrcmp(cur_node->name, (const xmlChar *)"set"))) {
-                    attr = cur_node->properties;
-                    i =0;
-                    if (attr)
-                    {
-                        TM_PRINTF( "Attribute name: %s value: %d\n", attr->name ,set);
-                        config_pattern[set].key = atoi((char*)attr->children->content);;
-                    }
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to print the url match pattern into the output buffer
+ * of the thread, no lock is needed
+ *
+ * @Param out
+ * @Param url
+ * @Param url_len
+ * @Param match_pattern
+ * @Param pattern_len
+ * @Param key - id of the set
+ * @Param is_first_pattern_match
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void print_url_match_pattern(out_buf_t * out, const char *url, size_t url_len,
+        const char * match_pattern, int pattern_len, int key, bool *is_first_pattern_match)
+{
+    bool ok = true;
 
-                    temp = cur_node;
-                    cur_node = cur_node->xmlChildrenNode;
-                    while(cur_node){
-                        if ((!xmlStrcmp(cur_node->name, (const xmlChar *)"pattern"))) {
-                            key = xmlNodeListGetString(doc, cur_node->xmlChildrenNode, 1);
-                            TM_PRINTF("name %s: keyword: %s\n", cur_node->name, key);
-                            config_pattern[set].pattern[i] = (char*) calloc(PATTERN_STRING_MAX_LENGTH, sizeof(char));
-                            strncpy(&config_pattern[set].pattern[i][0],(char*)key,PATTERN_STRING_MAX_LENGTH);
-                            i++;
-                            xmlFree(key);
-                        }
-                        cur_node = cur_node->next;
-                    }
-                    config_pattern[set].num_patterns = i; 
-                    cur_node = temp; 
-                    set++;
-            } 
-        }
+    if (*is_first_pattern_match){
+        ok = out_buf_append(out, "url: ", 5) && out_buf_append(out, url, url_len) &&
+            out_buf_append(out, ",", 1);
+        *is_first_pattern_match = false;
+    }
+    ok = ok && out_buf_append(out, " pattern: ", 10) &&
+        out_buf_append(out, match_pattern, pattern_len) &&
+        out_buf_append(out, ", set: ", 7) && out_buf_append_int(out, key);
+    if (!ok) {
+        fprintf(stderr, "Output buffer allocation failed\n");
+        exit(1);
     }
-
-    num_sets = set;
 }
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Function to free the memory allocated for each pattern in config.xml
+ * @Synopsis  Function to end the line of a url having matches
+ *
+ * @Param out
  */
 /* ----------------------------------------------------------------------------*/
-static inline void free_pattern_allocated_memory()
+static inline void print_url_match_end(out_buf_t * out)
 {
-    int i,j;
-    
-    for (i = 0;i<num_sets;i++) {
-        for (j=0;j<config_pattern[i].num_patterns; j++) {
-            free(config_pattern[i].pattern[j]);
-        }
+    if (!out_buf_append(out, "\n", 1)) {
+        fprintf(stderr, "Output buffer allocation failed\n");
+        exit(1);
     }
 }
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Function to print the saved xml config
+ * @Synopsis  Function to print the matching patterns of a url. In boolean
+ * mode only the url is printed.
+ *
+ * @Param out
+ * @Param url
+ * @Param url_len
+ * @Param rs
+ * @Param ids - matching pattern ids in config order
+ * @Param num_ids
  */
 /* ----------------------------------------------------------------------------*/
-static void print_xml_pattern()
+static void print_url_matches(out_buf_t * out, const char * url, size_t url_len,
+        const url_engine_t * rs, const int * ids, int num_ids)
 {
-    int i,j;
-    
-    TM_PRINTF("print_xml_pattern\n");
-    for (i=0;i<num_sets; i++){
-        TM_PRINTF("set %d: ", config_pattern[i].key);
-        for(j=0;j<config_pattern[i].num_patterns;j++){
-            TM_PRINTF("%s ", config_pattern[i].pattern[j]);
+    const char *pattern;
+    bool is_first_pattern_match = true;
+    int i, key, pattern_len;
+
+    if (MATCH_BOOLEAN == match_mode) {
+        if (num_ids && !(out_buf_append(out, "url: ", 5) && out_buf_append(out, url, url_len) &&
+                    out_buf_append(out, "\n", 1))) {
+            fprintf(stderr, "Output buffer allocation failed\n");
+            exit(1);
         }
+        return;
+    }
+
+    for (i=0;i<num_ids;i++){
+        pattern = url_engine_pattern(rs, ids[i], &key, &pattern_len);
+        print_url_match_pattern(out, url, url_len, pattern, pattern_len, key, &is_first_pattern_match);
+    }
+    if (false==is_first_pattern_match) {
+        print_url_match_end(out);
     }
-    TM_PRINTF("\n");
 }
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Function to create a new pattern from the pattern read from config.xml
- *  1. Removes consecutive wildcard characters
- *  2. In the case of POSIX algorithm add ^ and $ to do the fullmatch with url
- * @Param pattern
- * @Param new_pattern
- * @Param match_type
+ * @Synopsis  Function to pin the current ruleset for the thread. A reload
+ * won't free it till the thread calls ruleset_release().
+ *
+ * @Param tinfo
  */
 /* ----------------------------------------------------------------------------*/
-static void create_new_pattern(const char * pattern, char * new_pattern, MATCH_TYPE match_type)
+static inline void ruleset_acquire(struct thread_info * tinfo)
 {
-    int i=0, writeIndex=0, pattern_len = strlen(pattern);
-    bool isFirst = true;
+    epoch_enter(ruleset_epoch, tinfo->reader);
+    tinfo->rs = atomic_load(&ruleset);
+}
 
-    memset(new_pattern,0 , PATTERN_STRING_MAX_LENGTH);
-    
-    if (POSIX == match_type){
-        new_pattern[writeIndex++] = '^';
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to unpin the ruleset of the thread
+ *
+ * @Param tinfo
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void ruleset_release(struct thread_info * tinfo)
+{
+    tinfo->rs = NULL;
+    epoch_exit(ruleset_epoch, tinfo->reader);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Wrapper that is called from main to do the URL pattern match.
+ * With the url cache on a repeated url is answered from the cache, the
+ * cache entries of an older ruleset don't match after a reload.
+ *
+ * @Param url - one line without the '\n', not NUL terminated
+ * @Param url_len
+ * @Param tinfo
+ */
+/* ----------------------------------------------------------------------------*/
+static void pattern_match(const char * url, size_t url_len, struct thread_info * tinfo)
+{
+    const url_engine_t *rs = tinfo->rs;
+    const int *matches = NULL;
+    int num_matches = -1;
+    unsigned long long hash = 0, start, matched;
+
+    if (url == NULL) {
+        fprintf(stderr, "URL NULL, threadid %d\n", tinfo->thread_num);
+        return;
     }
+    TM_PRINTF(debug_enabled, "Enter thread: %d\n", tinfo->thread_num);
 
-    for ( i = 0 ; i < pattern_len; i++) {
-        if (pattern[i] == '*') {
-            if (isFirst) {
-                new_pattern[writeIndex++] = pattern[i]; 
-                isFirst = false;
-            } 
-        } else {
-                new_pattern[writeIndex++] = pattern[i];
-                isFirst = true;
+    start = stats_clock();
+    if (tinfo->url_cache) {
+        hash = url_cache_hash(url, url_len);
+        num_matches = url_cache_lookup(tinfo->url_cache, url_engine_generation(rs), url, url_len, hash, &matches);
+    }
+
+    if (num_matches < 0) {
+        num_matches = url_engine_match_ids(rs, tinfo->scratch, url, url_len, &matches);
+        if (num_matches < 0) {
+            fprintf(stderr, "URL match failed, threadid %d\n", tinfo->thread_num);
+            exit(1);
+        }
+        if (tinfo->url_cache) {
+            url_cache_insert(tinfo->url_cache, url_engine_generation(rs), url, url_len, hash, matches, num_matches);
         }
     }
 
-    if (POSIX == match_type) {
-        new_pattern[writeIndex++] = '$';
+    matched = stats_clock();
+    print_url_matches(tinfo->out, url, url_len, rs, matches, num_matches);
+    if (stats_file) {
+        tinfo->match_ns += matched - start;
+        tinfo->output_ns += bench_now_ns() - matched;
+        tinfo->urls++;
     }
 }
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Function to print the url match pattern
+ * @Synopsis  Function to start matching in a thread, its profile is not
+ * read by the stats meanwhile
  *
- * @Param url
- * @Param match_pattern
- * @Param set
- * @Param is_first_pattern_match
+ * @Param tinfo
  */
 /* ----------------------------------------------------------------------------*/
-static inline void print_url_match_pattern(const char *url, const char * match_pattern, int set, bool *is_first_pattern_match)
+static inline void stats_begin(struct thread_info * tinfo)
 {
-    pthread_mutex_lock(&lock);
-    if (*is_first_pattern_match){
-        printf("url: %s,", url);
-        *is_first_pattern_match = false;
+    if (stats_file) {
+        pthread_mutex_lock(&tinfo->stats_lock);
     }
-    printf(" pattern: %s, set: %d", match_pattern, config_pattern[set].key);
-    pthread_mutex_unlock(&lock);
 }
 
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to end matching in a thread, its stage times go to
+ * the stage stats
+ *
+ * @Param tinfo
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void stats_end(struct thread_info * tinfo)
+{
+    if (!stats_file) {
+        return;
+    }
+    stage_stats_add(&stage_stats.read_ns, tinfo->read_ns);
+    stage_stats_add(&stage_stats.match_ns, tinfo->match_ns);
+    stage_stats_add(&stage_stats.output_ns, tinfo->output_ns);
+    stage_stats_add(&stage_stats.urls, tinfo->urls);
+    tinfo->read_ns = tinfo->match_ns = tinfo->output_ns = tinfo->urls = 0;
+    pthread_mutex_unlock(&tinfo->stats_lock);
+}
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis Function used to check if the pattern needs to be changed for regex
- * matching. Also the wildcard index before the /delimiter is returned.
- * Case POSIX: return true 
- * case SELF: return true if wildcard present else no change needed
- * @Param pattern
- * @Param wildcard_index
- * @Param match_type
+ * @Synopsis  Function to match every line of a chunk of the mapped URL file
+ * in place. The bench gives a histogram to time each URL.
  *
- * @Returns  true or false 
+ * @Param chunk
+ * @Param tinfo
  */
 /* ----------------------------------------------------------------------------*/
-static bool match_needs_pattern_change(const char * pattern, int * wildcard_index, MATCH_TYPE match_type)
+static void chunk_pattern_match(long chunk, struct thread_info * tinfo)
 {
-    char * wildcard_ch, *last_wildcard_ch ,* delim_ch;
+    const char *pos = url_input->data + url_input->chunk_off[chunk];
+    const char *end = url_input->data + url_input->chunk_off[chunk + 1];
+    const char *url;
+    size_t url_len;
+    unsigned long long start;
+
+    while (pos < end) {
+        url = url_input_next_line(&pos, end, &url_len);
+        if (tinfo->hist) {
+            start = bench_now_ns();
+            pattern_match(url, url_len, tinfo);
+            bench_hist_record(tinfo->hist, bench_now_ns() - start);
+        } else {
+            pattern_match(url, url_len, tinfo);
+        }
+    }
+}
 
-    delim_ch = strchr(pattern,'/');
-    wildcard_ch = strchr(pattern,'*');
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to pin the calling thread to the n-th cpu it may run
+ * on, wrapping around past the last one
+ *
+ * @Param n
+ */
+/* ----------------------------------------------------------------------------*/
+static void pin_thread(int n)
+{
+    cpu_set_t allowed, set;
+    int cpu;
 
-    if ((0 != wildcard_ch) && 
-            ((0==delim_ch) || ((wildcard_ch - delim_ch) <0))) {
-        while(wildcard_ch && (!delim_ch ||(wildcard_ch<delim_ch))) {
-            last_wildcard_ch = wildcard_ch;
-            wildcard_ch = strchr(wildcard_ch+1, '*');
-        }
-        *wildcard_index = last_wildcard_ch - pattern;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) || !CPU_COUNT(&allowed)) {
+        return;
     }
+    n %= CPU_COUNT(&allowed);
+    for (cpu = 0; cpu < CPU_SETSIZE && !(CPU_ISSET(cpu, &allowed) && 0 == n--); cpu++);
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+        fprintf(stderr, "Could not pin thread to cpu %d\n", cpu);
+    }
+}
 
-    return (POSIX==match_type) ? true: (*wildcard_index != -1) ;
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to create the scratch, url cache and histogram of a
+ * thread. A worker calls it once pinned: the memory is first written by the
+ * thread using it and so comes from its NUMA node.
+ *
+ * @Param tinfo
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool thread_setup(struct thread_info * tinfo)
+{
+    url_engine_scratch_t *scratch = url_engine_scratch_create(tinfo->algo);
+
+    if (NULL == scratch) {
+        return false;
+    }
+    url_engine_scratch_set_mode(scratch, match_mode);
+    url_engine_scratch_set_normalize(scratch, normalize_flags);
+    url_engine_scratch_set_profile(scratch, NULL != stats_file);
+    url_engine_scratch_set_debug(scratch, debug_enabled);
+    tinfo->hist = tinfo->timed ? calloc(1, sizeof(bench_hist_t)) : NULL;
+    tinfo->url_cache = tinfo->url_cache_bytes ? url_cache_create(tinfo->url_cache_bytes) : NULL;
+
+    /* the stats may read the scratch from now on */
+    pthread_mutex_lock(&tinfo->stats_lock);
+    tinfo->scratch = scratch;
+    pthread_mutex_unlock(&tinfo->stats_lock);
+    return !(tinfo->timed && !tinfo->hist) && !(tinfo->url_cache_bytes && !tinfo->url_cache);
 }
 
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  worker thread that does the pattern match on a batch of URLs.
+ * With the URL file mapped the worker takes a free batch and claims the next
+ * chunk of the file for it, else the batch comes filled from the work queue.
+ * The chunks of a worker are its own range of the file, once it is done the
+ * worker steals half of the largest range left (url_steal.h), so a range
+ * of costly urls is shared out. With ordered output the chunks are taken in
+ * file order instead, the writer holds back at most NUM_BATCHES of them.
+ * The results are formatted into the output buffer of the batch, the batch
+ * then goes to the writer.
+ * A whole batch is matched with the ruleset current when it started.
+ * @Param arg
+ *
+ * @Returns   
+ */
+/* ----------------------------------------------------------------------------*/
+void *worker_thread(void * arg){
+    struct thread_info * tinfo = arg;
+    url_batch_t * batch;
+    void * data;
+    unsigned long long start;
+    int i;
+
+    TM_PRINTF(debug_enabled, "Worker Thread num: %d\n", tinfo->thread_num);
+    if (pin_threads) {
+        pin_thread(tinfo->thread_num - 1);
+    }
+    if (!thread_setup(tinfo)) {
+        fprintf(stderr, "Worker allocation failed, threadid %d\n", tinfo->thread_num);
+        exit(1);
+    }
+    for (;;) {
+        start = stats_clock();
+        if (url_input) {
+            /* batch first, then the chunk: chunks in flight stay below NUM_BATCHES apart */
+            if (!url_queue_pop_wait(free_queue, &data, &match_stop)) {
+                break;
+            }
+            batch = data;
+            if (atomic_load(&match_stop)) {
+                url_queue_push_wait(free_queue, batch);
+                break;
+            } else if (chunk_pool) {
+                if (!steal_pool_next(chunk_pool, tinfo->reader, &batch->seq)) {
+                    url_queue_push_wait(free_queue, batch);
+                    break;
+                }
+            } else if ((batch->seq = atomic_fetch_add(&next_chunk, 1)) >= url_input->num_chunks) {
+                url_queue_push_wait(free_queue, batch);
+                break;
+            }
+        } else if (url_queue_pop_wait(work_queue, &data, &fileRead_end)) {
+            batch = data;
+        } else {
+            break;
+        }
+        stats_since(&stage_stats.queue_ns, start);
+        batch->out.len = 0;
+        tinfo->out = &batch->out;
+        stats_begin(tinfo);
+        ruleset_acquire(tinfo);
+        if (url_input) {
+            chunk_pattern_match(batch->seq, tinfo);
+        } else {
+            for (i=0;i<batch->count;i++) {
+                pattern_match(batch->data + batch->url_off[i], batch->url_len[i], tinfo);
+            }
+        }
+        ruleset_release(tinfo);
+        stats_end(tinfo);
+        start = stats_clock();
+        url_queue_push_wait(done_queue, batch);
+        stats_since(&stage_stats.queue_ns, start);
+    }
 
+    /* the last worker out tells the writer that no more batches are coming */
+    if (1 == atomic_fetch_sub(&workers_running, 1)) {
+        atomic_store(&workers_end, true);
+        url_queue_wake(done_queue);
+    }
+    TM_PRINTF(debug_enabled, "exit thread: %d\n ", tinfo->thread_num); 
+    pthread_exit(0);
+}
 
-/*-----------------------------------------------------------------------------
- |                          POSIX ALGO FUNCTIONS                            |
- |                                                                          |
- |                                                                          |
- |--------------------------------------------------------------------------|
-*/
+/*! \struct _fileRead_state_t
+ *  Batch being filled by the fileRead thread and the seq of the next one
+ */
+typedef struct _fileRead_state_t {
+    url_batch_t *batch;
+    long seq;
+} fileRead_state_t;
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Function to identify special characters 
+ * @Synopsis  Function to take a free batch for the fileRead thread
  *
- * @Param ch
+ * @Param state
  *
- * @Returns   true or false
+ * @Returns   false when the match is stopped before a batch is free
  */
 /* ----------------------------------------------------------------------------*/
-static inline bool regex_special_characters(char ch)
+static bool fileRead_batch(fileRead_state_t * state)
 {
-    return ( ('.'==ch) || ('?'==ch) || ('\\'==ch) ||
-            ('|'==ch) || ('+'==ch) ||  ('('==ch) || (')'==ch) ); // || ('^'==ch) || ('$'==ch));
+    unsigned long long start = stats_clock();
+    void *data;
+
+    if (!url_queue_pop_wait(free_queue, &data, &match_stop)) {
+        return false;
+    }
+    stats_since(&stage_stats.queue_ns, start);
+    state->batch = data;
+    state->batch->seq = state->seq++;
+    state->batch->count = 0;
+    state->batch->used = 0;
+    return true;
 }
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Function to modify the POSIX pattern for according to regex matching
+ * @Synopsis  Stream idle callback of the fileRead thread: the batch is handed
+ * over as it is, empty when there is none, so that the writer gets to the
+ * end of the input read so far and flushes it
  *
- * @Param old_pattern
- * @Param new_pattern
- * @Param wildcard_index
+ * @Param arg - fileRead_state_t
  */
 /* ----------------------------------------------------------------------------*/
-static void modify_posix_pattern_string(const char * old_pattern, char * new_pattern, int wildcard_index)
+static void fileRead_idle(void * arg)
 {
-    int old_index=0, new_index=0, old_len = strlen(old_pattern);
+    fileRead_state_t *state = arg;
 
-    while(old_index<old_len) {
-        /* if special character */
-        if (regex_special_characters(old_pattern[old_index]) ){
-            new_pattern[new_index++] = '\\';
-            new_pattern[new_index++] = old_pattern[old_index];
-        } /* wildcard after delimiter */
-        else if (old_pattern[old_index]=='*' && old_index > wildcard_index){
-            new_pattern[new_index++] = '.';
-            new_pattern[new_index++] = '*';
-        } /* wildcard before delimiter */ 
-        else if (old_pattern[old_index]=='*' && old_index <= wildcard_index) {
-            strncpy(&new_pattern[new_index], "[^\\/]*",6);
-            new_index += 6;
-        } else {
-            new_pattern[new_index++] = old_pattern[old_index];
+    if (NULL == state->batch && !fileRead_batch(state)) {
+        return;
+    }
+    /* before the push: the writer sees it with the batch */
+    atomic_store(&input_idle, true);
+    url_queue_push_wait(work_queue, state->batch);
+    state->batch = NULL;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  fileRead thread that reads the lines into a free batch and adds
+ * the batch to the work queue once it is full, or once the stream waits for
+ * its source. Only used when the URL file can't be mapped (pipe, compressed
+ * file), from the read-ahead stream.
+ *      This is the producer thread
+ * @Param arg
+ *
+ * @Returns   
+ */
+/* ----------------------------------------------------------------------------*/
+void *fileRead_thread(void * arg){
+    url_stream_t *stream = (url_stream_t*)arg;
+    fileRead_state_t state = { NULL, 0 };
+    url_batch_t *batch;
+    const char *line;
+    char *p;
+    size_t len, size;
+    unsigned long long start, read_start = stats_clock();
+
+    TM_PRINTF(debug_enabled, "fileRead_thread \n");
+    url_stream_set_idle(stream, fileRead_idle, &state);
+    while (!atomic_load(&match_stop) && url_stream_next_line(stream, &line, &len)) {
+        if (NULL == state.batch) {
+            stats_since(&stage_stats.read_ns, read_start);
+            if (!fileRead_batch(&state)) {
+                break;
+            }
+            atomic_store(&input_idle, false);
+            read_start = stats_clock();
+        }
+        batch = state.batch;
+
+        if (batch->used + len > batch->size) {
+            size = (batch->used + len > URL_BATCH_BYTES) ? batch->used + len : URL_BATCH_BYTES;
+            if (NULL == (p = realloc(batch->data, size))) {
+                fprintf(stderr, "URL batch allocation failed\n");
+                exit(1);
+            }
+            batch->data = p;
+            batch->size = size;
+        }
+        memcpy(batch->data + batch->used, line, len);
+        batch->url_off[batch->count] = batch->used;
+        batch->url_len[batch->count++] = len;
+        batch->used += len;
+
+        if (URL_BATCH_SIZE == batch->count || batch->used >= URL_BATCH_BYTES) {
+            stats_since(&stage_stats.read_ns, read_start);
+            start = stats_clock();
+            url_queue_push_wait(work_queue, batch);
+            stats_since(&stage_stats.queue_ns, start);
+            read_start = stats_clock();
+            state.batch = NULL;
         }
-        old_index++;
     }
+    stats_since(&stage_stats.read_ns, read_start);
+
+    if (state.batch) {
+        url_queue_push_wait(work_queue, state.batch);
+    }
+    atomic_store(&fileRead_end, true);
+    url_queue_wake(work_queue);
+    pthread_exit(0);
 }
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Function to do the regex match given the url and modified pattern
+ * @Synopsis  Function to write the formatted results to output_fd
  *
- * @Param url
- * @Param pattern
+ * @Param out
  *
- * @Returns  true or false 
+ * @Returns   false on write failure
  */
 /* ----------------------------------------------------------------------------*/
-static bool regex_match(const char * url, const char * pattern)
+static bool flush_output(out_buf_t * out)
 {
-    regex_t regex;
-    int reti;
-    char msgbuf[100];
+    unsigned long long start = stats_clock();
+    bool ok;
 
-    /* Compile regular expression */
-    reti = regcomp(&regex, pattern, 0);
-    if (reti) {
-        fprintf(stderr, "Could not compile regex\n");
-        exit(1);
+    output_bytes += out->len;
+    ok = out_buf_write(out, output_fd);
+    stats_since(&stage_stats.output_ns, start);
+    return ok;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Writer stage run by the main thread. Output buffers of the done
+ * batches are gathered into one large buffer flushed with write().
+ * With ordered output a batch waits in pending till all the batches read
+ * before it are written, so the output is the same as with one thread.
+ * At most NUM_BATCHES batches are in flight, seq modulo NUM_BATCHES is unique.
+ * The buffer is also flushed while the URL stream waits for its source.
+ *
+ * @Returns   false on write failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool writer_stage()
+{
+    url_batch_t *pending[NUM_BATCHES] = { NULL }, *batch;
+    out_buf_t out = { NULL, 0, 0 };
+    long next_seq = 0;
+    void *data;
+    bool ok = true;
+    unsigned long long start = stats_clock();
+
+    while (url_queue_pop_wait(done_queue, &data, &workers_end)) {
+        stats_since(&stage_stats.queue_ns, start);
+        start = stats_clock();
+        batch = data;
+        if (ordered_output) {
+            pending[batch->seq & (NUM_BATCHES-1)] = batch;
+            batch = pending[next_seq & (NUM_BATCHES-1)];
+        }
+
+        while (batch) {
+            if (!out_buf_append(&out, batch->out.data, batch->out.len)) {
+                fprintf(stderr, "Output buffer allocation failed\n");
+                exit(1);
+            }
+            url_queue_push_wait(free_queue, batch);
+            batch = NULL;
+            if (ordered_output) {
+                pending[next_seq & (NUM_BATCHES-1)] = NULL;
+                batch = pending[++next_seq & (NUM_BATCHES-1)];
+            }
+        }
+
+        stats_since(&stage_stats.output_ns, start);
+        if (out.len >= OUTPUT_FLUSH_SIZE || (out.len && atomic_load(&input_idle))) {
+            ok = flush_output(&out) && ok;
+        }
+        start = stats_clock();
     }
+    stats_since(&stage_stats.queue_ns, start);
 
-    /* Execute regular expression */
-    reti = regexec(&regex, url, 0, NULL, 0);
-    if (!reti) {
-        TM_PRINTF("Match\n");
+    ok = flush_output(&out) && ok;
+    out_buf_free(&out);
+    return ok;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write the stats file: the stage times so far and
+ * the verifier profile of the threads with the current ruleset. A thread
+ * in the middle of a batch is waited for.
+ */
+/* ----------------------------------------------------------------------------*/
+static void dump_stats()
+{
+    url_engine_pattern_stats_t *patterns;
+    const url_engine_t *rs;
+    int i;
+
+    pthread_mutex_lock(&stats_threads_lock);
+    rs = atomic_load(&ruleset);
+    patterns = calloc(url_engine_num_patterns(rs) + 1, sizeof(url_engine_pattern_stats_t));
+    if (NULL == patterns) {
+        fprintf(stderr, "Stats allocation failed\n");
+        pthread_mutex_unlock(&stats_threads_lock);
+        return;
     }
-    else if (reti == REG_NOMATCH) {
-        TM_PRINTF("No match\n");
+    for (i = 0; i < stats_num_threads; i++) {
+        pthread_mutex_lock(&stats_threads[i].stats_lock);
+        if (stats_threads[i].scratch) {
+            url_engine_scratch_profile(rs, stats_threads[i].scratch, patterns);
+        }
+        pthread_mutex_unlock(&stats_threads[i].stats_lock);
     }
-    else {
-        regerror(reti, &regex, msgbuf, sizeof(msgbuf));
-        fprintf(stderr, "Regex match failed: %s\n", msgbuf);
-        exit(1);
+    url_stats_write(stats_file, rs, patterns, &stage_stats, algo_names[stats_algo], stats_num_threads, stats_top);
+    pthread_mutex_unlock(&stats_threads_lock);
+    free(patterns);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  reload thread woken up on SIGUSR1 to recompile the pattern.
+ * The new ruleset is built aside while the workers keep matching with the
+ * current one, over it: what is compiled for the sets and patterns left as
+ * they were is taken over. Then it is published with one atomic swap. The old ruleset is
+ * freed once every worker has finished the batch it started with it.
+ * On a bad config the current ruleset stays in use.
+ * SIGUSR2 wakes it up as well to write the stats.
+ *
+ * @Param arg
+ *
+ * @Returns   
+ */
+/* ----------------------------------------------------------------------------*/
+void *reload_thread(void *arg){
+    url_engine_t *rs, *old;
+    unsigned long long start;
+
+    for (;;) {
+        while (sem_wait(&reload_sem) && EINTR == errno);
+        /* signals received meanwhile are served by this one reload */
+        while (0 == sem_trywait(&reload_sem));
+        if (atomic_load(&reload_exit)) {
+            break;
+        }
+        if (atomic_exchange(&stats_wanted, false)) {
+            dump_stats();
+        }
+        if (!atomic_exchange(&reload_wanted, false)) {
+            continue;
+        }
+
+        TM_PRINTF(debug_enabled, "Recompile the pattern\n");
+        start = bench_now_ns();
+        /* only this thread swaps the ruleset, the one in use stays alive */
+        rs = url_engine_recompile_file(configFile, atomic_load(&ruleset));
+        if (NULL == rs) {
+            fprintf(stderr, "Could not compile the config %s, keeping the current one\n", configFile);
+            continue;
+        }
+        if (matcher_file && !url_engine_load_matcher(rs, matcher_file)) {
+            fprintf(stderr, "Could not load the matcher of the config %s, keeping the current one\n", configFile);
+            url_engine_free(rs);
+            continue;
+        }
+
+        old = atomic_exchange(&ruleset, rs);
+        epoch_synchronize(ruleset_epoch);
+        pthread_mutex_lock(&stats_threads_lock);
+        url_engine_free(old);
+        pthread_mutex_unlock(&stats_threads_lock);
+        TM_PRINTF(debug_enabled, "Reload done in %f sec\n", (bench_now_ns() - start) / 1e9);
     }
 
-    /* Free memory allocated to the pattern buffer by regcomp() */
-    regfree(&regex);
+    pthread_exit(0);
+}
 
-    return (!reti)?true: false;
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Sig handler for SIGUSR1 and SIGUSR2, wakes up the reload
+ * thread to reload or to write the stats. sem_post() and the lock free
+ * atomic stores are async signal safe, nothing else is done here.
+ *
+ * @Param signum
+ */
+/* ----------------------------------------------------------------------------*/
+void my_handler(int signum)
+{
+    if (signum == SIGUSR1)
+    {
+        atomic_store(&reload_wanted, true);
+        sem_post(&reload_sem);
+    }
+    else if (signum == SIGUSR2)
+    {
+        atomic_store(&stats_wanted, true);
+        sem_post(&reload_sem);
+    }
 }
 
+/*! \struct _idle_flush_t
+ *  Output of the single thread, flushed when the URL stream waits
+ */
+typedef struct _idle_flush_t {
+    out_buf_t *out;
+    bool ok;
+} idle_flush_t;
+
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Function that does URL pattern match based on POSIX algorithm
+ * @Synopsis  Stream idle callback of the single thread: the results so far
+ * are written out
  *
- * @Param fp
+ * @Param arg - idle_flush_t
  */
 /* ----------------------------------------------------------------------------*/
-static void posix_pattern_match(char* url, int thread_num)
+static void flush_idle(void * arg)
 {
-    int i,j, wildcard_index=-1;
-    char new_pattern[PATTERN_STRING_MAX_LENGTH] = {'\0'}, temp_pattern[PATTERN_STRING_MAX_LENGTH] = {'\0'}; 
-    bool is_first_pattern_match = true;
+    idle_flush_t *flush = arg;
 
-    /* Read each URL from file */
-    if (url != NULL)
-    {
-         TM_PRINTF("Enter thread: %d\n", thread_num);
-         //Added for testing purpose
-         //usleep(10000);
-         url[strlen(url) - 1] = '\0';
-         is_first_pattern_match = true;
-         /* Read each set */
-         for (i=0;i<num_sets;i++){
-         /* Read each pattern */
-           for (j=0;j<config_pattern[i].num_patterns;j++){
-                wildcard_index = -1;
-                memset(new_pattern, 0, PATTERN_STRING_MAX_LENGTH);
-                create_new_pattern(config_pattern[i].pattern[j],temp_pattern, POSIX);
-
-                if (true == match_needs_pattern_change(temp_pattern, &wildcard_index, POSIX)) {
-                    modify_posix_pattern_string(temp_pattern, new_pattern, wildcard_index);
-                }
+    if (flush->out->len) {
+        flush->ok = flush_output(flush->out) && flush->ok;
+    }
+}
 
-                if (regex_match(url,new_pattern)) {
-                    print_url_match_pattern(url, config_pattern[i].pattern[j], i, &is_first_pattern_match);
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to match all the URLs of the input with the current
+ * ruleset. With more than one thread the workers match and the calling
+ * thread writes, else the calling thread does both.
+ *
+ * @Param algo
+ * @Param num_threads
+ * @Param stream - read line by line when the URL file is not mapped
+ * @Param hist - per URL latency when not NULL, mapped input only
+ *
+ * @Returns   false on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool match_urls(MATCH_TYPE algo, int num_threads, url_stream_t * stream, bench_hist_t * hist)
+{
+    struct thread_info *tinfo;	
+    url_batch_t *batches = NULL;
+    pthread_t fileRead_threadid;
+    bool ok = true, fileRead_started = false;
+    int i, num_started = 0;
+    void *data;
+
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    atomic_store(&next_chunk, 0);
+    atomic_store(&fileRead_end, false);
+    atomic_store(&input_idle, false);
+    atomic_store(&workers_end, false);
+    atomic_store(&match_stop, false);
+
+    tinfo = calloc(num_threads, sizeof(struct thread_info));
+    if (NULL == tinfo) {
+            fprintf(stderr,"calloc error\n");
+            return false;
+    }
+    for (i = 0; i < num_threads; i++) {
+        tinfo[i].thread_num = i+1;
+        tinfo[i].reader = i;
+        tinfo[i].algo = algo;
+        tinfo[i].timed = (NULL != hist);
+        tinfo[i].url_cache_bytes = url_cache_bytes / num_threads;
+        pthread_mutex_init(&tinfo[i].stats_lock, NULL);
+    }
+    pthread_mutex_lock(&stats_threads_lock);
+    stats_threads = tinfo;
+    stats_num_threads = num_threads;
+    stats_algo = algo;
+    pthread_mutex_unlock(&stats_threads_lock);
+
+    if (1 < num_threads) {
+        work_queue = url_queue_create(NUM_BATCHES);
+        free_queue = url_queue_create(NUM_BATCHES);
+        done_queue = url_queue_create(NUM_BATCHES);
+        batches = calloc(NUM_BATCHES, sizeof(url_batch_t));
+        if (url_input && !ordered_output) {
+            chunk_pool = steal_pool_create(url_input->num_chunks, num_threads);
+        }
+        if (!work_queue || !free_queue || !done_queue || !batches ||
+                (url_input && !ordered_output && !chunk_pool)) {
+                fprintf(stderr,"calloc error\n");
+                ok = false;
+                goto out;
+        }
+        for (i = 0; i < NUM_BATCHES; i++) {
+            url_queue_push(free_queue, &batches[i]);
+        }
+
+        //file read thread
+        if (!url_input) {
+            if (pthread_create(&fileRead_threadid, NULL, fileRead_thread, stream) != 0) {
+                fprintf(stderr, "pthread_create failed fieRead thread!\n");
+                ok = false;
+                goto out;
+            }
+            fileRead_started = true;
+        }
+       
+        atomic_store(&workers_running, num_threads);
+        for (; num_started < num_threads; num_started++) {
+            if (pthread_create(&tinfo[num_started].thread_id, NULL, worker_thread, &tinfo[num_started]) != 0) {
+                    fprintf(stderr, "pthread_create failed!\n");
+                    ok = false;
+                    goto out;
+            }
+        }
+
+        ok = writer_stage();
+    }  else {
+        out_buf_t out = { NULL, 0, 0 };
+        if (!thread_setup(&tinfo[0])) {
+            fprintf(stderr,"calloc error\n");
+            ok = false;
+            goto out;
+        }
+        tinfo[0].out = &out;
+        if (url_input) {
+            for (i = 0; ok && i < url_input->num_chunks; i++) {
+                stats_begin(&tinfo[0]);
+                ruleset_acquire(&tinfo[0]);
+                chunk_pattern_match(i, &tinfo[0]);
+                ruleset_release(&tinfo[0]);
+                stats_end(&tinfo[0]);
+                if (out.len >= OUTPUT_FLUSH_SIZE) {
+                    ok = flush_output(&out);
                 }
-           }
+            }
+        } else {
+            const char *url;
+            size_t url_len;
+            idle_flush_t flush = { &out, true };
+            unsigned long long start = stats_clock();
+            url_stream_set_idle(stream, flush_idle, &flush);
+            while(ok && flush.ok && url_stream_next_line(stream, &url, &url_len)) {
+                stats_begin(&tinfo[0]);
+                tinfo[0].read_ns += stats_clock() - start;
+                ruleset_acquire(&tinfo[0]);
+                pattern_match(url, url_len, &tinfo[0]);
+                ruleset_release(&tinfo[0]);
+                stats_end(&tinfo[0]);
+                if (out.len >= OUTPUT_FLUSH_SIZE) {
+                    ok = flush_output(&out);
+                }
+                start = stats_clock();
+            }
+            ok = ok && flush.ok;
         }
-        if (false==is_first_pattern_match) {
-            printf("\n");
+        ok = ok && flush_output(&out);
+        out_buf_free(&out);
+    }
+
+out:
+    if (num_started < num_threads && (fileRead_started || num_started)) {
+        /* the threads started stop, the batches they match are put back
+         * unwritten till the last one is out */
+        atomic_store(&match_stop, true);
+        url_queue_wake(free_queue);
+        if (atomic_fetch_sub(&workers_running, num_threads - num_started) == num_threads - num_started) {
+            atomic_store(&workers_end, true);
+        }
+        while (url_queue_pop_wait(done_queue, &data, &workers_end)) {
+            url_queue_push_wait(free_queue, data);
         }
-    } else {
-        fprintf(stderr, "URL NULL, threadid %d\n", thread_num);
+    }
+    for (i = 0; i < num_started; i++) {
+        if (pthread_join(tinfo[i].thread_id, NULL) != 0) {
+                fprintf(stderr,"pthread_join failed\n");
+                ok = false;
+        }
+    }
+    if (fileRead_started) {
+        pthread_join(fileRead_threadid, NULL);
     }
 
-}
+    url_queue_free(work_queue);
+    url_queue_free(free_queue);
+    url_queue_free(done_queue);
+    work_queue = free_queue = done_queue = NULL;
+    steal_pool_free(chunk_pool);
+    chunk_pool = NULL;
+    for (i = 0; batches && i < NUM_BATCHES; i++) {
+        out_buf_free(&batches[i].out);
+        free(batches[i].data);
+    }
+    free(batches);
 
+    if (stats_file) {
+        dump_stats();
+    }
+    pthread_mutex_lock(&stats_threads_lock);
+    stats_threads = NULL;
+    stats_num_threads = 0;
+    pthread_mutex_unlock(&stats_threads_lock);
+
+    for (i = 0; i < num_threads; i++) {
+        pthread_mutex_destroy(&tinfo[i].stats_lock);
+        if (hist && tinfo[i].hist) {
+            bench_hist_merge(hist, tinfo[i].hist);
+            free(tinfo[i].hist);
+        }
+        if (tinfo[i].url_cache) {
+            url_cache_total.hits += tinfo[i].url_cache->hits;
+            url_cache_total.misses += tinfo[i].url_cache->misses;
+            url_cache_total.evictions += tinfo[i].url_cache->evictions;
+            url_cache_total.bypass += tinfo[i].url_cache->bypass;
+            url_cache_free(tinfo[i].url_cache);
+        }
+        url_engine_scratch_free(tinfo[i].scratch);
+    }
+    free(tinfo);
+
+    return ok;
+}
 
 /*
  ----------------------------------------------------------------------------
 |                                                                           |
-|                               SELF ALGORITHM FUNCTIONS                    |
+|                               BENCHMARK                                   |
 |                                                                           |
 |---------------------------------------------------------------------------|
 */
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Function to modify the SELF pattern string
- * if wildcard comes before delimiter replacing it with '|' character to
- * differentiate in the SELF algorithm
+ * @Synopsis  Function to read the value of the mode option
+ *
+ * @Param name - all, any, first or boolean
  *
- * @Param old_pattern
- * @Param new_pattern
- * @Param wildcard_index
+ * @Returns   false on an unknown mode
  */
 /* ----------------------------------------------------------------------------*/
-static inline void modify_self_pattern_string(const char * old_pattern, char * new_pattern, int wildcard_index)
+static bool parse_mode(const char * name)
 {
-    int old_index=0, old_len = strlen(old_pattern);
+    int m;
 
-    while(old_index<old_len) {
-        if (old_pattern[old_index]=='*' && old_index <= wildcard_index) {
-            new_pattern[old_index] = '|';
-        } else {
-            new_pattern[old_index] = old_pattern[old_index];
+    for (m = MATCH_ALL; m <= MATCH_BOOLEAN && strcmp(name, mode_names[m]); m++);
+    if (m > MATCH_BOOLEAN) {
+        fprintf(stderr, "all|any|first|boolean\n");
+        return false;
+    }
+    match_mode = m;
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to read the value of the normalize option
+ *
+ * @Param list - comma separated host (lowercase the host), lower (lowercase
+ * the url) and decode (percent-decode unreserved characters)
+ *
+ * @Returns   false on an unknown word
+ */
+/* ----------------------------------------------------------------------------*/
+static bool parse_normalize(const char * list)
+{
+    static const char *names[] = { "host", "lower", "decode" };
+    static const int flags[] = { URL_NORMALIZE_LOWER_HOST, URL_NORMALIZE_LOWER, URL_NORMALIZE_DECODE };
+    const char *p = list;
+    size_t len;
+    int n;
+
+    normalize_flags = 0;
+    while (*p) {
+        len = strcspn(p, ",");
+        for (n = 0; n < 3 && (strlen(names[n]) != len || strncmp(p, names[n], len)); n++);
+        if (n == 3) {
+            fprintf(stderr, "host|lower|decode, comma separated\n");
+            return false;
         }
-        old_index++;
+        normalize_flags |= flags[n];
+        p += len + (p[len] == ',');
     }
+    return true;
 }
+
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Function that implementes the SELF algorithm
+ * @Synopsis  Function to compile the config. With debug_enable it is
+ * compiled over an empty ruleset with the debug prints on, which the new
+ * ruleset and its reloads take over, so the compile is printed.
  *
- * @Param url
- * @Param pattern
+ * @Param config_file - config.xml or ruleset image
  *
- * @Returns  true or false 
+ * @Returns   compiled ruleset, NULL on failure
  */
 /* ----------------------------------------------------------------------------*/
-static bool self_match(const char * url, char * pattern)
+static url_engine_t * compile_config(const char * config_file)
 {
-    if (!url && !pattern){
-        TM_PRINTF("Both URL and pattern empty/n");
-        return true;
-    } 
+    url_engine_t *empty, *rs;
 
-    if (!url) {
-         TM_PRINTF("URL empty\n");
-         return false;
+    if (!debug_enabled) {
+        return url_engine_compile_file(config_file);
     }
-
-    if (!pattern) {
-         TM_PRINTF("Pattern empty\n");
-         return false;
+    empty = url_engine_compile(NULL, 0);
+    if (NULL == empty) {
+        return NULL;
     }
+    url_engine_set_debug(empty, true);
+    rs = url_engine_recompile_file(config_file, empty);
+    url_engine_free(empty);
+    return rs;
+}
 
-    const int url_len = strlen(url), pattern_len = strlen(pattern);
-    int i,j, writeIndex=pattern_len;
-    bool dp[url_len+1][writeIndex+1];
-
-    /* Initialize the dp array */
-    for (i=0;i<url_len+1;i++) {
-        for (j=0;j<writeIndex+1;j++){
-            dp[i][j] = false;
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to run the benchmark. The url and pattern corpora are
+ * generated from the seed, then every algorithm is run at every thread
+ * count. Each run is done twice, once to measure the throughput and once
+ * timing every URL for the latency percentiles, so the clock reads do not
+ * slow down the throughput run. One JSON object per run is printed.
+ * codegen writes the matcher of the generated patterns instead, native is
+ * run once it is built and given with matcher.
+ *  url-engine bench [urls N] [unique N] [patterns N] [wildcard D]
+ *                   [threads 1,2,4] [seed S] [algo posix|self|dfa|native]
+ *                   [cache MB] [mode all|any|first|boolean]
+ *                   [codegen bench_matcher.c] [matcher bench_matcher.so]
+ *
+ * @Param argc
+ * @Param argv
+ *
+ * @Returns   exit code
+ */
+/* ----------------------------------------------------------------------------*/
+static int bench_main(int argc, char **argv)
+{
+    long num_urls = 100000, num_unique = 0;
+    int num_patterns = 1000;
+    double wildcard = 0.3, seconds, compile_seconds;
+    unsigned long long seed = 1, start_time, end_time;
+    const char *threads = "1,2,4", *codegen_file = NULL, *bench_matcher = NULL;
+    char *urls, *end;
+    size_t urls_size;
+    int i, a, t, num_counts = 0, max_threads = 1, thread_counts[64], num_sets;
+    int algo_first = POSIX, algo_last = -1;
+    unsigned long cache_hits, cache_misses;
+    url_engine_set_t *sets;
+    bench_hist_t *hist;
+
+    for (i = 2; i < argc; i++) {
+        if (i+1 == argc) {
+            fprintf(stderr, "Missing value of %s\n", argv[i]);
+            return 1;
+        }
+        if (!strcmp(argv[i], "urls")) {
+            num_urls = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "unique")) {
+            num_unique = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "cache")) {
+            url_cache_bytes = (size_t)atol(argv[++i]) * 1024 * 1024;
+        } else if (!strcmp(argv[i], "patterns")) {
+            num_patterns = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "wildcard")) {
+            wildcard = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "threads")) {
+            threads = argv[++i];
+        } else if (!strcmp(argv[i], "seed")) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "algo")) {
+            for (a = POSIX; a <= NATIVE && strcmp(argv[i+1], algo_names[a]); a++);
+            if (a > NATIVE) {
+                fprintf(stderr, "posix|self|dfa|native\n");
+                return 1;
+            }
+            algo_first = algo_last = a;
+            i++;
+        } else if (!strcmp(argv[i], "codegen")) {
+            codegen_file = argv[++i];
+        } else if (!strcmp(argv[i], "matcher")) {
+            bench_matcher = argv[++i];
+        } else if (!strcmp(argv[i], "mode")) {
+            if (!parse_mode(argv[++i])) {
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown bench option %s\n", argv[i]);
+            return 1;
         }
     }
-    if (writeIndex > 0 && (pattern[0] == '*' || pattern[0]=='|')) {
-        dp[0][1] = true;
-    } 
-
-    dp[0][0] = true;
 
-    /* Core logic */
-    for (i = 1; i < url_len+1; i++) {
-        for (j = 1; j < writeIndex+1; j++) {
-            if (url[i-1] == pattern[j-1]) {
-                dp[i][j] = dp[i-1][j-1];
-            } else if (pattern[j-1] == '*'){
-                dp[i][j] = dp[i-1][j] || dp[i][j-1];
-            } else if (pattern[j-1]=='|') {
-                dp[i][j] = dp[i][j-1] || ((url[i-1]!='/')?(dp[i-1][j]):false);
-            }
+    for (; *threads && num_counts < 64; threads = ('\0' == *end) ? end : end + 1) {
+        t = strtol(threads, &end, 10);
+        if (end == threads || t < 1) {
+            fprintf(stderr, "Bad thread count list\n");
+            return 1;
         }
+        thread_counts[num_counts++] = t;
+        max_threads = (t > max_threads) ? t : max_threads;
+    }
+    if (num_urls < 1 || num_patterns < 1 || 0 == num_counts) {
+        fprintf(stderr, "Nothing to run\n");
+        return 1;
+    }
+    if (algo_last < 0) {
+        algo_last = bench_matcher ? NATIVE : DFA;
+    }
+    if (NATIVE == algo_last && !bench_matcher && !codegen_file) {
+        fprintf(stderr, "native needs the matcher of the bench patterns, built from codegen\n");
+        return 1;
     }
 
-    /* Print the dp array in case debugging */
-    for (i=0;i<url_len+1;i++) 
-    {
-        TM_PRINTF("\n");
-        for (j=0;j<writeIndex+1;j++){
-            TM_PRINTF("%d ",dp[i][j]);
+    sets = bench_gen_patterns(seed, num_patterns, wildcard, BENCH_MAX_SETS, &num_sets);
+    if (NULL == sets) {
+        fprintf(stderr, "Could not generate the patterns\n");
+        return 1;
+    }
+    start_time = bench_now_ns();
+    ruleset = url_engine_compile(sets, num_sets);
+    compile_seconds = (bench_now_ns() - start_time) / 1e9;
+    bench_free_patterns(sets, num_sets);
+    if (ruleset && codegen_file) {
+        if (!url_engine_codegen(ruleset, codegen_file)) {
+            return 1;
         }
+        printf("%d patterns (%d duplicate) generated into %s\n",
+                url_engine_num_patterns(ruleset), url_engine_num_duplicates(ruleset), codegen_file);
+        url_engine_free(ruleset);
+        return 0;
     }
- 
-    if (dp[url_len][writeIndex]){
-        TM_PRINTF("Match\n");
-    } else {
-        TM_PRINTF("No Match\n");
+    if (ruleset && bench_matcher && !url_engine_load_matcher(ruleset, bench_matcher)) {
+        return 1;
     }
 
-    return dp[url_len][writeIndex]; 
-}
+    urls = bench_gen_urls(seed, num_urls, num_unique, &urls_size);
+    hist = malloc(sizeof(bench_hist_t));
+    ruleset_epoch = epoch_create(max_threads);
+    output_fd = open("/dev/null", O_WRONLY);
+    if (!ruleset || !urls || !hist || !ruleset_epoch || output_fd < 0) {
+        fprintf(stderr, "Could not set up the bench\n");
+        return 1;
+    }
 
-/* --------------------------------------------------------------------------*/
-/**
- * @Synopsis  Function that does the URL pattern match based on SELF algorithm
- *
- * @Param fp
- */
-/* ----------------------------------------------------------------------------*/
-static void self_pattern_match(char * url, int thread_num)
-{
-    int i,j, wildcard_index=-1;
-    char new_pattern[PATTERN_STRING_MAX_LENGTH] = {'\0'}, temp_pattern[PATTERN_STRING_MAX_LENGTH] = {'\0'}; 
-    bool is_first_pattern_match = true;
+    for (a = algo_first; a <= algo_last; a++) {
+        for (i = 0; i < num_counts; i++) {
+            url_input = url_input_split(urls, urls_size, thread_counts[i]);
+            if (NULL == url_input) {
+                fprintf(stderr, "calloc error\n");
+                return 1;
+            }
 
-    /* Read URL from the file */
-    if (url != NULL){
-         TM_PRINTF("Enter thread: %d\n", thread_num);
-         // Added for testing
-         //usleep(10000);
-         url[strlen(url) - 1] = '\0';
-         is_first_pattern_match = true;
-         /* Iterate through each set */
-         for (i=0;i<num_sets;i++){
-             /* Iterate through each pattern */ 
-           for (j=0;j<config_pattern[i].num_patterns;j++){
-                wildcard_index = -1;
-                memset(new_pattern, 0, PATTERN_STRING_MAX_LENGTH);
-                create_new_pattern(config_pattern[i].pattern[j],temp_pattern, SELF);
-                strncpy(new_pattern, temp_pattern, PATTERN_STRING_MAX_LENGTH);
-
-                if (true == match_needs_pattern_change(temp_pattern, &wildcard_index, SELF)) {
-                    modify_self_pattern_string(temp_pattern, new_pattern, wildcard_index);
-                }
-                
-                if (self_match(url,new_pattern)) {
-                    print_url_match_pattern(url, config_pattern[i].pattern[j], i, &is_first_pattern_match);
-                }
-           }
-        }
-        if (false==is_first_pattern_match) {
-            printf("\n");
+            output_bytes = 0;
+            memset(&url_cache_total, 0, sizeof(url_cache_total));
+            start_time = bench_now_ns();
+            if (!match_urls(a, thread_counts[i], NULL, NULL)) {
+                return 1;
+            }
+            end_time = bench_now_ns();
+            seconds = (end_time - start_time) / 1e9;
+
+            cache_hits = url_cache_total.hits;
+            cache_misses = url_cache_total.misses;
+            memset(hist, 0, sizeof(bench_hist_t));
+            if (!match_urls(a, thread_counts[i], NULL, hist)) {
+                return 1;
+            }
+            url_input_unmap(url_input);
+            url_input = NULL;
+
+            printf("{\"algo\": \"%s\", \"mode\": \"%s\", \"threads\": %d, \"urls\": %ld, \"patterns\": %d, "
+                    "\"wildcard\": %.3f, \"seed\": %llu, \"compile_seconds\": %.6f, "
+                    "\"seconds\": %.6f, \"urls_per_sec\": %.0f, \"ns_per_url\": %.1f, "
+                    "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"output_bytes\": %llu, "
+                    "\"cache_hits\": %lu, \"cache_misses\": %lu}\n",
+                    algo_names[a], mode_names[match_mode], thread_counts[i], num_urls, num_patterns, wildcard, seed,
+                    compile_seconds, seconds, num_urls / seconds, seconds * 1e9 / num_urls,
+                    bench_hist_percentile(hist, 50), bench_hist_percentile(hist, 99),
+                    bench_hist_percentile(hist, 99.9), output_bytes, cache_hits, cache_misses);
+            fflush(stdout);
         }
-    } else {
-        fprintf(stderr, "URL NULL, threadid %d\n", thread_num);
     }
+
+    close(output_fd);
+    free(hist);
+    free(urls);
+    epoch_free(ruleset_epoch);
+    url_engine_free(ruleset);
+    return 0;
 }
 
+/*
+ ----------------------------------------------------------------------------
+|                                                                           |
+|                               RULESET IMAGE                               |
+|                                                                           |
+|---------------------------------------------------------------------------|
+*/
+
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Wrapper that is called from main to do the URL pattern match
+ * @Synopsis  Function to compile config.xml into a ruleset image, given to
+ * url-engine in place of config.xml it is mapped and used without parsing.
+ *  url-engine compile config.xml rules.img
  *
- * @Param fp
- * @Param type
+ * @Param argc
+ * @Param argv
+ *
+ * @Returns   exit code
  */
 /* ----------------------------------------------------------------------------*/
-static void pattern_match(char * url, MATCH_TYPE type, int thread_num)
+static int compile_main(int argc, char **argv)
 {
-    switch(type) {
-        case POSIX:
-            posix_pattern_match(url, thread_num); 
-            break;
+    url_engine_t *rs;
+    unsigned long long start_time, compile_time;
 
-        case SELF:
-            self_pattern_match(url, thread_num);
-            break;
+    if (argc != 4) {
+        fprintf(stderr, "Usage: url-engine compile config.xml rules.img\n");
+        return 1;
+    }
 
-        default:
-            break;
+    start_time = bench_now_ns();
+    rs = url_engine_compile_file(argv[2]);
+    compile_time = bench_now_ns() - start_time;
+    if (NULL == rs) {
+        fprintf(stderr, "Could not compile the config %s\n", argv[2]);
+        return 1;
     }
+    if (!url_engine_save(rs, argv[3])) {
+        url_engine_free(rs);
+        return 1;
+    }
+
+    printf("%d sets, %d patterns (%d duplicate, %d subsumed) compiled in %f sec into %s\n",
+            url_engine_num_sets(rs), url_engine_num_patterns(rs), url_engine_num_duplicates(rs),
+            url_engine_num_subsumed(rs), compile_time / 1e9, argv[3]);
+    url_engine_free(rs);
+    return 0;
 }
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Add to the buffer
+ * @Synopsis  Function to write the C source of a matcher specialized for
+ * the patterns of config.xml, built into a shared object by make matcher and
+ * loaded by the native algorithm.
+ *  url-engine codegen config.xml url_matcher.c
  *
- * @Param url
+ * @Param argc
+ * @Param argv
+ *
+ * @Returns   exit code
  */
 /* ----------------------------------------------------------------------------*/
-void insertbuffer(char * url) {
-    if (buffer_index < NUM_BUFFERS) {
-        strncpy(&buffer[buffer_index++][0],url,BUFF_SIZE);
-    } else {
-        printf("Buffer overflow\n");
+static int codegen_main(int argc, char **argv)
+{
+    url_engine_t *rs;
+    bool ok;
+
+    if (argc != 4) {
+        fprintf(stderr, "Usage: url-engine codegen config.xml url_matcher.c\n");
+        return 1;
+    }
+    rs = url_engine_compile_file(argv[2]);
+    if (NULL == rs) {
+        fprintf(stderr, "Could not compile the config %s\n", argv[2]);
+        return 1;
     }
+    ok = url_engine_codegen(rs, argv[3]);
+    if (ok) {
+        printf("%d patterns (%d duplicate) generated into %s\n",
+                url_engine_num_patterns(rs), url_engine_num_duplicates(rs), argv[3]);
+    }
+    url_engine_free(rs);
+    return ok ? 0 : 1;
 }
- 
+
+/*
+ ----------------------------------------------------------------------------
+|                                                                           |
+|                               SERVE                                       |
+|                                                                           |
+|---------------------------------------------------------------------------|
+*/
+
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Dequeue the value from buffer
+ * @Synopsis  Sig handler for SIGINT and SIGTERM of the server
  *
- * @Returns   
+ * @Param signum
  */
 /* ----------------------------------------------------------------------------*/
-char * dequeuebuffer() {
-    if (buffer_index > 0) {
-        return buffer[--buffer_index]; // buffer_index-- would be error!
-    } else {
-        printf("Buffer underflow\n");
-    }
-    return NULL;
+static void serve_handler(int signum)
+{
+    url_serve_stop();
 }
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  worker thread that does the pattern match after deque the URL from buffer
- * There is a busy wait added when the sig handler is received. This will wait till
- * the recompilation is done.
- * @Param arg
+ * @Synopsis  Function to run url-engine as a server answering match requests
+ * on a Unix domain socket (protocol in url_serve.h). The ruleset is loaded
+ * once, SIGUSR1 reloads it as in the file mode without closing the
+ * connections, SIGINT or SIGTERM stops the server.
+ *  url-engine serve <posix|self|dfa|native> config.xml socket [thread N]
+ *                   [mode all|any|first|boolean] [normalize N] [cache MB]
+ *                   [matcher M.so] [debug_enable]
  *
- * @Returns   
+ * @Param argc
+ * @Param argv
+ *
+ * @Returns   exit code
  */
 /* ----------------------------------------------------------------------------*/
-void *worker_thread(void * arg){
-    struct thread_info * tinfo = arg;
-    int sval;
-    char * url; 
-
-    printf("Worker Thread num: %d Thread algo %d\n", tinfo->thread_num, tinfo->algo);
-    while(!fileRead_end || (!sem_getvalue(&full_sem, &sval) && sval>0)) {
-        sem_wait(&full_sem);
-        pthread_mutex_lock(&buffer_lock); 
-        url = dequeuebuffer();        
-        pthread_mutex_unlock(&buffer_lock);
-        while(is_sighandler_rcvd){
-            printf("thread id : %d, is sleeping\n", tinfo->thread_num);
-            sleep(1);
-            if (!is_sighandler_rcvd) {
-                printf("thread id : %d, is awake\n", tinfo->thread_num);
-                break;
+static int serve_main(int argc, char **argv)
+{
+    url_serve_config_t config;
+    pthread_t reload_threadid;
+    int i, a;
+    bool ok;
+
+    if (argc < 5) {
+        fprintf(stderr, "Usage: url-engine serve <posix|self|dfa|native> config.xml socket [thread N] [mode M] [normalize N] [cache MB] [matcher M.so] [debug_enable]\n");
+        return 1;
+    }
+    for (a = POSIX; a <= NATIVE && strcmp(argv[2], algo_names[a]); a++);
+    if (a > NATIVE) {
+        fprintf(stderr, "posix|self|dfa|native\n");
+        return 1;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.algo = a;
+    config.num_threads = 1;
+    config.socket_path = argv[4];
+    configFile = argv[3];
+    for (i = 5; i < argc; i++) {
+        if (!strcmp(argv[i], "thread") && i+1 < argc) {
+            config.num_threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "mode") && i+1 < argc) {
+            if (!parse_mode(argv[++i])) {
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "normalize") && i+1 < argc) {
+            if (!parse_normalize(argv[++i])) {
+                return 1;
             }
+        } else if (!strcmp(argv[i], "cache") && i+1 < argc) {
+            config.url_cache_bytes = (size_t)atol(argv[++i]) * 1024 * 1024;
+        } else if (!strcmp(argv[i], "matcher") && i+1 < argc) {
+            matcher_file = argv[++i];
+        } else if (!strcmp(argv[i],"debug_enable")){
+            debug_enabled = true;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
         }
-        //printf("Read next url %s\n ", url);
-        pattern_match(url, tinfo->algo, tinfo->thread_num);	
-        sem_post(&empty_sem);
+    }
+    if (config.num_threads < 1) {
+        config.num_threads = 1;
+    }
+    config.mode = match_mode;
+    config.normalize = normalize_flags;
+    config.debug = debug_enabled;
+    if (NATIVE == a && !matcher_file) {
+        matcher_file = DEFAULT_MATCHER;
+    }
+    if (NATIVE != a) {
+        matcher_file = NULL;
     }
 
-    printf("exit thread: %d\n ", tinfo->thread_num); 
-    pthread_exit(0);
+    if (sem_init(&reload_sem, 0, 0)) {
+        fprintf(stderr, "sem_init failed\n");
+        return EXIT_FAILURE;
+    }
+    signal(SIGUSR1, my_handler);
+    signal(SIGINT, serve_handler);
+    signal(SIGTERM, serve_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    ruleset = compile_config(configFile);
+    if (NULL == ruleset) {
+        fprintf(stderr, "Could not compile the config %s\n", configFile);
+        return 1;
+    }
+    if (matcher_file && !url_engine_load_matcher(ruleset, matcher_file)) {
+        return 1;
+    }
+    ruleset_epoch = epoch_create(config.num_threads);
+    if (NULL == ruleset_epoch) {
+        fprintf(stderr,"calloc error\n");
+        return EXIT_FAILURE;
+    }
+    if (pthread_create(&reload_threadid, NULL, reload_thread, NULL) != 0) {
+        fprintf(stderr, "pthread_create failed reload thread!\n");
+        return EXIT_FAILURE;
+    }
+    config.ruleset = &ruleset;
+    config.epoch = ruleset_epoch;
+
+    ok = url_serve_run(&config);
+
+    atomic_store(&reload_exit, true);
+    sem_post(&reload_sem);
+    pthread_join(reload_threadid, NULL);
+    sem_destroy(&reload_sem);
+    epoch_free(ruleset_epoch);
+    url_engine_free(ruleset);
+    return ok ? 0 : 1;
 }
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  fileRead thread that reads the file and adds url to the buffer.
- *      This is the producer thread
- * @Param arg
+ * @Synopsis  Function to read exactly len bytes of a socket
  *
- * @Returns   
+ * @Param fd
+ * @Param buf
+ * @Param len
+ *
+ * @Returns   false on failure or end of file
  */
 /* ----------------------------------------------------------------------------*/
-void *fileRead_thread(void * arg){
-    FILE *fp = (FILE*)arg;
-    char url[BUFF_SIZE];
-
-    printf("fileRead_thread \n");
-    while(fgets(url, BUFF_SIZE, fp) != NULL) {
-        sem_wait(&empty_sem);
-        pthread_mutex_lock(&buffer_lock); 
-        insertbuffer(url);        
-        pthread_mutex_unlock(&buffer_lock);
-        sem_post(&full_sem);
-    }
-    fileRead_end = true;
-    pthread_exit(0);
+static bool query_read(int fd, char * buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        n = read(fd, buf, len);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
 }
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  signal thread invoked to recompile the pattern
+ * @Synopsis  Function to send a request of the query client and print the
+ * response as url-engine prints a match
  *
- * @Param arg
+ * @Param fd
+ * @Param request - frame length still 0
+ * @Param response - grows to the response frame
+ * @Param response_size
+ * @Param out
  *
- * @Returns   
+ * @Returns   false on failure
  */
 /* ----------------------------------------------------------------------------*/
-void *signal_thread(void *arg){
-    xmlDocPtr       document;
-    xmlNodePtr      root, first_child;
-
-    printf("Enter signal_thread\n");
-
-    printf("Enter signal_thread recompute\n");
-
-    free_pattern_allocated_memory();
-    document = xmlReadFile(configFile, NULL, 0);
-    root = xmlDocGetRootElement(document);
-    first_child = root->xmlChildrenNode;
-
-    construct_pattern_from_xml(document, first_child);
-    if (debug_enabled) {
-        print_xml_pattern();
+static bool query_send(int fd, out_buf_t * request, char ** response, size_t * response_size, out_buf_t * out)
+{
+    uint32_t len, num_urls, num_ids, i, j, off, url_off, pattern_len;
+    bool is_first_pattern_match;
+    char *p;
+
+    len = htonl(request->len - 4);
+    memcpy(request->data, &len, 4);
+    if (!out_buf_write(request, fd)) {
+        return false;
     }
 
-    pthread_exit(0);
+    if (!query_read(fd, (char *)&len, 4)) {
+        return false;
+    }
+    len = ntohl(len);
+    if (len > *response_size) {
+        if (NULL == (p = realloc(*response, len))) {
+            return false;
+        }
+        *response = p;
+        *response_size = len;
+    }
+    if (!query_read(fd, *response, len)) {
+        return false;
+    }
 
+    /* the urls come from the request, the response is in the same order */
+    p = *response;
+    num_urls = url_serve_get_u32(p);
+    for (i = 0, off = 4, url_off = 8; i < num_urls; i++) {
+        num_ids = url_serve_get_u32(p + off);
+        off += 4;
+        is_first_pattern_match = true;
+        for (j = 0; j < num_ids; j++) {
+            pattern_len = url_serve_get_u32(p + off + 4);
+            print_url_match_pattern(out, request->data + url_off + 4, url_serve_get_u32(request->data + url_off),
+                    p + off + 8, pattern_len, (int)url_serve_get_u32(p + off), &is_first_pattern_match);
+            off += 8 + pattern_len;
+        }
+        if (false == is_first_pattern_match) {
+            print_url_match_end(out);
+        }
+        url_off += 4 + url_serve_get_u32(request->data + url_off);
+    }
+    return true;
 }
 
 /* --------------------------------------------------------------------------*/
 /**
- * @Synopsis  Sig handler for SIGUSR1
- * sleep of 5 sec added to wait for the current pattern match to finish.
+ * @Synopsis  Function to match a URL file through a running url-engine serve,
+ * batch URLs per request. The matches are printed as in the file mode.
+ *  url-engine query socket urlFile.txt [batch N] [calc_time]
  *
- * @Param signum
+ * @Param argc
+ * @Param argv
+ *
+ * @Returns   exit code
  */
 /* ----------------------------------------------------------------------------*/
-void my_handler(int signum)
+static int query_main(int argc, char **argv)
 {
-    pthread_t sig_handler_thread_id;
+    out_buf_t request = { NULL, 0, 0 }, out = { NULL, 0, 0 };
+    unsigned long long start_time, num_requests = 0;
+    char *url = NULL, *response = NULL;
+    size_t url_size = 0, response_size = 0;
+    ssize_t url_len;
+    int fd, i, batch = URL_BATCH_SIZE, count = 0;
+    bool measure_time = false, ok = true;
+    FILE *fp;
 
-    if (signum == SIGUSR1)
-    {
-        printf("Received SIGUSR1!\n");
-        printf("Recompile the pattern\n");
-        is_sighandler_rcvd = true; 
-        sleep(5);
+    if (argc < 4) {
+        fprintf(stderr, "Usage: url-engine query socket urlFile.txt [batch N] [calc_time]\n");
+        return 1;
+    }
+    for (i = 4; i < argc; i++) {
+        if (!strcmp(argv[i], "batch") && i+1 < argc) {
+            batch = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "calc_time")) {
+            measure_time = true;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (batch < 1) {
+        batch = 1;
+    }
+
+    fp = strcmp(argv[3], "-") ? fopen(argv[3], "r") : stdin;
+    if (NULL == fp) {
+        fprintf(stderr,"Could not open file %s\n", argv[3]);
+        return 1;
+    }
+    fd = url_serve_connect(argv[2]);
+    if (fd < 0) {
+        fprintf(stderr, "Could not connect to %s\n", argv[2]);
+        return 1;
+    }
 
-        if (pthread_create(&sig_handler_thread_id, NULL, signal_thread, NULL) != 0) {
-            fprintf(stderr, "pthread_create failed!\n");
+    start_time = bench_now_ns();
+    while (ok) {
+        url_len = getline(&url, &url_size, fp);
+        if (url_len >= 0) {
+            if (url_len && '\n' == url[url_len - 1]) {
+                url_len--;
+            }
+            if (0 == count) {
+                request.len = 0;
+                ok = url_serve_append_u32(&request, 0) && url_serve_append_u32(&request, 0);
+            }
+            ok = ok && url_serve_append_u32(&request, url_len) && out_buf_append(&request, url, url_len);
+            count++;
+        }
+        if (ok && count && (count == batch || url_len < 0 || request.len >= URL_SERVE_MAX_FRAME / 2)) {
+            count = htonl(count);
+            memcpy(request.data + 4, &count, 4);
+            ok = query_send(fd, &request, &response, &response_size, &out);
+            num_requests++;
+            count = 0;
+            if (ok && out.len >= OUTPUT_FLUSH_SIZE) {
+                ok = out_buf_write(&out, STDOUT_FILENO);
+            }
+        }
+        if (url_len < 0) {
+            break;
         }
-        pthread_join(sig_handler_thread_id, NULL);
- 
-        is_sighandler_rcvd = false;
-        printf("sig handler done\n");
     }
+    ok = ok && out_buf_write(&out, STDOUT_FILENO);
+    if (!ok) {
+        fprintf(stderr, "Query through %s failed\n", argv[2]);
+    }
+    if (ok && measure_time && num_requests) {
+        printf("Time taken is %f sec, %f ms per request\n", (bench_now_ns() - start_time) / 1e9,
+                (bench_now_ns() - start_time) / 1e6 / num_requests);
+    }
+    /* the same end as the file mode */
+    if (ok) {
+        printf("\n");
+    }
+
+    close(fd);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    free(url);
+    free(response);
+    out_buf_free(&request);
+    out_buf_free(&out);
+    return ok ? 0 : 1;
 }
 
 int main(int argc, char **argv)
 {
-    xmlDocPtr       document;
-    xmlNodePtr      root, first_child;
     char            *urlFile;
     MATCH_TYPE algo;
-    FILE * fp;
-    clock_t start_time, end_time; 
-    double time_taken;
-    bool measure_time = false;
-    int num_threads=1;
+    url_stream_t *stream = NULL;
+    int url_fd;
+    unsigned long long start_time, end_time, load_time; 
+    bool measure_time = false, ok;
+    int i, num_threads=1;
+    pthread_t reload_threadid;
+
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        return bench_main(argc, argv);
+    }
+    if (argc > 1 && !strcmp(argv[1], "compile")) {
+        return compile_main(argc, argv);
+    }
+    if (argc > 1 && !strcmp(argv[1], "codegen")) {
+        return codegen_main(argc, argv);
+    }
+    if (argc > 1 && !strcmp(argv[1], "serve")) {
+        return serve_main(argc, argv);
+    }
+    if (argc > 1 && !strcmp(argv[1], "query")) {
+        return query_main(argc, argv);
+    }
 
     if (argc < 4) {
-        fprintf(stderr, "Usage: url-engine <posix|self> config.xml urlFile.txt thread 3\n");
+        fprintf(stderr, "Usage: url-engine <posix|self|dfa|native> config.xml <urlFile.txt|urls.gz|urls.zst|-> [thread 3] [ordered] [affinity] [cache MB] [mode all|any|first|boolean] [normalize host,lower,decode] [stats file.json] [stats_top N] [matcher M.so] [calc_time] [debug_enable]\n"
+                "       url-engine compile config.xml rules.img\n"
+                "       url-engine codegen config.xml url_matcher.c\n"
+                "       url-engine serve <posix|self|dfa|native> config.xml socket [thread N] [mode M] [normalize N] [cache MB] [matcher M.so]\n"
+                "       url-engine query socket urlFile.txt [batch N] [calc_time]\n"
+                "       url-engine bench [urls N] [unique N] [patterns N] [wildcard D] [threads 1,2,4] [seed S] [algo posix|self|dfa] [cache MB] [mode M]\n");
         return 1;
     }
     
@@ -712,101 +1750,139 @@ int main(int argc, char **argv)
         algo = POSIX;
     } else if (!strcmp(argv[1],"self")){ 
         algo = SELF;
+    } else if (!strcmp(argv[1],"dfa")){ 
+        algo = DFA;
+    } else if (!strcmp(argv[1],"native")){ 
+        algo = NATIVE;
     } else {
-        fprintf(stderr, "posix|self\n");    
+        fprintf(stderr, "posix|self|dfa|native\n");    
         return 1;
     }
 
     configFile = argv[2];
     urlFile = argv[3];
-    if (argc >4 && !strcmp(argv[4], "thread")) {
-       num_threads = atoi(argv[5]); 
-    }
 
-    if (argc>6 && !strcmp(argv[6],"debug_enable")){
-        debug_enabled = true;
-    }
-    
-    if (argc>6 && !strcmp(argv[6],"calc_time")){
-        measure_time = true;
+    /* options may come in any order */
+    for (i = 4; i < argc; i++) {
+        if (!strcmp(argv[i], "thread") && i+1 < argc) {
+            num_threads = atoi(argv[++i]); 
+        } else if (!strcmp(argv[i],"debug_enable")){
+            debug_enabled = true;
+        } else if (!strcmp(argv[i],"calc_time")){
+            measure_time = true;
+        } else if (!strcmp(argv[i], "ordered")) {
+            ordered_output = true;
+        } else if (!strcmp(argv[i], "affinity")) {
+            pin_threads = true;
+        } else if (!strcmp(argv[i], "cache") && i+1 < argc) {
+            url_cache_bytes = (size_t)atol(argv[++i]) * 1024 * 1024;
+        } else if (!strcmp(argv[i], "mode") && i+1 < argc) {
+            if (!parse_mode(argv[++i])) {
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "normalize") && i+1 < argc) {
+            if (!parse_normalize(argv[++i])) {
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "stats") && i+1 < argc) {
+            stats_file = argv[++i];
+        } else if (!strcmp(argv[i], "stats_top") && i+1 < argc) {
+            stats_top = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "matcher") && i+1 < argc) {
+            matcher_file = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
     }
     
-    fp = fopen(urlFile, "r");
-    if (fp == NULL){
+    url_fd = strcmp(urlFile, "-") ? open(urlFile, O_RDONLY) : STDIN_FILENO;
+    if (url_fd < 0){
         fprintf(stderr,"Could not open file %s",urlFile);
         return 1;
     }
-
-    document = xmlReadFile(configFile, NULL, 0);
-    root = xmlDocGetRootElement(document);
-    first_child = root->xmlChildrenNode;
-
-    construct_pattern_from_xml(document, first_child);
-    if (debug_enabled) {
-        print_xml_pattern();
+    /* a plain regular file is matched in place, else it is read ahead */
+    start_time = stats_clock();
+    if (!url_stream_is_compressed(url_fd)) {
+        url_input = url_input_map(url_fd, num_threads);
+    }
+    stats_since(&stage_stats.read_ns, start_time);
+    if (!url_input && NULL == (stream = url_stream_open(url_fd))) {
+        return 1;
     }
 
-	int i, s;
-    struct thread_info *tinfo;	
+    /* a SIGUSR1 during the first load is kept for the reload thread */
+    if (sem_init(&reload_sem, 0, 0)) {
+        fprintf(stderr, "sem_init failed\n");
+        return EXIT_FAILURE;
+    }
     signal(SIGUSR1, my_handler);
-    pthread_t fileRead_threadid;
+    if (stats_file) {
+        signal(SIGUSR2, my_handler);
+    }
 
-    if (1 < num_threads) {
-        tinfo = calloc(num_threads, sizeof(struct thread_info));
-        if (NULL == tinfo) {
-                fprintf(stderr,"calloc error\n");
-                return EXIT_FAILURE;
-        }
-        pthread_mutex_init (&lock, NULL);
-        pthread_mutex_init(&buffer_lock, NULL);
+    if (NATIVE == algo && !matcher_file) {
+        matcher_file = DEFAULT_MATCHER;
+    }
+    if (NATIVE != algo) {
+        matcher_file = NULL;
+    }
 
-        sem_init(&empty_sem, 0, NUM_BUFFERS);
-        sem_init(&full_sem, 0, 0);
+    start_time = bench_now_ns();
+    ruleset = compile_config(configFile);
+    load_time = bench_now_ns() - start_time;
+    if (NULL == ruleset) {
+        fprintf(stderr, "Could not compile the config %s\n", configFile);
+        return 1;
+    }
+    if (matcher_file && !url_engine_load_matcher(ruleset, matcher_file)) {
+        return 1;
+    }
 
-        //file read thread
-        if (pthread_create(&fileRead_threadid, NULL, fileRead_thread, fp) != 0) {
-            fprintf(stderr, "pthread_create failed fieRead thread!\n");
-            return EXIT_FAILURE;
-        }
-       
-        for (i = 0; i < num_threads; i++) {
-            tinfo[i].thread_num = i+1;
-            tinfo[i].algo = algo;
-            if (pthread_create(&tinfo[i].thread_id, NULL, worker_thread, &tinfo[i]) != 0) {
-                    fprintf(stderr, "pthread_create failed!\n");
-                    return EXIT_FAILURE;
-            }
-        }
+    /* one epoch slot per matching thread */
+    ruleset_epoch = epoch_create(num_threads);
+    if (NULL == ruleset_epoch) {
+        fprintf(stderr,"calloc error\n");
+        return EXIT_FAILURE;
+    }
+    if (pthread_create(&reload_threadid, NULL, reload_thread, NULL) != 0) {
+        fprintf(stderr, "pthread_create failed reload thread!\n");
+        return EXIT_FAILURE;
+    }
 
-        for (i = 0; i < num_threads; i++) {
-            if ((s=pthread_join(tinfo[i].thread_id, NULL)) != 0) {
-                    fprintf(stderr,"pthread_join failed\n");
-                    return EXIT_FAILURE;
-            }
-        }
-        free(tinfo);
-    }  else {
-        start_time = clock();
-        char url[BUFF_SIZE];
-        while(fgets(url, BUFF_SIZE, fp) != NULL) {
-            pattern_match(url, algo,1);
-        }
-        end_time = clock();
+    /* wall clock time of the match, CPU time would add up the threads */
+    start_time = bench_now_ns();
+    ok = match_urls(algo, num_threads, stream, NULL);
+    end_time = bench_now_ns();
+    ok = url_stream_close(stream) && ok;
+    if (!ok) {
+        return EXIT_FAILURE;
     }
 
     if (measure_time) {
-        time_taken = ((double)(end_time - start_time))/CLOCKS_PER_SEC; // in seconds 
-        printf("Time taken is %f sec\n", time_taken);
+        printf("Load time is %f sec\n", load_time / 1e9);
+        printf("Time taken is %f sec\n", (end_time - start_time) / 1e9);
+    }
+
+    if (url_cache_bytes) {
+        fprintf(stderr, "url cache: hits %lu misses %lu hit rate %.1f%% evictions %lu not cached %lu\n",
+                url_cache_total.hits, url_cache_total.misses,
+                100.0 * url_cache_total.hits / (url_cache_total.hits + url_cache_total.misses + !url_cache_total.hits),
+                url_cache_total.evictions, url_cache_total.bypass);
     }
 
     printf("\n");
-    sem_destroy(&empty_sem);
-    sem_destroy(&full_sem);
-    pthread_mutex_destroy(&buffer_lock);
-    pthread_mutex_destroy(&lock);
 
-    free_pattern_allocated_memory();
-    fclose(fp);
+    atomic_store(&reload_exit, true);
+    sem_post(&reload_sem);
+    pthread_join(reload_threadid, NULL);
+    sem_destroy(&reload_sem);
+    epoch_free(ruleset_epoch);
+    url_engine_free(ruleset);
+    url_input_unmap(url_input);
+    if (STDIN_FILENO != url_fd) {
+        close(url_fd);
+    }
 
     return 0;
 }    
@@ -1,28 +1,170 @@
 #ifndef _URL_ENGINE_H_
 #define _URL_ENGINE_H_
 
-#define SET_MAX_SIZE    1000
-#define PATTERN_STRING_MAX_LENGTH 100
-#define BUFF_SIZE 1024
-
-/*! \struct _pattern_t 
- *  Used to hold each set from config.xml
- *  key - set id
- *  array of patterns
+#include <stdbool.h>
+#include <regex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "url_dfa.h"
+#include "url_prefilter.h"
+#include "url_hosttrie.h"
+#include "url_arena.h"
+#include "url_lib.h"
+#include "url_codegen.h"
+
+/* Pattern characters turning into BRE operators once escaped, or starting a
+ * bracket expression */
+#define REGEX_OPERATORS     "?+|()[\\"
+
+/* pattern_flags of a ruleset */
+/* first of patterns written the same way, verified once per url for all */
+#define PATTERN_SHARED      0x01
+/* '*' alone, matches the urls without a '/' and needs no verifier */
+#define PATTERN_ANY_HOST    0x02
+/* a pattern of the same set ranked before it matches whenever it does */
+#define PATTERN_SUBSUMED    0x04
+/* no character turning into a regex operator, POSIX and SELF agree on it */
+#define PATTERN_PLAIN       0x08
+/* SELF form with no '|' past its first '/', matched as host then path */
+#define PATTERN_SPLIT       0x10
+
+/*! \struct _shared_regex_t
+ *  Compiled POSIX pattern, shared by the rulesets reloaded from the same
+ *  pattern and freed by the last of them
  */
-typedef struct _pattern_t {
-    int key; 
-    int num_patterns; 
-    char *pattern[PATTERN_STRING_MAX_LENGTH]; 
-} pattern_t;
-
-typedef enum match_type{
-    POSIX=0,
-    SELF
-}MATCH_TYPE;
-
-#define TM_PRINTF(f_, ...)  \
-    if (debug_enabled)  \
+typedef struct _shared_regex_t {
+    regex_t regex;
+    int refs;
+} shared_regex_t;
+
+/*! \struct _ruleset_t
+ *  Immutable compiled form of the config sets used by the match path, the
+ *  url_engine_t of the library. A reload builds a new ruleset and swaps the
+ *  pointer, the old one is freed once no thread is matching with it.
+ *  The patterns are kept as arrays indexed by the pattern id (config order),
+ *  the strings live in one arena:
+ *  set_keys - key of each of the num_sets sets
+ *  set_hash - content hash of the patterns of the set, in order
+ *  pattern_set - index of the set of the pattern
+ *  pattern_off, pattern_len - pattern as written in the config
+ *  pattern_hash - content hash of the pattern as written
+ *  self_off - normalized pattern with '|' for the wildcard before first '/'
+ *  self_len, self_host - length of the SELF pattern and of its host part,
+ *  before its first '/'
+ *  is_domain - domain rule kept in the host trie
+ *  pattern_canon - first pattern written the same way once the consecutive
+ *  wildcards are removed, the pattern itself when it is the first. Such
+ *  duplicates share the SELF string and the regex of the first one.
+ *  dup_next - next duplicate of a first pattern, -1 at the end
+ *  pattern_flags - PATTERN_* of the pattern
+ *  num_duplicates, num_subsumed - patterns pruned at compile
+ *  regex - escaped and anchored POSIX pattern compiled by regcomp(), done
+ *  the first time the pattern is verified once regex_ready is set, under
+ *  regex_lock, or taken over from the ruleset reloaded
+ *  set_hash, pattern_hash - NULL for a mapped image, which is not reloaded
+ *  over
+ *  dfa - automata of the SELF patterns for the DFA algorithm, one per group
+ *  of patterns run on the urls where the prefilter finds one of them
+ *  self_prefilter, posix_prefilter - literal prefilter giving the candidate
+ *  patterns to verify for a url
+ *  hosttrie - domain rules, matched by one walk over the host labels and
+ *  left out of the prefilters
+ *  generation - unique id, results cached for an older ruleset are stale
+ *  image - mapped ruleset image the arrays point in, NULL when compiled
+ *  from a config
+ *  matcher_handle, matcher_verify - generated matcher of the NATIVE
+ *  algorithm, NULL when none is loaded
+ *  debug - TM_PRINTF the compile and the regexes compiled for the match,
+ *  taken over by a ruleset recompiled over it
+ */
+typedef struct _ruleset_t {
+    unsigned int generation;
+    int num_sets;
+    int *set_keys;
+    unsigned long long *set_hash;
+    int num_patterns;
+    url_arena_t strings;
+    int *pattern_set;
+    size_t *pattern_off;
+    int *pattern_len;
+    unsigned long long *pattern_hash;
+    size_t *self_off;
+    int *self_len;
+    int *self_host;
+    unsigned char *is_domain;
+    int *pattern_canon;
+    int *dup_next;
+    unsigned char *pattern_flags;
+    int num_duplicates;
+    int num_subsumed;
+    shared_regex_t **regex;
+    _Atomic unsigned char *regex_ready;
+    pthread_mutex_t regex_lock;
+    dfa_t *dfa;
+    prefilter_t *self_prefilter;
+    prefilter_t *posix_prefilter;
+    hosttrie_t *hosttrie;
+    void *image;
+    size_t image_size;
+    void *matcher_handle;
+    url_matcher_verify_fn matcher_verify;
+    bool debug;
+} ruleset_t;
+
+/*! \struct _config_sets_t
+ *  Sets read from config.xml, sized from the file while it is read
+ *  strings - all the patterns, pattern_off - offset of each pattern in it
+ *  sets - key and number of patterns of each set, set_first - index of the
+ *  first pattern of the set
+ *  debug - TM_PRINTF the config as it is read
+ */
+typedef struct _config_sets_t {
+    url_arena_t strings;
+    size_t *pattern_off;
+    int num_patterns;
+    int max_patterns;
+    url_engine_set_t *sets;
+    int *set_first;
+    int num_sets;
+    int max_sets;
+    bool debug;
+} config_sets_t;
+
+/*! \struct _url_engine_scratch_t
+ *  Match state of one thread, the url_engine_scratch_t of the library
+ *  hits, ids - host trie hits and matching ids, grown to the patterns of
+ *  the ruleset in use
+ *  order - candidates of a set sorted cheapest first, same size
+ *  memo - result of a shared pattern for the url, memo_stamp << 1 | result
+ *  normalize - URL_NORMALIZE_* done in url_buf before the match
+ *  profile - per pattern verifier counters of the ruleset of
+ *  profile_generation, NULL when not profiling
+ *  debug - TM_PRINTF the result of each pattern verified
+ */
+struct _url_engine_scratch_t {
+    MATCH_TYPE algo;
+    MATCH_MODE mode;
+    dfa_cache_t *dfa_cache;
+    prefilter_scratch_t *pf_scratch;
+    int *hits;
+    int *ids;
+    int *order;
+    unsigned int *memo;
+    unsigned int memo_stamp;
+    int ids_size;
+    int normalize;
+    char *url_buf;
+    size_t url_buf_size;
+    bool profiling;
+    url_engine_pattern_stats_t *profile;
+    unsigned int profile_generation;
+    bool debug;
+};
+
+unsigned int ruleset_new_generation();
+
+#define TM_PRINTF(debug_, f_, ...)  \
+    if (debug_)  \
         printf((f_), ##__VA_ARGS__) \
 
 #endif /* ifndef _URL_ENGINE_H_ */
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include "url_epoch.h"
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to create the epoch state for a fixed number of readers
+ *
+ * @Param num_readers
+ *
+ * @Returns   epoch state, NULL on failure
+ */
+/* ----------------------------------------------------------------------------*/
+epoch_t * epoch_create(int num_readers)
+{
+    epoch_t *ep;
+    int i;
+
+    if (num_readers < 1) {
+        num_readers = 1;
+    }
+
+    ep = aligned_alloc(CACHE_LINE_SIZE, sizeof(epoch_t));
+    if (NULL == ep) {
+        return NULL;
+    }
+    ep->slots = aligned_alloc(CACHE_LINE_SIZE, num_readers * sizeof(epoch_slot_t));
+    if (NULL == ep->slots) {
+        free(ep);
+        return NULL;
+    }
+
+    /* 0 is kept for a reader outside its section */
+    atomic_init(&ep->global, 1);
+    for (i=0;i<num_readers;i++) {
+        atomic_init(&ep->slots[i].epoch, 0);
+    }
+    ep->num_readers = num_readers;
+
+    return ep;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the epoch state
+ *
+ * @Param ep
+ */
+/* ----------------------------------------------------------------------------*/
+void epoch_free(epoch_t * ep)
+{
+    if (!ep) {
+        return;
+    }
+    free(ep->slots);
+    free(ep);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function called by the writer after it swapped the shared
+ * pointer. The global epoch moves on, a reader entering from now on sees the
+ * new pointer. The old data is free to reclaim once no reader is left in an
+ * older epoch. Only the writer waits, the readers never block.
+ *
+ * @Param ep
+ */
+/* ----------------------------------------------------------------------------*/
+void epoch_synchronize(epoch_t * ep)
+{
+    unsigned long epoch, seen;
+    int i;
+
+    epoch = atomic_fetch_add(&ep->global, 1) + 1;
+    for (i=0;i<ep->num_readers;i++) {
+        for (;;) {
+            seen = atomic_load(&ep->slots[i].epoch);
+            if (0 == seen || seen >= epoch) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
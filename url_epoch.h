@@ -0,0 +1,61 @@
+#ifndef _URL_EPOCH_H_
+#define _URL_EPOCH_H_
+
+#include <stdatomic.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+/*! \struct _epoch_slot_t
+ *  Epoch a reader thread entered its read side section in, 0 when the
+ *  reader is outside. On its own cache line, only its reader writes it.
+ */
+typedef struct _epoch_slot_t {
+    _Alignas(CACHE_LINE_SIZE) atomic_ulong epoch;
+} epoch_slot_t;
+
+/*! \struct _epoch_t
+ *  Epoch based reclamation of data shared by pointer with the readers.
+ *  The writer swaps the pointer, then epoch_synchronize() waits till every
+ *  reader that might still see the old data has left its section.
+ */
+typedef struct _epoch_t {
+    _Alignas(CACHE_LINE_SIZE) atomic_ulong global;
+    int num_readers;
+    epoch_slot_t *slots;
+} epoch_t;
+
+epoch_t * epoch_create(int num_readers);
+void epoch_free(epoch_t * ep);
+void epoch_synchronize(epoch_t * ep);
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to enter the read side section, the shared pointer must
+ * be loaded after this
+ *
+ * @Param ep
+ * @Param reader - index of the reader thread
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void epoch_enter(epoch_t * ep, int reader)
+{
+    atomic_store(&ep->slots[reader].epoch, atomic_load(&ep->global));
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to leave the read side section, the data loaded in the
+ * section must not be used after this
+ *
+ * @Param ep
+ * @Param reader
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void epoch_exit(epoch_t * ep, int reader)
+{
+    atomic_store_explicit(&ep->slots[reader].epoch, 0, memory_order_release);
+}
+
+#endif /* ifndef _URL_EPOCH_H_ */
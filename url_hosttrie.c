@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "url_hosttrie.h"
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to check if a SELF pattern is a domain rule
+ *  1. optional '|.' - any labels in front of the host
+ *  2. host - labels of [A-Za-z0-9_-] separated by '.'
+ *  3. nothing or '/' and '*' after the host
+ *
+ * @Param pattern - SELF pattern
+ * @Param host
+ * @Param host_len
+ * @Param flags
+ *
+ * @Returns   true if the pattern can go into the trie
+ */
+/* ----------------------------------------------------------------------------*/
+bool hosttrie_parse(const char * pattern, const char ** host, int * host_len, int * flags)
+{
+    const char *p = pattern;
+    bool label_start = true;
+
+    *flags = 0;
+    if (p[0] == '|' && p[1] == '.') {
+        *flags |= HOSTTRIE_WILDCARD;
+        p += 2;
+    }
+
+    *host = p;
+    for (; *p && *p != '/'; p++) {
+        if (*p == '.') {
+            if (label_start) {
+                return false;
+            }
+            label_start = true;
+        } else if (isalnum((unsigned char)*p) || *p == '-' || *p == '_') {
+            label_start = false;
+        } else {
+            return false;
+        }
+    }
+    /* empty host or empty last label */
+    if (label_start) {
+        return false;
+    }
+    *host_len = p - *host;
+
+    if (*p == '\0') {
+        return true;
+    }
+    if (!strcmp(p, "/*")) {
+        *flags |= HOSTTRIE_PATH_ANY;
+        return true;
+    }
+    return false;
+}
+
+static inline unsigned int edge_hash(int parent, const char * label, int len)
+{
+    unsigned int h = 2166136261u ^ (unsigned int)parent * 2654435761u;
+    int i;
+
+    for (i=0;i<len;i++) {
+        h = (h ^ (unsigned char)label[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to find the child of parent for the label
+ *
+ * @Returns   child node, -1 when none
+ */
+/* ----------------------------------------------------------------------------*/
+static int hosttrie_child(const hosttrie_t * trie, int parent, const char * label, int len)
+{
+    unsigned int slot;
+    int child;
+
+    for (slot = edge_hash(parent, label, len) & trie->edge_mask; (child = trie->edge[slot]) >= 0;
+            slot = (slot+1) & trie->edge_mask) {
+        if (trie->parent[child] == parent && trie->label_len[child] == len &&
+                !memcmp(trie->labels + trie->label_off[child], label, len)) {
+            return child;
+        }
+    }
+    return -1;
+}
+
+static void hosttrie_insert_edge(hosttrie_t * trie, int child)
+{
+    unsigned int slot;
+
+    slot = edge_hash(trie->parent[child], trie->labels + trie->label_off[child], trie->label_len[child]) & trie->edge_mask;
+    while (trie->edge[slot] >= 0) {
+        slot = (slot+1) & trie->edge_mask;
+    }
+    trie->edge[slot] = child;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to grow the node, label and edge arrays to fit one
+ * more node
+ *
+ * @Returns   true on success
+ */
+/* ----------------------------------------------------------------------------*/
+static bool hosttrie_reserve(hosttrie_t * trie, int label_len)
+{
+    int i, max_nodes, size, *edge;
+    void *p;
+
+    if (trie->num_nodes == trie->max_nodes) {
+        max_nodes = trie->max_nodes ? 2*trie->max_nodes : 64;
+        if (NULL == (p = realloc(trie->parent, max_nodes * sizeof(int)))) return false;
+        trie->parent = p;
+        if (NULL == (p = realloc(trie->label_off, max_nodes * sizeof(int)))) return false;
+        trie->label_off = p;
+        if (NULL == (p = realloc(trie->label_len, max_nodes * sizeof(int)))) return false;
+        trie->label_len = p;
+        if (NULL == (p = realloc(trie->rule_first, max_nodes * sizeof(int)))) return false;
+        trie->rule_first = p;
+        trie->max_nodes = max_nodes;
+
+        /* keep the edge table at most a quarter full */
+        size = 4 * max_nodes;
+        edge = malloc(size * sizeof(int));
+        if (NULL == edge) {
+            return false;
+        }
+        free(trie->edge);
+        trie->edge = edge;
+        trie->edge_mask = size - 1;
+        memset(trie->edge, 0xff, size * sizeof(int));
+        for (i=1;i<trie->num_nodes;i++) {
+            hosttrie_insert_edge(trie, i);
+        }
+    }
+
+    if (trie->labels_used + label_len > trie->labels_size) {
+        size = trie->labels_size ? trie->labels_size : 1024;
+        while (trie->labels_used + label_len > size) {
+            size *= 2;
+        }
+        if (NULL == (p = realloc(trie->labels, size))) return false;
+        trie->labels = p;
+        trie->labels_size = size;
+    }
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to create an empty trie holding only the root
+ *
+ * @Returns   trie, NULL on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+hosttrie_t * hosttrie_create()
+{
+    hosttrie_t *trie = calloc(1, sizeof(hosttrie_t));
+
+    if (NULL == trie) {
+        return NULL;
+    }
+    if (!hosttrie_reserve(trie, 0)) {
+        hosttrie_free(trie);
+        return NULL;
+    }
+    trie->parent[0] = -1;
+    trie->label_off[0] = 0;
+    trie->label_len[0] = 0;
+    trie->rule_first[0] = -1;
+    trie->num_nodes = 1;
+    return trie;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add a domain rule, labels are walked from the right
+ *
+ * @Param trie
+ * @Param host
+ * @Param host_len
+ * @Param flags
+ * @Param pattern_id
+ *
+ * @Returns   true on success
+ */
+/* ----------------------------------------------------------------------------*/
+bool hosttrie_add(hosttrie_t * trie, const char * host, int host_len, int flags, int pattern_id)
+{
+    int node = 0, child, start, end = host_len, max_rules;
+    void *p;
+
+    while (end > 0) {
+        for (start = end; start > 0 && host[start-1] != '.'; start--);
+        child = hosttrie_child(trie, node, host + start, end - start);
+        if (child < 0) {
+            if (!hosttrie_reserve(trie, end - start)) {
+                return false;
+            }
+            child = trie->num_nodes++;
+            trie->parent[child] = node;
+            trie->label_off[child] = trie->labels_used;
+            trie->label_len[child] = end - start;
+            trie->rule_first[child] = -1;
+            memcpy(trie->labels + trie->labels_used, host + start, end - start);
+            trie->labels_used += end - start;
+            hosttrie_insert_edge(trie, child);
+        }
+        node = child;
+        end = start - 1;
+    }
+
+    if (trie->num_rules == trie->max_rules) {
+        max_rules = trie->max_rules ? 2*trie->max_rules : 64;
+        if (NULL == (p = realloc(trie->rule_pattern, max_rules * sizeof(int)))) return false;
+        trie->rule_pattern = p;
+        if (NULL == (p = realloc(trie->rule_flags, max_rules * sizeof(int)))) return false;
+        trie->rule_flags = p;
+        if (NULL == (p = realloc(trie->rule_next, max_rules * sizeof(int)))) return false;
+        trie->rule_next = p;
+        trie->max_rules = max_rules;
+    }
+    trie->rule_pattern[trie->num_rules] = pattern_id;
+    trie->rule_flags[trie->num_rules] = flags;
+    trie->rule_next[trie->num_rules] = trie->rule_first[node];
+    trie->rule_first[node] = trie->num_rules++;
+
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the trie
+ *
+ * @Param trie
+ */
+/* ----------------------------------------------------------------------------*/
+void hosttrie_free(hosttrie_t * trie)
+{
+    if (!trie) {
+        return;
+    }
+    free(trie->parent);
+    free(trie->label_off);
+    free(trie->label_len);
+    free(trie->rule_first);
+    free(trie->labels);
+    free(trie->rule_pattern);
+    free(trie->rule_flags);
+    free(trie->rule_next);
+    free(trie->edge);
+    free(trie);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to find every domain rule matching the url with one
+ * walk over the host labels from the right. After the labels of a node are
+ * matched, wildcard rules need a '.' in front and exact rules the start of
+ * the url. The part after the host decides between the path rules.
+ *
+ * @Param trie
+ * @Param url
+ * @Param len
+ * @Param hits - ids of the matching patterns in increasing order, room for
+ *               num_rules ids
+ *
+ * @Returns   number of matching patterns
+ */
+/* ----------------------------------------------------------------------------*/
+int hosttrie_match(const hosttrie_t * trie, const char * url, size_t len, int * hits)
+{
+    const char *slash = memchr(url, '/', len);
+    int node = 0, rule, flags, n = 0, k, id;
+    int path_flag = slash ? HOSTTRIE_PATH_ANY : 0;
+    size_t start, end = slash ? (size_t)(slash - url) : len;
+
+    if (trie->num_rules == 0) {
+        return 0;
+    }
+
+    for (;;) {
+        for (start = end; start > 0 && url[start-1] != '.'; start--);
+        node = hosttrie_child(trie, node, url + start, end - start);
+        if (node < 0) {
+            break;
+        }
+        for (rule = trie->rule_first[node]; rule >= 0; rule = trie->rule_next[rule]) {
+            flags = trie->rule_flags[rule];
+            if ((flags & HOSTTRIE_PATH_ANY) != path_flag) {
+                continue;
+            }
+            if (((flags & HOSTTRIE_WILDCARD) && start == 0) ||
+                    (!(flags & HOSTTRIE_WILDCARD) && start != 0)) {
+                continue;
+            }
+            /* few hits, insertion keeps them in config order */
+            id = trie->rule_pattern[rule];
+            for (k=n++;k>0 && hits[k-1]>id;k--) {
+                hits[k] = hits[k-1];
+            }
+            hits[k] = id;
+        }
+        if (start == 0) {
+            break;
+        }
+        end = start - 1;
+    }
+
+    return n;
+}
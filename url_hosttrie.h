@@ -0,0 +1,42 @@
+#ifndef _URL_HOSTTRIE_H_
+#define _URL_HOSTTRIE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Rule flags */
+#define HOSTTRIE_WILDCARD   0x1     /* '|.' before the host, any labels in front */
+#define HOSTTRIE_PATH_ANY   0x2     /* '/' and '*' after the host, url has a path */
+
+/*! \struct _hosttrie_t
+ *  Trie of domain rules keyed on the host labels in reverse order
+ *  (com -> yahoo), shared read only by the threads. Node 0 is the root.
+ *  Edges are found through an open addressing table on (parent, label).
+ *  rule_first - first rule of the node, -1 when none
+ */
+typedef struct _hosttrie_t {
+    int num_nodes;
+    int max_nodes;
+    int *parent;
+    int *label_off;
+    int *label_len;
+    int *rule_first;
+    char *labels;
+    int labels_used;
+    int labels_size;
+    int num_rules;
+    int max_rules;
+    int *rule_pattern;
+    int *rule_flags;
+    int *rule_next;
+    int *edge;
+    int edge_mask;
+} hosttrie_t;
+
+bool hosttrie_parse(const char * pattern, const char ** host, int * host_len, int * flags);
+hosttrie_t * hosttrie_create();
+bool hosttrie_add(hosttrie_t * trie, const char * host, int host_len, int flags, int pattern_id);
+void hosttrie_free(hosttrie_t * trie);
+int hosttrie_match(const hosttrie_t * trie, const char * url, size_t len, int * hits);
+
+#endif /* ifndef _URL_HOSTTRIE_H_ */
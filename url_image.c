@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "url_image.h"
+
+/*! \struct _image_section_t
+ *  Where an array of the ruleset lives while saving or loading an image.
+ *  field - the pointer of the ruleset to the array, NULL when the array is
+ *  a part of a struct (data)
+ */
+typedef struct _image_section_t {
+    void **field;
+    void *data;
+    size_t size;
+} image_section_t;
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to round an image offset up to URL_IMAGE_ALIGN
+ *
+ * @Param off
+ *
+ * @Returns   aligned offset
+ */
+/* ----------------------------------------------------------------------------*/
+static inline size_t image_align(size_t off)
+{
+    return (off + URL_IMAGE_ALIGN - 1) & ~(size_t)(URL_IMAGE_ALIGN - 1);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to checksum the image, 4 words at a time in 4
+ * independent lanes so that the multiplies overlap
+ *
+ * @Param data
+ * @Param len
+ *
+ * @Returns   checksum
+ */
+/* ----------------------------------------------------------------------------*/
+static uint64_t image_checksum(const unsigned char * data, size_t len)
+{
+    uint64_t lane[4] = { 0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+        0x165667b19e3779f9ULL, 0x27d4eb2f165667c5ULL }, word, h;
+    size_t i;
+    int k;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        for (k = 0; k < 4; k++) {
+            memcpy(&word, data + i + 8*k, 8);
+            lane[k] = (lane[k] ^ word) * 0xff51afd7ed558ccdULL;
+            lane[k] ^= lane[k] >> 29;
+        }
+    }
+    for (k = 0; i < len; i += 8, k++) {
+        word = 0;
+        memcpy(&word, data + i, (len - i < 8) ? len - i : 8);
+        lane[k] = (lane[k] ^ word) * 0xff51afd7ed558ccdULL;
+    }
+
+    h = len;
+    for (k = 0; k < 4; k++) {
+        h = (h ^ lane[k]) * 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+    }
+    return h;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to describe one prefilter array
+ *
+ * @Param sections
+ * @Param id
+ * @Param field
+ * @Param size
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void image_section(image_section_t * sections, int id, void * field, size_t size)
+{
+    sections[id].field = field;
+    sections[id].data = NULL;
+    sections[id].size = size;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to list the arrays of the ruleset with their size.
+ * Saving and loading go through the same list, the counts of the ruleset
+ * and of its automata give the sizes.
+ *
+ * @Param rs
+ * @Param sections - IMG_NUM_SECTIONS
+ */
+/* ----------------------------------------------------------------------------*/
+static void image_sections(ruleset_t * rs, image_section_t * sections)
+{
+    prefilter_t *pf[2] = { rs->self_prefilter, rs->posix_prefilter };
+    hosttrie_t *ht = rs->hosttrie;
+    dfa_t *dfa = rs->dfa;
+    size_t np = rs->num_patterns, nodes;
+    int i, base;
+
+    image_section(sections, IMG_SET_KEYS, &rs->set_keys, rs->num_sets * sizeof(int));
+    image_section(sections, IMG_PATTERN_SET, &rs->pattern_set, np * sizeof(int));
+    image_section(sections, IMG_PATTERN_OFF, &rs->pattern_off, np * sizeof(size_t));
+    image_section(sections, IMG_PATTERN_LEN, &rs->pattern_len, np * sizeof(int));
+    image_section(sections, IMG_SELF_OFF, &rs->self_off, np * sizeof(size_t));
+    image_section(sections, IMG_SELF_LEN, &rs->self_len, np * sizeof(int));
+    image_section(sections, IMG_SELF_HOST, &rs->self_host, np * sizeof(int));
+    image_section(sections, IMG_IS_DOMAIN, &rs->is_domain, np * sizeof(unsigned char));
+    image_section(sections, IMG_PATTERN_CANON, &rs->pattern_canon, np * sizeof(int));
+    image_section(sections, IMG_DUP_NEXT, &rs->dup_next, np * sizeof(int));
+    image_section(sections, IMG_PATTERN_FLAGS, &rs->pattern_flags, np * sizeof(unsigned char));
+    image_section(sections, IMG_STRINGS, &rs->strings.data, rs->strings.used);
+
+    image_section(sections, IMG_DFA_TOKEN, &dfa->token, dfa->num_states * sizeof(unsigned char));
+    image_section(sections, IMG_DFA_CH, &dfa->ch, dfa->num_states * sizeof(unsigned char));
+    image_section(sections, IMG_DFA_PATTERN_ID, &dfa->pattern_id, dfa->num_states * sizeof(int));
+    image_section(sections, IMG_DFA_START, &dfa->start, dfa->num_start * sizeof(int));
+    image_section(sections, IMG_DFA_GROUP_STATE, &dfa->group_state, (dfa->num_groups + 1) * sizeof(int));
+    image_section(sections, IMG_DFA_GROUP_START, &dfa->group_start, (dfa->num_groups + 1) * sizeof(int));
+    image_section(sections, IMG_DFA_NUM_CLASSES, &dfa->num_classes, dfa->num_groups * sizeof(int));
+    image_section(sections, IMG_DFA_CLASSES, &dfa->classes, dfa->num_groups * 256 * sizeof(unsigned char));
+    image_section(sections, IMG_DFA_PATTERN_GROUP, &dfa->pattern_group, np * sizeof(int));
+
+    for (i = 0; i < 2; i++) {
+        base = i * (IMG_PF_POSIX - IMG_PF_ROOT_NEXT);
+        nodes = pf[i]->num_nodes;
+        sections[base + IMG_PF_ROOT_NEXT].field = NULL;
+        sections[base + IMG_PF_ROOT_NEXT].data = pf[i]->root_next;
+        sections[base + IMG_PF_ROOT_NEXT].size = sizeof(pf[i]->root_next);
+        image_section(sections, base + IMG_PF_LABEL, &pf[i]->label, nodes * sizeof(unsigned char));
+        image_section(sections, base + IMG_PF_FIRST_CHILD, &pf[i]->first_child, nodes * sizeof(int));
+        image_section(sections, base + IMG_PF_NEXT_SIBLING, &pf[i]->next_sibling, nodes * sizeof(int));
+        image_section(sections, base + IMG_PF_FAIL, &pf[i]->fail, nodes * sizeof(int));
+        image_section(sections, base + IMG_PF_OUT_FIRST, &pf[i]->out_first, nodes * sizeof(int));
+        image_section(sections, base + IMG_PF_OUT_LINK, &pf[i]->out_link, nodes * sizeof(int));
+        image_section(sections, base + IMG_PF_OUT_PATTERN, &pf[i]->out_pattern, pf[i]->num_patterns * sizeof(int));
+        image_section(sections, base + IMG_PF_OUT_NEXT, &pf[i]->out_next, pf[i]->num_patterns * sizeof(int));
+        image_section(sections, base + IMG_PF_ALWAYS, &pf[i]->always, pf[i]->num_always * sizeof(int));
+    }
+
+    image_section(sections, IMG_HT_PARENT, &ht->parent, ht->num_nodes * sizeof(int));
+    image_section(sections, IMG_HT_LABEL_OFF, &ht->label_off, ht->num_nodes * sizeof(int));
+    image_section(sections, IMG_HT_LABEL_LEN, &ht->label_len, ht->num_nodes * sizeof(int));
+    image_section(sections, IMG_HT_RULE_FIRST, &ht->rule_first, ht->num_nodes * sizeof(int));
+    image_section(sections, IMG_HT_LABELS, &ht->labels, ht->labels_used);
+    image_section(sections, IMG_HT_RULE_PATTERN, &ht->rule_pattern, ht->num_rules * sizeof(int));
+    image_section(sections, IMG_HT_RULE_FLAGS, &ht->rule_flags, ht->num_rules * sizeof(int));
+    image_section(sections, IMG_HT_RULE_NEXT, &ht->rule_next, ht->num_rules * sizeof(int));
+    image_section(sections, IMG_HT_EDGE, &ht->edge, ((size_t)ht->edge_mask + 1) * sizeof(int));
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to check if a file is a ruleset image rather than a
+ * config.xml
+ *
+ * @Param path
+ *
+ * @Returns   true when the file starts with URL_IMAGE_MAGIC
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_image_is_image(const char * path)
+{
+    char magic[URL_IMAGE_MAGIC_LEN];
+    FILE *fp;
+    bool is_image;
+
+    fp = fopen(path, "rb");
+    if (NULL == fp) {
+        return false;
+    }
+    is_image = (1 == fread(magic, sizeof(magic), 1, fp)) && !memcmp(magic, URL_IMAGE_MAGIC, sizeof(magic));
+    fclose(fp);
+    return is_image;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write the compiled ruleset to an image. The image
+ * is written aside and renamed over path, a running engine which has the
+ * old image mapped keeps reading the old file.
+ *
+ * @Param rs
+ * @Param path
+ *
+ * @Returns   false on failure
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_image_save(const ruleset_t * rs, const char * path)
+{
+    image_section_t sections[IMG_NUM_SECTIONS];
+    url_image_header_t *hdr;
+    unsigned char *image;
+    size_t off, file_size;
+    char *tmp_path;
+    FILE *fp;
+    bool ok;
+    int i;
+
+    /* only read, the list is shared with the loader which fills it */
+    image_sections((ruleset_t *)rs, sections);
+
+    off = image_align(sizeof(url_image_header_t));
+    for (i = 0; i < IMG_NUM_SECTIONS; i++) {
+        off = image_align(off + sections[i].size);
+    }
+    file_size = off;
+
+    image = calloc(1, file_size);
+    tmp_path = malloc(strlen(path) + 5);
+    if (!image || !tmp_path) {
+        free(image);
+        free(tmp_path);
+        fprintf(stderr, "Image allocation failed\n");
+        return false;
+    }
+
+    hdr = (url_image_header_t *)image;
+    memcpy(hdr->magic, URL_IMAGE_MAGIC, URL_IMAGE_MAGIC_LEN);
+    hdr->version = URL_IMAGE_VERSION;
+    hdr->byte_order = URL_IMAGE_BYTE_ORDER;
+    hdr->word_size = sizeof(size_t);
+    hdr->num_sections = IMG_NUM_SECTIONS;
+    hdr->file_size = file_size;
+    hdr->strings_size = rs->strings.used;
+    hdr->num_sets = rs->num_sets;
+    hdr->num_patterns = rs->num_patterns;
+    hdr->dfa_num_states = rs->dfa->num_states;
+    hdr->dfa_num_start = rs->dfa->num_start;
+    hdr->dfa_num_groups = rs->dfa->num_groups;
+    hdr->prefilter[0].num_nodes = rs->self_prefilter->num_nodes;
+    hdr->prefilter[0].num_patterns = rs->self_prefilter->num_patterns;
+    hdr->prefilter[0].num_always = rs->self_prefilter->num_always;
+    hdr->prefilter[1].num_nodes = rs->posix_prefilter->num_nodes;
+    hdr->prefilter[1].num_patterns = rs->posix_prefilter->num_patterns;
+    hdr->prefilter[1].num_always = rs->posix_prefilter->num_always;
+    hdr->ht_num_nodes = rs->hosttrie->num_nodes;
+    hdr->ht_num_rules = rs->hosttrie->num_rules;
+    hdr->ht_labels_used = rs->hosttrie->labels_used;
+    hdr->ht_edge_mask = rs->hosttrie->edge_mask;
+    hdr->num_duplicates = rs->num_duplicates;
+    hdr->num_subsumed = rs->num_subsumed;
+
+    off = image_align(sizeof(url_image_header_t));
+    for (i = 0; i < IMG_NUM_SECTIONS; i++) {
+        hdr->sections[i].off = off;
+        hdr->sections[i].size = sections[i].size;
+        if (sections[i].size) {
+            memcpy(image + off, sections[i].field ? *sections[i].field : sections[i].data, sections[i].size);
+        }
+        off = image_align(off + sections[i].size);
+    }
+    hdr->checksum = image_checksum(image + sizeof(url_image_header_t), file_size - sizeof(url_image_header_t));
+
+    sprintf(tmp_path, "%s.tmp", path);
+    fp = fopen(tmp_path, "wb");
+    if (NULL == fp) {
+        fprintf(stderr, "Could not open file %s\n", tmp_path);
+        free(image);
+        free(tmp_path);
+        return false;
+    }
+    ok = (1 == fwrite(image, file_size, 1, fp));
+    ok = (0 == fclose(fp)) && ok;
+    ok = ok && (0 == rename(tmp_path, path));
+    if (!ok) {
+        fprintf(stderr, "Could not write the image %s\n", path);
+        unlink(tmp_path);
+    }
+
+    free(image);
+    free(tmp_path);
+    return ok;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to check the header of a mapped image
+ *
+ * @Param hdr
+ * @Param size - of the file
+ *
+ * @Returns   NULL when fine, else the reason
+ */
+/* ----------------------------------------------------------------------------*/
+static const char * image_check_header(const url_image_header_t * hdr, size_t size)
+{
+    int i;
+
+    if (size < sizeof(url_image_header_t) || memcmp(hdr->magic, URL_IMAGE_MAGIC, URL_IMAGE_MAGIC_LEN)) {
+        return "not a ruleset image";
+    }
+    if (hdr->version != URL_IMAGE_VERSION) {
+        return "image version not supported, compile the config again";
+    }
+    if (hdr->byte_order != URL_IMAGE_BYTE_ORDER || hdr->word_size != sizeof(size_t) ||
+            hdr->num_sections != IMG_NUM_SECTIONS) {
+        return "image written on another machine type";
+    }
+    if (hdr->file_size != size) {
+        return "truncated image";
+    }
+    if (hdr->num_sets < 0 || hdr->num_patterns < 0 || hdr->dfa_num_states < 0 || hdr->dfa_num_start < 0 ||
+            hdr->dfa_num_groups < 0 ||
+            hdr->prefilter[0].num_nodes < 1 || hdr->prefilter[1].num_nodes < 1 ||
+            hdr->prefilter[0].num_always < 0 || hdr->prefilter[1].num_always < 0 ||
+            hdr->ht_num_nodes < 1 || hdr->ht_num_rules < 0 || hdr->ht_labels_used < 0 || hdr->ht_edge_mask < 0 ||
+            hdr->num_duplicates < 0 || hdr->num_subsumed < 0) {
+        return "bad counts";
+    }
+    for (i = 0; i < IMG_NUM_SECTIONS; i++) {
+        if (hdr->sections[i].off % URL_IMAGE_ALIGN || hdr->sections[i].off > size ||
+                hdr->sections[i].size > size - hdr->sections[i].off) {
+            return "section out of the file";
+        }
+    }
+    if (image_checksum((const unsigned char *)hdr + sizeof(url_image_header_t),
+                size - sizeof(url_image_header_t)) != hdr->checksum) {
+        return "checksum mismatch";
+    }
+    return NULL;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to map a ruleset image. The arrays of the ruleset and
+ * of its automata point in the mapping, nothing is parsed or copied. Only
+ * the regex state is built, lazily as for a compiled config.
+ *
+ * @Param path
+ *
+ * @Returns   ruleset to free with url_engine_free(), NULL on failure
+ */
+/* ----------------------------------------------------------------------------*/
+ruleset_t * url_image_load(const char * path)
+{
+    image_section_t sections[IMG_NUM_SECTIONS];
+    const url_image_header_t *hdr;
+    const char *error;
+    ruleset_t *rs;
+    prefilter_t *pf[2];
+    struct stat st;
+    void *image;
+    int fd, i;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(url_image_header_t)) {
+        close(fd);
+        fprintf(stderr, "Bad ruleset image %s: not a ruleset image\n", path);
+        return NULL;
+    }
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == image) {
+        return NULL;
+    }
+
+    hdr = image;
+    error = image_check_header(hdr, st.st_size);
+    if (error) {
+        fprintf(stderr, "Bad ruleset image %s: %s\n", path, error);
+        munmap(image, st.st_size);
+        return NULL;
+    }
+
+    rs = calloc(1, sizeof(ruleset_t));
+    if (NULL == rs) {
+        munmap(image, st.st_size);
+        return NULL;
+    }
+    pthread_mutex_init(&rs->regex_lock, NULL);
+    rs->image = image;
+    rs->image_size = st.st_size;
+    rs->dfa = calloc(1, sizeof(dfa_t));
+    rs->self_prefilter = pf[0] = calloc(1, sizeof(prefilter_t));
+    rs->posix_prefilter = pf[1] = calloc(1, sizeof(prefilter_t));
+    rs->hosttrie = calloc(1, sizeof(hosttrie_t));
+    rs->regex = calloc(hdr->num_patterns ? hdr->num_patterns : 1, sizeof(shared_regex_t *));
+    rs->regex_ready = calloc(hdr->num_patterns ? hdr->num_patterns : 1, sizeof(unsigned char));
+    if (!rs->dfa || !pf[0] || !pf[1] || !rs->hosttrie || !rs->regex || !rs->regex_ready) {
+        url_engine_free(rs);
+        return NULL;
+    }
+
+    rs->generation = ruleset_new_generation();
+    rs->num_sets = hdr->num_sets;
+    rs->num_patterns = hdr->num_patterns;
+    rs->num_duplicates = hdr->num_duplicates;
+    rs->num_subsumed = hdr->num_subsumed;
+    rs->strings.used = rs->strings.size = hdr->strings_size;
+    rs->dfa->generation = dfa_new_generation();
+    rs->dfa->num_patterns = hdr->num_patterns;
+    rs->dfa->num_states = hdr->dfa_num_states;
+    rs->dfa->num_start = hdr->dfa_num_start;
+    rs->dfa->num_groups = hdr->dfa_num_groups;
+    for (i = 0; i < 2; i++) {
+        pf[i]->generation = prefilter_new_generation();
+        pf[i]->refs = 1;
+        pf[i]->num_nodes = hdr->prefilter[i].num_nodes;
+        pf[i]->num_patterns = hdr->prefilter[i].num_patterns;
+        pf[i]->num_always = hdr->prefilter[i].num_always;
+    }
+    rs->hosttrie->num_nodes = rs->hosttrie->max_nodes = hdr->ht_num_nodes;
+    rs->hosttrie->num_rules = rs->hosttrie->max_rules = hdr->ht_num_rules;
+    rs->hosttrie->labels_used = rs->hosttrie->labels_size = hdr->ht_labels_used;
+    rs->hosttrie->edge_mask = hdr->ht_edge_mask;
+
+    /* the counts give the size every section must have */
+    image_sections(rs, sections);
+    for (i = 0; i < IMG_NUM_SECTIONS; i++) {
+        if (hdr->sections[i].size != sections[i].size) {
+            fprintf(stderr, "Bad ruleset image %s: section %d size\n", path, i);
+            url_engine_free(rs);
+            return NULL;
+        }
+        if (sections[i].field) {
+            *sections[i].field = (char *)image + hdr->sections[i].off;
+        } else {
+            memcpy(sections[i].data, (char *)image + hdr->sections[i].off, sections[i].size);
+        }
+    }
+
+    return rs;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to unmap the image of a ruleset and free the structs
+ * pointing in it. The arrays belong to the mapping.
+ *
+ * @Param rs
+ */
+/* ----------------------------------------------------------------------------*/
+void url_image_unmap(ruleset_t * rs)
+{
+    free(rs->dfa);
+    free(rs->self_prefilter);
+    free(rs->posix_prefilter);
+    free(rs->hosttrie);
+    munmap(rs->image, rs->image_size);
+    rs->image = NULL;
+}
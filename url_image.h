@@ -0,0 +1,118 @@
+#ifndef _URL_IMAGE_H_
+#define _URL_IMAGE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "url_engine.h"
+
+/* First bytes of a ruleset image, a config.xml never starts with them */
+#define URL_IMAGE_MAGIC         "URLIMG\r\n"
+#define URL_IMAGE_MAGIC_LEN     8
+/* Bumped on any change of the layout, an older image is refused */
+#define URL_IMAGE_VERSION       4
+#define URL_IMAGE_BYTE_ORDER    0x01020304
+/* Sections start on this boundary so the arrays can be used in place */
+#define URL_IMAGE_ALIGN         8
+
+/* Arrays of the ruleset held in the image, in file order */
+typedef enum url_image_section{
+    IMG_SET_KEYS=0,
+    IMG_PATTERN_SET,
+    IMG_PATTERN_OFF,
+    IMG_PATTERN_LEN,
+    IMG_SELF_OFF,
+    IMG_SELF_LEN,
+    IMG_SELF_HOST,
+    IMG_IS_DOMAIN,
+    IMG_PATTERN_CANON,
+    IMG_DUP_NEXT,
+    IMG_PATTERN_FLAGS,
+    IMG_STRINGS,
+    IMG_DFA_TOKEN,
+    IMG_DFA_CH,
+    IMG_DFA_PATTERN_ID,
+    IMG_DFA_START,
+    IMG_DFA_GROUP_STATE,
+    IMG_DFA_GROUP_START,
+    IMG_DFA_NUM_CLASSES,
+    IMG_DFA_CLASSES,
+    IMG_DFA_PATTERN_GROUP,
+    /* self prefilter, the posix one follows in the same order */
+    IMG_PF_ROOT_NEXT,
+    IMG_PF_LABEL,
+    IMG_PF_FIRST_CHILD,
+    IMG_PF_NEXT_SIBLING,
+    IMG_PF_FAIL,
+    IMG_PF_OUT_FIRST,
+    IMG_PF_OUT_LINK,
+    IMG_PF_OUT_PATTERN,
+    IMG_PF_OUT_NEXT,
+    IMG_PF_ALWAYS,
+    IMG_PF_POSIX,
+    IMG_HT_PARENT = IMG_PF_POSIX + (IMG_PF_POSIX - IMG_PF_ROOT_NEXT),
+    IMG_HT_LABEL_OFF,
+    IMG_HT_LABEL_LEN,
+    IMG_HT_RULE_FIRST,
+    IMG_HT_LABELS,
+    IMG_HT_RULE_PATTERN,
+    IMG_HT_RULE_FLAGS,
+    IMG_HT_RULE_NEXT,
+    IMG_HT_EDGE,
+    IMG_NUM_SECTIONS
+}URL_IMAGE_SECTION;
+
+/*! \struct _url_image_section_t
+ *  Place of one array in the image, off from the start of the file
+ */
+typedef struct _url_image_section_t {
+    uint64_t off;
+    uint64_t size;
+} url_image_section_t;
+
+/*! \struct _url_image_prefilter_t
+ *  Counts of one prefilter in the image
+ */
+typedef struct _url_image_prefilter_t {
+    int32_t num_nodes;
+    int32_t num_patterns;
+    int32_t num_always;
+    int32_t pad;
+} url_image_prefilter_t;
+
+/*! \struct _url_image_header_t
+ *  Start of a ruleset image written by url-engine compile. The image is
+ *  only read on the machine type it was written on (byte order and word
+ *  size are checked).
+ *  checksum - of every byte after the header
+ */
+typedef struct _url_image_header_t {
+    char magic[URL_IMAGE_MAGIC_LEN];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t word_size;
+    uint32_t num_sections;
+    uint64_t file_size;
+    uint64_t checksum;
+    uint64_t strings_size;
+    int32_t num_sets;
+    int32_t num_patterns;
+    int32_t dfa_num_states;
+    int32_t dfa_num_start;
+    int32_t dfa_num_groups;
+    int32_t pad;
+    url_image_prefilter_t prefilter[2];
+    int32_t ht_num_nodes;
+    int32_t ht_num_rules;
+    int32_t ht_labels_used;
+    int32_t ht_edge_mask;
+    int32_t num_duplicates;
+    int32_t num_subsumed;
+    url_image_section_t sections[IMG_NUM_SECTIONS];
+} url_image_header_t;
+
+bool url_image_is_image(const char * path);
+bool url_image_save(const ruleset_t * rs, const char * path);
+ruleset_t * url_image_load(const char * path);
+void url_image_unmap(ruleset_t * rs);
+
+#endif /* ifndef _URL_IMAGE_H_ */
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "url_input.h"
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to split URLs in memory in chunks. A chunk ends after
+ * the first '\n' at or past its nominal size, so no line is cut. There are
+ * URL_CHUNKS_PER_WORKER chunks per worker so that the last chunk of a slow
+ * range, which no other worker can help with, is short.
+ *
+ * @Param data - kept by the caller till url_input_unmap()
+ * @Param size
+ * @Param num_workers
+ *
+ * @Returns   input, NULL on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+url_input_t * url_input_split(const char * data, size_t size, int num_workers)
+{
+    url_input_t *input;
+    size_t chunk_size, off;
+    const char *nl;
+    long max_chunks;
+
+    input = calloc(1, sizeof(url_input_t));
+    if (NULL == input) {
+        return NULL;
+    }
+    input->data = data;
+    input->size = size;
+
+    chunk_size = input->size / ((size_t)(num_workers > 0 ? num_workers : 1) * URL_CHUNKS_PER_WORKER);
+    if (chunk_size < URL_CHUNK_MIN_BYTES) {
+        chunk_size = URL_CHUNK_MIN_BYTES;
+    } else if (chunk_size > URL_CHUNK_MAX_BYTES) {
+        chunk_size = URL_CHUNK_MAX_BYTES;
+    }
+
+    max_chunks = input->size / chunk_size + 1;
+    input->chunk_off = malloc((max_chunks + 1) * sizeof(size_t));
+    if (NULL == input->chunk_off) {
+        free(input);
+        return NULL;
+    }
+
+    off = 0;
+    input->chunk_off[0] = 0;
+    while (off < input->size) {
+        off = (input->size - off > chunk_size) ? off + chunk_size : input->size;
+        if (off < input->size) {
+            nl = memchr(input->data + off - 1, '\n', input->size - off + 1);
+            off = nl ? (size_t)(nl - input->data) + 1 : input->size;
+        }
+        input->chunk_off[++input->num_chunks] = off;
+    }
+
+    return input;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to map the URL file and split it in chunks
+ *
+ * @Param fd
+ * @Param num_workers
+ *
+ * @Returns   input, NULL when fd is not a regular file or can't be mapped
+ */
+/* ----------------------------------------------------------------------------*/
+url_input_t * url_input_map(int fd, int num_workers)
+{
+    url_input_t *input;
+    struct stat st;
+    void *data = NULL;
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+
+    if (st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == data) {
+            return NULL;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+    }
+
+    input = url_input_split(data, st.st_size, num_workers);
+    if (NULL == input) {
+        if (data) {
+            munmap(data, st.st_size);
+        }
+        return NULL;
+    }
+    input->is_mapped = true;
+
+    return input;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to unmap the URL file and free the chunks
+ *
+ * @Param input
+ */
+/* ----------------------------------------------------------------------------*/
+void url_input_unmap(url_input_t * input)
+{
+    if (!input) {
+        return;
+    }
+    if (input->is_mapped && input->data) {
+        munmap((void *)input->data, input->size);
+    }
+    free(input->chunk_off);
+    free(input);
+}
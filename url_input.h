@@ -0,0 +1,57 @@
+#ifndef _URL_INPUT_H_
+#define _URL_INPUT_H_
+
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* Bounds of the byte range handed to a worker at a time */
+#define URL_CHUNK_MIN_BYTES (16 * 1024)
+#define URL_CHUNK_MAX_BYTES (1024 * 1024)
+/* Chunks per worker, the unit a worker steals */
+#define URL_CHUNKS_PER_WORKER   32
+
+/*! \struct _url_input_t
+ *  URL file mapped read only in memory and split in chunks that start and
+ *  end on a line boundary. Chunk i is data[chunk_off[i]] .. data[chunk_off[i+1]].
+ *  is_mapped - data is the mapped file, else it belongs to the caller
+ */
+typedef struct _url_input_t {
+    const char *data;
+    size_t size;
+    bool is_mapped;
+    long num_chunks;
+    size_t *chunk_off;
+} url_input_t;
+
+url_input_t * url_input_split(const char * data, size_t size, int num_workers);
+url_input_t * url_input_map(int fd, int num_workers);
+void url_input_unmap(url_input_t * input);
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the next line of a range, the line is not
+ * NUL terminated and does not include the '\n'
+ *
+ * @Param pos - start of the line, moved past the '\n'
+ * @Param end - end of the range
+ * @Param len - length of the line
+ *
+ * @Returns   start of the line
+ */
+/* ----------------------------------------------------------------------------*/
+static inline const char * url_input_next_line(const char ** pos, const char * end, size_t * len)
+{
+    const char *line = *pos, *nl = memchr(line, '\n', end - line);
+
+    if (nl) {
+        *len = nl - line;
+        *pos = nl + 1;
+    } else {
+        *len = end - line;
+        *pos = end;
+    }
+    return line;
+}
+
+#endif /* ifndef _URL_INPUT_H_ */
@@ -0,0 +1,2840 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <libxml/xmlreader.h>
+#include <regex.h>
+#include <time.h>
+#include <dlfcn.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "url_engine.h"
+#include "url_image.h"
+#include "url_parse.h"
+#include "url_simd.h"
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to start a new set of the config
+ *
+ * @Param config
+ * @Param key
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool config_add_set(config_sets_t * config, int key)
+{
+    url_engine_set_t *sets;
+    int *set_first, max_sets;
+
+    if (config->num_sets == config->max_sets) {
+        max_sets = config->max_sets ? 2 * config->max_sets : 64;
+        sets = realloc(config->sets, max_sets * sizeof(url_engine_set_t));
+        if (sets) {
+            config->sets = sets;
+        }
+        set_first = realloc(config->set_first, max_sets * sizeof(int));
+        if (set_first) {
+            config->set_first = set_first;
+        }
+        if (!sets || !set_first) {
+            return false;
+        }
+        config->max_sets = max_sets;
+    }
+
+    config->sets[config->num_sets].key = key;
+    config->sets[config->num_sets].num_patterns = 0;
+    config->sets[config->num_sets].patterns = NULL;
+    config->set_first[config->num_sets++] = config->num_patterns;
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add a pattern to the last set of the config
+ *
+ * @Param config
+ * @Param pattern
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool config_add_pattern(config_sets_t * config, const char * pattern)
+{
+    size_t *pattern_off, off;
+    int max_patterns;
+
+    if (config->num_patterns == config->max_patterns) {
+        max_patterns = config->max_patterns ? 2 * config->max_patterns : 256;
+        pattern_off = realloc(config->pattern_off, max_patterns * sizeof(size_t));
+        if (NULL == pattern_off) {
+            return false;
+        }
+        config->pattern_off = pattern_off;
+        config->max_patterns = max_patterns;
+    }
+
+    off = url_arena_add(&config->strings, pattern, strlen(pattern));
+    if (URL_ARENA_FAIL == off) {
+        return false;
+    }
+    config->pattern_off[config->num_patterns++] = off;
+    config->sets[config->num_sets - 1].num_patterns++;
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the sets read from config.xml
+ *
+ * @Param config
+ */
+/* ----------------------------------------------------------------------------*/
+static void free_config(config_sets_t * config)
+{
+    url_arena_free(&config->strings);
+    free(config->pattern_off);
+    free(config->sets);
+    free(config->set_first);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add the text of a <pattern> to the pattern being
+ * read, the text may come in several nodes
+ *
+ * @Param text - grows as needed
+ * @Param len
+ * @Param size
+ * @Param value
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool config_text_append(char ** text, size_t * len, size_t * size, const xmlChar * value)
+{
+    size_t value_len = value ? strlen((const char *)value) : 0;
+    size_t new_size = *size ? *size : 256;
+    char *new_text;
+
+    while (*len + value_len + 1 > new_size) {
+        new_size *= 2;
+    }
+    if (new_size != *size) {
+        new_text = realloc(*text, new_size);
+        if (NULL == new_text) {
+            return false;
+        }
+        *text = new_text;
+        *size = new_size;
+    }
+    if (value_len) {
+        memcpy(*text + *len, value, value_len);
+    }
+    *len += value_len;
+    (*text)[*len] = '\0';
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the key of a <set>, the value of its first
+ * attribute, 0 when it has none
+ *
+ * @Param reader - on the <set> element, left on it
+ * @Param debug
+ *
+ * @Returns   key
+ */
+/* ----------------------------------------------------------------------------*/
+static int config_set_key(xmlTextReaderPtr reader, bool debug)
+{
+    int key = 0;
+
+    if (1 == xmlTextReaderMoveToFirstAttribute(reader)) {
+        do {
+            if (!xmlTextReaderIsNamespaceDecl(reader)) {
+                TM_PRINTF(debug, "Attribute name: %s value: %s\n",
+                        xmlTextReaderConstName(reader), xmlTextReaderConstValue(reader));
+                key = atoi((const char *)xmlTextReaderConstValue(reader));
+                break;
+            }
+        } while (1 == xmlTextReaderMoveToNextAttribute(reader));
+        xmlTextReaderMoveToElement(reader);
+    }
+    return key;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to read the pattern from config.xml and save in the
+ * config sets. The file is read as a stream, each <pattern> goes to the
+ * config sets when its end is read and no document tree is built. There is
+ * no limit on the number of sets, of patterns or on the length of a pattern.
+ *
+ * Only the <set> elements under the root and the <pattern> elements right
+ * under a <set> are read.
+ *
+ * @Param reader
+ * @Param config
+ *
+ * @Returns   false on a parse error or allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool construct_pattern_from_xml(xmlTextReaderPtr reader, config_sets_t * config)
+{
+    const xmlChar *name;
+    char *text = NULL;
+    size_t text_len = 0, text_size = 0;
+    bool in_set = false, in_pattern = false, ok = true;
+    int ret, type, depth;
+
+    while (ok && 1 == (ret = xmlTextReaderRead(reader))) {
+        type = xmlTextReaderNodeType(reader);
+        depth = xmlTextReaderDepth(reader);
+        name = xmlTextReaderConstName(reader);
+
+        if (XML_READER_TYPE_ELEMENT == type) {
+            if (1 == depth) {
+                in_set = !xmlStrcmp(name, (const xmlChar *)"set");
+                if (in_set) {
+                    TM_PRINTF(config->debug, "node type: Element, name: %s\n", name);
+                    ok = config_add_set(config, config_set_key(reader, config->debug));
+                    in_set = !xmlTextReaderIsEmptyElement(reader);
+                }
+            } else if (2 == depth && in_set && !xmlStrcmp(name, (const xmlChar *)"pattern")) {
+                text_len = 0;
+                ok = config_text_append(&text, &text_len, &text_size, NULL);
+                in_pattern = !xmlTextReaderIsEmptyElement(reader);
+                if (ok && !in_pattern) {
+                    ok = config_add_pattern(config, text);
+                }
+            }
+        } else if (in_pattern && 3 == depth &&
+                (XML_READER_TYPE_TEXT == type || XML_READER_TYPE_CDATA == type ||
+                 XML_READER_TYPE_WHITESPACE == type ||
+                 XML_READER_TYPE_SIGNIFICANT_WHITESPACE == type)) {
+            ok = config_text_append(&text, &text_len, &text_size, xmlTextReaderConstValue(reader));
+        } else if (XML_READER_TYPE_END_ELEMENT == type) {
+            if (in_pattern && 2 == depth) {
+                TM_PRINTF(config->debug, "name %s: keyword: %s\n", name, text);
+                ok = config_add_pattern(config, text);
+                in_pattern = false;
+            } else if (1 == depth) {
+                in_set = false;
+            }
+        }
+    }
+
+    free(text);
+    if (!ok) {
+        fprintf(stderr, "Config allocation failed\n");
+        return false;
+    }
+    return 0 == ret;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to print the saved xml config
+ *
+ * @Param config
+ */
+/* ----------------------------------------------------------------------------*/
+static void print_xml_pattern(const config_sets_t * config)
+{
+    int i,j;
+    
+    TM_PRINTF(config->debug, "print_xml_pattern\n");
+    for (i=0;i<config->num_sets; i++){
+        TM_PRINTF(config->debug, "set %d: ", config->sets[i].key);
+        for(j=0;j<config->sets[i].num_patterns;j++){
+            TM_PRINTF(config->debug, "%s ", url_arena_str(&config->strings, config->pattern_off[config->set_first[i] + j]));
+        }
+    }
+    TM_PRINTF(config->debug, "\n");
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to create a new pattern from the pattern read from config.xml
+ *  1. Removes consecutive wildcard characters
+ *  2. In the case of POSIX algorithm add ^ and $ to do the fullmatch with url
+ * @Param pattern
+ * @Param new_pattern
+ * @Param match_type
+ */
+/* ----------------------------------------------------------------------------*/
+static void create_new_pattern(const char * pattern, char * new_pattern, MATCH_TYPE match_type)
+{
+    int i=0, writeIndex=0, pattern_len = strlen(pattern);
+    bool isFirst = true;
+
+    if (POSIX == match_type){
+        new_pattern[writeIndex++] = '^';
+    }
+
+    for ( i = 0 ; i < pattern_len; i++) {
+        if (pattern[i] == '*') {
+            if (isFirst) {
+                new_pattern[writeIndex++] = pattern[i]; 
+                isFirst = false;
+            } 
+        } else {
+                new_pattern[writeIndex++] = pattern[i];
+                isFirst = true;
+        }
+    }
+
+    if (POSIX == match_type) {
+        new_pattern[writeIndex++] = '$';
+    }
+    new_pattern[writeIndex] = '\0';
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis Function used to check if the pattern needs to be changed for regex
+ * matching. Also the wildcard index before the /delimiter is returned.
+ * Case POSIX: return true 
+ * case SELF: return true if wildcard present else no change needed
+ * @Param pattern
+ * @Param wildcard_index
+ * @Param match_type
+ *
+ * @Returns  true or false 
+ */
+/* ----------------------------------------------------------------------------*/
+static bool match_needs_pattern_change(const char * pattern, int * wildcard_index, MATCH_TYPE match_type)
+{
+    char * wildcard_ch, *last_wildcard_ch ,* delim_ch;
+
+    delim_ch = strchr(pattern,'/');
+    wildcard_ch = strchr(pattern,'*');
+
+    if ((0 != wildcard_ch) && 
+            ((0==delim_ch) || ((wildcard_ch - delim_ch) <0))) {
+        while(wildcard_ch && (!delim_ch ||(wildcard_ch<delim_ch))) {
+            last_wildcard_ch = wildcard_ch;
+            wildcard_ch = strchr(wildcard_ch+1, '*');
+        }
+        *wildcard_index = last_wildcard_ch - pattern;
+    }
+
+    return (POSIX==match_type) ? true: (*wildcard_index != -1) ;
+}
+
+
+
+/*-----------------------------------------------------------------------------
+ |                          URL SEGMENTS                                    |
+ |                                                                          |
+ |                                                                          |
+ |--------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Greedy wildcard match of the SELF algorithm: literals are
+ * compared one by one and on a mismatch only the last wildcard seen takes
+ * one more character of the url.
+ * '|' never takes a '/'. All the '|' come before the first '/' of the pattern
+ * and the '*' after it, so when the last wildcard is a '|' no other
+ * alignment can match either and the match fails right away.
+ *
+ * @Param url - not NULL
+ * @Param url_len
+ * @Param pattern - not NULL
+ * @Param pattern_len
+ *
+ * @Returns  true or false 
+ */
+/* ----------------------------------------------------------------------------*/
+static inline bool self_glob_match(const char * url, size_t url_len, const char * pattern, size_t pattern_len)
+{
+    const char *star_pattern = NULL, *star_url = NULL, *url_end, *pattern_end;
+
+    url_end = url + url_len;
+    pattern_end = pattern + pattern_len;
+    while (url < url_end) {
+        if (pattern < pattern_end && (*pattern == '*' || *pattern == '|')) {
+            /* wildcard takes nothing to begin with */
+            star_pattern = pattern++;
+            star_url = url;
+        } else if (pattern < pattern_end && *pattern == *url) {
+            pattern++;
+            url++;
+        } else if (star_pattern && !(*star_pattern == '|' && *star_url == '/')) {
+            /* backtrack: last wildcard takes one more character */
+            url = ++star_url;
+            pattern = star_pattern + 1;
+        } else {
+            return false;
+        }
+    }
+
+    /* url is consumed, only wildcards can be left in the pattern */
+    while (pattern < pattern_end && (*pattern == '*' || *pattern == '|')) {
+        pattern++;
+    }
+
+    return pattern == pattern_end; 
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Wildcard match by literal segments, for a text no '|' of the
+ * pattern can stop at: the host of a url, or a path with a pattern part
+ * having only '*'. The segment before the first wildcard must start the
+ * text, the one after the last must end it, each one in between is found
+ * with url_find() at its first place past the previous one. Taking the first
+ * place leaves the most text to the next segments, so nothing is tried twice.
+ *
+ * @Param text - not NULL
+ * @Param text_len
+ * @Param pattern - not NULL
+ * @Param pattern_len
+ *
+ * @Returns  true or false
+ */
+/* ----------------------------------------------------------------------------*/
+static inline bool segment_glob_match(const char * text, size_t text_len, const char * pattern, size_t pattern_len)
+{
+    const char *first, *last, *next, *found, *pattern_end = pattern + pattern_len;
+    size_t head, tail, pos, end;
+
+    for (first = pattern; first < pattern_end && *first != '*' && *first != '|'; first++);
+    if (first == pattern_end) {
+        return pattern_len == text_len && !memcmp(text, pattern, text_len);
+    }
+    for (last = pattern_end - 1; *last != '*' && *last != '|'; last--);
+
+    head = first - pattern;
+    tail = pattern_end - last - 1;
+    if (head + tail > text_len || memcmp(text, pattern, head) ||
+            memcmp(text + text_len - tail, last + 1, tail)) {
+        return false;
+    }
+
+    pos = head;
+    end = text_len - tail;
+    for (pattern = first + 1; pattern < last; pattern = next + 1) {
+        for (next = pattern; *next != '*' && *next != '|'; next++);
+        if (next == pattern) {
+            continue;
+        }
+        found = url_find(text + pos, end - pos, pattern, next - pattern);
+        if (!found) {
+            return false;
+        }
+        pos = found - text + (next - pattern);
+    }
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to match the host of a url with the host part of a
+ * PATTERN_SPLIT pattern. The '|' of the pattern never take a '/', so its
+ * host part can only match the host of the url, up to the first '/', and
+ * it has a path exactly when the url has one. Most patterns fail here
+ * without their path being looked at.
+ *
+ * @Param parts
+ * @Param rs
+ * @Param id
+ *
+ * @Returns   true when the host matches
+ */
+/* ----------------------------------------------------------------------------*/
+static inline bool host_segment_match(const url_parts_t * parts, const ruleset_t * rs, int id)
+{
+    int host = rs->self_host[id];
+
+    if ((host < rs->self_len[id]) != (parts->host_len < parts->len)) {
+        return false;
+    }
+    return segment_glob_match(parts->url, parts->host_len, url_arena_str(&rs->strings, rs->self_off[id]), host);
+}
+
+/*-----------------------------------------------------------------------------
+ |                          POSIX ALGO FUNCTIONS                            |
+ |                                                                          |
+ |                                                                          |
+ |--------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to identify special characters 
+ *
+ * @Param ch
+ *
+ * @Returns   true or false
+ */
+/* ----------------------------------------------------------------------------*/
+static inline bool regex_special_characters(char ch)
+{
+    return ( ('.'==ch) || ('?'==ch) || ('\\'==ch) ||
+            ('|'==ch) || ('+'==ch) ||  ('('==ch) || (')'==ch) ); // || ('^'==ch) || ('$'==ch));
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to modify the POSIX pattern for according to regex matching
+ *
+ * @Param old_pattern
+ * @Param new_pattern
+ * @Param wildcard_index
+ */
+/* ----------------------------------------------------------------------------*/
+static void modify_posix_pattern_string(const char * old_pattern, char * new_pattern, int wildcard_index)
+{
+    int old_index=0, new_index=0, old_len = strlen(old_pattern);
+
+    while(old_index<old_len) {
+        /* if special character */
+        if (regex_special_characters(old_pattern[old_index]) ){
+            new_pattern[new_index++] = '\\';
+            new_pattern[new_index++] = old_pattern[old_index];
+        } /* wildcard after delimiter */
+        else if (old_pattern[old_index]=='*' && old_index > wildcard_index){
+            new_pattern[new_index++] = '.';
+            new_pattern[new_index++] = '*';
+        } /* wildcard before delimiter */ 
+        else if (old_pattern[old_index]=='*' && old_index <= wildcard_index) {
+            memcpy(&new_pattern[new_index], "[^\\/]*", 6);
+            new_index += 6;
+        } else {
+            new_pattern[new_index++] = old_pattern[old_index];
+        }
+        old_index++;
+    }
+    new_pattern[new_index] = '\0';
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to do the regex match given the url and the regex
+ * compiled at load time. The url is not NUL terminated, REG_STARTEND gives
+ * its bounds to regexec.
+ *
+ * @Param url
+ * @Param url_len
+ * @Param regex
+ *
+ * @Returns  1 on a match, 0 on no match, -1 when regexec fails
+ */
+/* ----------------------------------------------------------------------------*/
+static int regex_match(const char * url, size_t url_len, const regex_t * regex)
+{
+    int reti;
+    char msgbuf[100];
+    regmatch_t bounds = { .rm_so = 0, .rm_eo = url_len };
+
+    /* Execute regular expression */
+    reti = regexec(regex, url, 1, &bounds, REG_STARTEND);
+    if (reti && reti != REG_NOMATCH) {
+        regerror(reti, regex, msgbuf, sizeof(msgbuf));
+        fprintf(stderr, "Regex match failed: %s\n", msgbuf);
+        return -1;
+    }
+
+    return (!reti)? 1: 0;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write the regex of a pattern for the POSIX algorithm
+ *
+ * @Param pattern
+ * @Param temp_pattern - strlen(pattern) + 3 bytes
+ * @Param posix_pattern - 6 * (strlen(pattern) + 2) + 1 bytes, every
+ * character escapes to at most 6
+ */
+/* ----------------------------------------------------------------------------*/
+static void create_posix_pattern(const char * pattern, char * temp_pattern, char * posix_pattern)
+{
+    int wildcard_index = -1;
+
+    create_new_pattern(pattern, temp_pattern, POSIX);
+    if (true == match_needs_pattern_change(temp_pattern, &wildcard_index, POSIX)) {
+        modify_posix_pattern_string(temp_pattern, posix_pattern, wildcard_index);
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to compile the regex of a pattern. Most patterns of a
+ * large config never get past the prefilter, so their regex is only
+ * compiled the first time it is needed. Threads verifying the same pattern
+ * wait on the lock of the ruleset, one of them compiles it.
+ *
+ * @Param rs
+ * @Param id
+ *
+ * @Returns  false when the regex can't be compiled 
+ */
+/* ----------------------------------------------------------------------------*/
+static bool regex_prepare(const ruleset_t * rs, int id)
+{
+    /* the ruleset stays read only for the match, only the lazy regex changes */
+    pthread_mutex_t *lock = (pthread_mutex_t *)&rs->regex_lock;
+    char *temp_pattern, *posix_pattern;
+    shared_regex_t *shared;
+    bool ok = true;
+
+    if (atomic_load_explicit(&rs->regex_ready[id], memory_order_acquire)) {
+        return true;
+    }
+
+    pthread_mutex_lock(lock);
+    if (!atomic_load_explicit(&rs->regex_ready[id], memory_order_relaxed)) {
+        temp_pattern = malloc(rs->pattern_len[id] + 3);
+        posix_pattern = malloc(6 * (rs->pattern_len[id] + 2) + 1);
+        shared = malloc(sizeof(shared_regex_t));
+        ok = temp_pattern && posix_pattern && shared;
+        if (ok) {
+            create_posix_pattern(url_arena_str(&rs->strings, rs->pattern_off[id]), temp_pattern, posix_pattern);
+            ok = !regcomp(&shared->regex, posix_pattern, 0);
+            if (!ok) {
+                fprintf(stderr, "Could not compile regex %s\n", posix_pattern);
+            }
+        }
+        if (ok) {
+            TM_PRINTF(rs->debug, "compiled regex %s\n", posix_pattern);
+            shared->refs = 1;
+            rs->regex[id] = shared;
+            atomic_store_explicit(&rs->regex_ready[id], 1, memory_order_release);
+        } else {
+            free(shared);
+        }
+        free(temp_pattern);
+        free(posix_pattern);
+    }
+    pthread_mutex_unlock(lock);
+
+    return ok;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to drop one ruleset of a compiled regex, freed with
+ * the last one
+ *
+ * @Param shared
+ */
+/* ----------------------------------------------------------------------------*/
+static void regex_release(shared_regex_t * shared)
+{
+    if (0 == __sync_sub_and_fetch(&shared->refs, 1)) {
+        regfree(&shared->regex);
+        free(shared);
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Verifier of the POSIX algorithm. A plain pattern whose host
+ * part doesn't match is rejected before the regex.
+ *
+ * @Param parts
+ * @Param rs
+ * @Param id - pattern
+ *
+ * @Returns  1 on a match, 0 on no match, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static int posix_verify(const url_parts_t * parts, const ruleset_t * rs, int id)
+{
+    if ((rs->pattern_flags[id] & PATTERN_PLAIN) && !host_segment_match(parts, rs, id)) {
+        return 0;
+    }
+    if (!regex_prepare(rs, id)) {
+        return -1;
+    }
+    return regex_match(parts->url, parts->len, &rs->regex[id]->regex);
+}
+
+/*
+ ----------------------------------------------------------------------------
+|                                                                           |
+|                               SELF ALGORITHM FUNCTIONS                    |
+|                                                                           |
+|---------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to modify the SELF pattern string
+ * if wildcard comes before delimiter replacing it with '|' character to
+ * differentiate in the SELF algorithm
+ *
+ * @Param old_pattern
+ * @Param new_pattern
+ * @Param wildcard_index
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void modify_self_pattern_string(const char * old_pattern, char * new_pattern, int wildcard_index)
+{
+    int old_index=0, old_len = strlen(old_pattern);
+
+    while(old_index<old_len) {
+        if (old_pattern[old_index]=='*' && old_index <= wildcard_index) {
+            new_pattern[old_index] = '|';
+        } else {
+            new_pattern[old_index] = old_pattern[old_index];
+        }
+        old_index++;
+    }
+}
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function that implementes the SELF algorithm
+ *
+ * @Param url
+ * @Param url_len
+ * @Param pattern
+ *
+ * @Returns  true or false 
+ */
+/* ----------------------------------------------------------------------------*/
+static bool self_match(const char * url, size_t url_len, const char * pattern)
+{
+    if (!url && !pattern){
+        return true;
+    } 
+
+    if (!url || !pattern) {
+         return false;
+    }
+
+    return self_glob_match(url, url_len, pattern, strlen(pattern));
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Verifier of the SELF algorithm. A PATTERN_SPLIT pattern is
+ * matched host part first, its path part only against the path of the url.
+ *
+ * @Param parts
+ * @Param rs
+ * @Param id - pattern
+ *
+ * @Returns  1 on a match, 0 on no match
+ */
+/* ----------------------------------------------------------------------------*/
+static int self_verify(const url_parts_t * parts, const ruleset_t * rs, int id)
+{
+    const char *pattern = url_arena_str(&rs->strings, rs->self_off[id]);
+    int host = rs->self_host[id];
+
+    if (!(rs->pattern_flags[id] & PATTERN_SPLIT)) {
+        return self_match(parts->url, parts->len, pattern);
+    }
+
+    return host_segment_match(parts, rs, id) &&
+        segment_glob_match(parts->url + parts->host_len, parts->len - parts->host_len,
+                pattern + host, rs->self_len[id] - host);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Verifier of the NATIVE algorithm, the generated matcher of the
+ * pattern. It gives what self_verify() gives.
+ *
+ * @Param parts
+ * @Param rs - with a matcher loaded
+ * @Param id - pattern
+ *
+ * @Returns  1 on a match, 0 on no match
+ */
+/* ----------------------------------------------------------------------------*/
+static int native_verify(const url_parts_t * parts, const ruleset_t * rs, int id)
+{
+    return rs->matcher_verify(parts->url, parts->len, parts->host_len, id);
+}
+
+/*
+ ----------------------------------------------------------------------------
+|                                                                           |
+|                               INDEXED MATCH                               |
+|                                                                           |
+|---------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to start the memo of the shared patterns for a new url
+ *
+ * @Param rs
+ * @Param scratch
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void memo_next_url(const ruleset_t * rs, url_engine_scratch_t * scratch)
+{
+    if (!rs->num_duplicates) {
+        return;
+    }
+    if (++scratch->memo_stamp > (UINT_MAX >> 1)) {
+        memset(scratch->memo, 0, scratch->ids_size * sizeof(unsigned int));
+        scratch->memo_stamp = 1;
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to read the clock of the profile
+ *
+ * @Returns   cpu cycles, ns where the cpu has no cycle counter
+ */
+/* ----------------------------------------------------------------------------*/
+static inline unsigned long long profile_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to run the verifier of a pattern, counted in the
+ * profile of the scratch when it has one and printed when its debug is on
+ *
+ * @Param rs
+ * @Param scratch
+ * @Param verify
+ * @Param parts
+ * @Param id
+ *
+ * @Returns  1 on a match, 0 on no match, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static inline int profiled_verify(const ruleset_t * rs, url_engine_scratch_t * scratch,
+        int (*verify)(const url_parts_t *, const ruleset_t *, int),
+        const url_parts_t * parts, int id)
+{
+    url_engine_pattern_stats_t *stats;
+    unsigned long long start;
+    int ret;
+
+    if (!scratch->profile) {
+        ret = verify(parts, rs, id);
+    } else {
+        start = profile_clock();
+        ret = verify(parts, rs, id);
+        stats = &scratch->profile[id];
+        stats->cycles += profile_clock() - start;
+        stats->evaluations++;
+        stats->hits += (1 == ret);
+    }
+    TM_PRINTF(scratch->debug, "%s: %s\n", url_arena_str(&rs->strings, rs->pattern_off[id]),
+            (1 == ret) ? "Match" : "No match");
+    return ret;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to verify a candidate pattern. The duplicates of a
+ * pattern are verified through the first one, whose result is kept for the
+ * url. '*' alone is told by the url having no '/'.
+ *
+ * @Param rs
+ * @Param scratch - memo_next_url() done for the url
+ * @Param verify
+ * @Param parts - url split by url_parse()
+ * @Param id
+ *
+ * @Returns  1 on a match, 0 on no match, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static inline int pattern_verify(const ruleset_t * rs, url_engine_scratch_t * scratch,
+        int (*verify)(const url_parts_t *, const ruleset_t *, int),
+        const url_parts_t * parts, int id)
+{
+    int canon = rs->pattern_canon[id], ret;
+    unsigned char flags = rs->pattern_flags[canon];
+
+    if (flags & PATTERN_ANY_HOST) {
+        return parts->host_len == parts->len;
+    }
+    if (!(flags & PATTERN_SHARED)) {
+        return profiled_verify(rs, scratch, verify, parts, canon);
+    }
+    if ((scratch->memo[canon] >> 1) == scratch->memo_stamp) {
+        return scratch->memo[canon] & 1;
+    }
+    ret = profiled_verify(rs, scratch, verify, parts, canon);
+    if (ret >= 0) {
+        scratch->memo[canon] = (scratch->memo_stamp << 1) | ret;
+    }
+    return ret;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function that does the URL pattern match for the POSIX and SELF
+ * algorithms using the indexes of the ruleset
+ *  1. Domain rules matching the host come from the host trie
+ *  2. Candidates from the prefilter are checked by the verifier
+ * Both lists are in config order and are merged.
+ *
+ * @Param rs
+ * @Param scratch - hits and ids hold rs->num_patterns
+ * @Param prefilter
+ * @Param verify - posix_verify() or self_verify() of the pattern
+ * @Param url - not NUL terminated
+ * @Param url_len
+ * @Param matches - matching pattern ids in config order
+ *
+ * @Returns   number of matching patterns, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static int indexed_pattern_match(const ruleset_t * rs, url_engine_scratch_t * scratch,
+        const prefilter_t * prefilter, int (*verify)(const url_parts_t *, const ruleset_t *, int),
+        const char * url, size_t url_len, const int ** matches)
+{
+    int i, h, id, num_candidates, num_hits, num_matches = 0, ret;
+    const int *candidates;
+    url_parts_t parts;
+
+    url_parse(&parts, url, url_len);
+    memo_next_url(rs, scratch);
+    num_hits = hosttrie_match(rs->hosttrie, url, url_len, scratch->hits);
+
+    num_candidates = prefilter_scan(prefilter, scratch->pf_scratch, url, url_len, &candidates);
+    if (num_candidates < 0) {
+        fprintf(stderr, "Prefilter allocation failed\n");
+        return -1;
+    }
+
+    for (i=0, h=0; i<num_candidates || h<num_hits;){
+        if (h<num_hits && (i==num_candidates || scratch->hits[h]<candidates[i])) {
+            id = scratch->hits[h++];
+        } else {
+            id = candidates[i++];
+            ret = pattern_verify(rs, scratch, verify, &parts, id);
+            if (ret < 0) {
+                return -1;
+            }
+            if (0 == ret) {
+                continue;
+            }
+        }
+        scratch->ids[num_matches++] = id;
+    }
+
+    *matches = scratch->ids;
+    return num_matches;
+}
+
+/* Patterns longer than this rank the same, cheapest first is by bucket */
+#define RANK_MAX_LEN    63
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to give the length bucket of a pattern in the cheapest
+ * first order
+ *
+ * @Param rs
+ * @Param id
+ *
+ * @Returns   0 to RANK_MAX_LEN
+ */
+/* ----------------------------------------------------------------------------*/
+static inline int rank_len(const ruleset_t * rs, int id)
+{
+    return (rs->pattern_len[id] < RANK_MAX_LEN) ? rs->pattern_len[id] : RANK_MAX_LEN;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to give the order in which the patterns of a set are
+ * checked past MATCH_ALL, cheapest first: domain rules (a host trie walk),
+ * then the patterns by length bucket, then by config order
+ *
+ * @Param rs
+ * @Param id
+ *
+ * @Returns   rank, the lower the earlier
+ */
+/* ----------------------------------------------------------------------------*/
+static inline unsigned long long pattern_rank(const ruleset_t * rs, int id)
+{
+    return ((unsigned long long)!rs->is_domain[id] << 63) |
+        ((unsigned long long)rank_len(rs, id) << 32) | (unsigned int)id;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to verify candidates cheapest first till one matches.
+ * The candidates are put in pattern_rank() order with a counting sort on
+ * the length bucket, which keeps the config order inside a bucket. A
+ * subsumed candidate is left out, the pattern of its set ranked before it
+ * matches whenever it does.
+ *
+ * @Param rs
+ * @Param scratch
+ * @Param verify
+ * @Param parts
+ * @Param candidates - in config order, no domain rule
+ * @Param num_candidates
+ * @Param id - first matching candidate by pattern_rank()
+ *
+ * @Returns   1 on a match, 0 on no match, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static int verify_cheapest(const ruleset_t * rs, url_engine_scratch_t * scratch,
+        int (*verify)(const url_parts_t *, const ruleset_t *, int),
+        const url_parts_t * parts, const int * candidates, int num_candidates, int * id)
+{
+    int bucket[RANK_MAX_LEN + 2] = { 0 };
+    int i, num_ordered = 0, ret;
+
+    if (1 == num_candidates) {
+        *id = candidates[0];
+        if (rs->pattern_flags[*id] & PATTERN_SUBSUMED) {
+            return 0;
+        }
+        return pattern_verify(rs, scratch, verify, parts, *id);
+    }
+
+    for (i=0;i<num_candidates;i++) {
+        if (!(rs->pattern_flags[candidates[i]] & PATTERN_SUBSUMED)) {
+            bucket[rank_len(rs, candidates[i]) + 1]++;
+            num_ordered++;
+        }
+    }
+    for (i=1;i<=RANK_MAX_LEN;i++) {
+        bucket[i] += bucket[i-1];
+    }
+    for (i=0;i<num_candidates;i++) {
+        if (!(rs->pattern_flags[candidates[i]] & PATTERN_SUBSUMED)) {
+            scratch->order[bucket[rank_len(rs, candidates[i])]++] = candidates[i];
+        }
+    }
+
+    for (i=0;i<num_ordered;i++) {
+        *id = scratch->order[i];
+        ret = pattern_verify(rs, scratch, verify, parts, *id);
+        if (ret) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function that does the URL pattern match for the POSIX and SELF
+ * algorithms when not every matching pattern is wanted. The sets are taken
+ * in config order:
+ *  1. A set with a host trie hit is matched, none of its candidates is
+ *     verified
+ *  2. Otherwise its candidates are verified cheapest first, the set stops at
+ *     the first match
+ * MATCH_FIRST_SET stops at the first matched set. MATCH_BOOLEAN takes any
+ * host trie hit, or verifies the candidates of all the sets cheapest first.
+ *
+ * @Param rs
+ * @Param scratch - hits, ids and order hold rs->num_patterns
+ * @Param prefilter
+ * @Param verify
+ * @Param mode - not MATCH_ALL
+ * @Param url - not NUL terminated
+ * @Param url_len
+ * @Param matches - one pattern per matching set, in config order
+ *
+ * @Returns   number of matching patterns, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static int indexed_set_match(const ruleset_t * rs, url_engine_scratch_t * scratch,
+        const prefilter_t * prefilter, int (*verify)(const url_parts_t *, const ruleset_t *, int),
+        MATCH_MODE mode, const char * url, size_t url_len, const int ** matches)
+{
+    int i, h, start, set, id, best, num_candidates, num_hits, num_matches = 0, ret;
+    const int *candidates;
+    url_parts_t parts;
+
+    *matches = scratch->ids;
+    url_parse(&parts, url, url_len);
+    memo_next_url(rs, scratch);
+    num_hits = hosttrie_match(rs->hosttrie, url, url_len, scratch->hits);
+    if (MATCH_BOOLEAN == mode && num_hits) {
+        for (h=1, best=scratch->hits[0]; h<num_hits; h++) {
+            if (pattern_rank(rs, scratch->hits[h]) < pattern_rank(rs, best)) {
+                best = scratch->hits[h];
+            }
+        }
+        scratch->ids[0] = best;
+        return 1;
+    }
+
+    num_candidates = prefilter_scan(prefilter, scratch->pf_scratch, url, url_len, &candidates);
+    if (num_candidates < 0) {
+        fprintf(stderr, "Prefilter allocation failed\n");
+        return -1;
+    }
+
+    if (MATCH_BOOLEAN == mode) {
+        ret = num_candidates ? verify_cheapest(rs, scratch, verify, &parts,
+                candidates, num_candidates, &scratch->ids[0]) : 0;
+        return ret;
+    }
+
+    for (i=0, h=0; i<num_candidates || h<num_hits;){
+        if (h<num_hits && (i==num_candidates ||
+                    rs->pattern_set[scratch->hits[h]] <= rs->pattern_set[candidates[i]])) {
+            set = rs->pattern_set[scratch->hits[h]];
+        } else {
+            set = rs->pattern_set[candidates[i]];
+        }
+
+        /* the ids of a set follow each other, so do its hits and candidates */
+        for (best=-1; h<num_hits && rs->pattern_set[scratch->hits[h]] == set; h++) {
+            if (best < 0 || pattern_rank(rs, scratch->hits[h]) < pattern_rank(rs, best)) {
+                best = scratch->hits[h];
+            }
+        }
+        for (start=i; i<num_candidates && rs->pattern_set[candidates[i]] == set; i++);
+        if (best < 0 && i > start) {
+            ret = verify_cheapest(rs, scratch, verify, &parts, candidates + start, i - start, &id);
+            if (ret < 0) {
+                return -1;
+            }
+            best = ret ? id : -1;
+        }
+
+        if (best >= 0) {
+            scratch->ids[num_matches++] = best;
+            if (MATCH_FIRST_SET == mode) {
+                break;
+            }
+        }
+    }
+
+    return num_matches;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to keep the patterns a match mode reports out of every
+ * matching pattern, used when the algorithm can't stop early
+ *
+ * @Param rs
+ * @Param scratch
+ * @Param mode - not MATCH_ALL
+ * @Param ids - every matching pattern in config order, can be scratch->ids
+ * @Param num_ids
+ * @Param matches - the patterns indexed_set_match() gives for the url
+ *
+ * @Returns   number of matching patterns
+ */
+/* ----------------------------------------------------------------------------*/
+static int select_set_matches(const ruleset_t * rs, url_engine_scratch_t * scratch,
+        MATCH_MODE mode, const int * ids, int num_ids, const int ** matches)
+{
+    int i, id, best = -1, num_matches = 0;
+
+    /* ids may be scratch->ids, each id is read before its slot is written */
+    *matches = scratch->ids;
+    for (i=0;i<num_ids;i++) {
+        id = ids[i];
+        if (MATCH_BOOLEAN != mode && best >= 0 && rs->pattern_set[id] != rs->pattern_set[best]) {
+            scratch->ids[num_matches++] = best;
+            if (MATCH_FIRST_SET == mode) {
+                return num_matches;
+            }
+            best = -1;
+        }
+        if (best < 0 || pattern_rank(rs, id) < pattern_rank(rs, best)) {
+            best = id;
+        }
+    }
+    if (best >= 0) {
+        scratch->ids[num_matches++] = best;
+    }
+    return num_matches;
+}
+
+/*
+ ----------------------------------------------------------------------------
+|                                                                           |
+|                               DFA ALGORITHM FUNCTIONS                     |
+|                                                                           |
+|---------------------------------------------------------------------------|
+*/
+
+static int compare_ids(const void * a, const void * b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function that does the URL pattern match based on DFA algorithm.
+ * The patterns are compiled into groups of automata, a url only runs the
+ * groups holding one of its prefilter candidates (all of them when there are
+ * few), a single scan of the URL per group reports every matching pattern of
+ * the group. Domain rules come from the host trie. The scan can't stop early,
+ * the other modes keep their patterns out of the result.
+ *
+ * @Param rs
+ * @Param scratch
+ * @Param mode
+ * @Param url - not NUL terminated
+ * @Param url_len
+ * @Param matches - matching pattern ids in config order
+ *
+ * @Returns   number of matching patterns, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static int dfa_pattern_match(const ruleset_t * rs, url_engine_scratch_t * scratch,
+        MATCH_MODE mode, const char * url, size_t url_len, const int ** matches)
+{
+    int i, id, num_candidates = 0, num_accepted, num_hits, num_matches = 0;
+    const int *candidates = NULL, *accepted;
+
+    /* the automata only look the candidates up, they are left in no order */
+    if (rs->dfa->num_groups > DFA_UNGATED_GROUPS) {
+        num_candidates = prefilter_scan_unordered(rs->self_prefilter, scratch->pf_scratch, url, url_len, &candidates);
+    }
+    if (num_candidates < 0) {
+        fprintf(stderr, "Prefilter allocation failed\n");
+        return -1;
+    }
+    num_accepted = dfa_match(scratch->dfa_cache, rs->dfa, url, url_len, candidates, num_candidates, &accepted);
+    if (num_accepted < 0) {
+        fprintf(stderr, "DFA cache allocation failed\n");
+        return -1;
+    }
+
+    /* the automata hold the first pattern written a given way, the host
+     * trie the domain rules */
+    for (i=0;i<num_accepted;i++) {
+        for (id=accepted[i]; id>=0; id=rs->dup_next[id]) {
+            scratch->ids[num_matches++] = id;
+        }
+    }
+    num_hits = hosttrie_match(rs->hosttrie, url, url_len, scratch->ids + num_matches);
+    num_matches += num_hits;
+    if (num_matches > 1) {
+        qsort(scratch->ids, num_matches, sizeof(int), compare_ids);
+    }
+
+    *matches = scratch->ids;
+    if (MATCH_ALL != mode) {
+        num_matches = select_set_matches(rs, scratch, mode, scratch->ids, num_matches, matches);
+    }
+    return num_matches;
+}
+
+/*
+ ----------------------------------------------------------------------------
+|                                                                           |
+|                               COMPILED RULESET                            |
+|                                                                           |
+|---------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the compiled ruleset. No thread may be
+ * matching with it.
+ *
+ * @Param rs
+ */
+/* ----------------------------------------------------------------------------*/
+void url_engine_free(ruleset_t * rs)
+{
+    int i;
+
+    if (!rs) {
+        return;
+    }
+
+    for (i=0;rs->regex_ready && i<rs->num_patterns;i++) {
+        if (rs->regex_ready[i]) {
+            regex_release(rs->regex[i]);
+        }
+    }
+    free(rs->regex);
+    free((void *)rs->regex_ready);
+    pthread_mutex_destroy(&rs->regex_lock);
+    if (rs->matcher_handle) {
+        dlclose(rs->matcher_handle);
+    }
+
+    if (rs->image) {
+        url_image_unmap(rs);
+        free(rs);
+        return;
+    }
+
+    dfa_free(rs->dfa);
+    prefilter_free(rs->self_prefilter);
+    prefilter_free(rs->posix_prefilter);
+    hosttrie_free(rs->hosttrie);
+    url_arena_free(&rs->strings);
+    free(rs->set_keys);
+    free(rs->set_hash);
+    free(rs->pattern_set);
+    free(rs->pattern_off);
+    free(rs->pattern_len);
+    free(rs->pattern_hash);
+    free(rs->self_off);
+    free(rs->self_len);
+    free(rs->self_host);
+    free(rs->is_domain);
+    free(rs->pattern_canon);
+    free(rs->dup_next);
+    free(rs->pattern_flags);
+    free(rs);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to find the longest literal of the SELF pattern. Every
+ * run of characters between the wildcards has to be present in a matching url.
+ * For POSIX '?', '+', '|', '(' and ')' are escaped into regex operators and
+ * '[' or '\\' change the meaning of what follows, such patterns have no
+ * mandatory literal.
+ *
+ * @Param rs
+ * @Param id
+ * @Param match_type
+ * @Param literal_len
+ *
+ * @Returns  start of the literal in the SELF pattern, NULL when there is none 
+ */
+/* ----------------------------------------------------------------------------*/
+static const char * longest_literal(const ruleset_t * rs, int id, MATCH_TYPE match_type, int * literal_len)
+{
+    const char *p = url_arena_str(&rs->strings, rs->self_off[id]), *start = NULL, *literal = NULL;
+
+    *literal_len = 0;
+    if (POSIX == match_type && strpbrk(url_arena_str(&rs->strings, rs->pattern_off[id]), REGEX_OPERATORS)) {
+        return NULL;
+    }
+
+    for (;; p++) {
+        if (*p == '*' || *p == '|' || *p == '\0') {
+            if (start && p - start > *literal_len) {
+                literal = start;
+                *literal_len = p - start;
+            }
+            start = NULL;
+            if (*p == '\0') {
+                break;
+            }
+        } else if (!start) {
+            start = p;
+        }
+    }
+
+    return literal;
+}
+
+/* A reload scans the prefilter of the live ruleset as the base of a smaller
+ * one holding the literals of the new patterns, till these are over one in
+ * PREFILTER_DELTA_SHARE of the patterns or the patterns gone over one in
+ * PREFILTER_DELTA_SHARE of the base. Past that it is built whole again. */
+#define PREFILTER_DELTA_SHARE   8
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to build the literal prefilter of the ruleset. Domain
+ * rules are left out, the host trie matches them. Over a live prefilter,
+ * the patterns found the same in the live ruleset are left to its base
+ * automaton and only the others are added.
+ *
+ * @Param rs
+ * @Param match_type
+ * @Param live - prefilter of the ruleset reloaded, NULL to build it whole
+ * @Param live_map - id in rs of each pattern of the ruleset reloaded, -1
+ * when gone or changed
+ *
+ * @Returns  prefilter, NULL on allocation failure 
+ */
+/* ----------------------------------------------------------------------------*/
+static prefilter_t * build_prefilter(const ruleset_t * rs, MATCH_TYPE match_type,
+        prefilter_t * live, const int * live_map)
+{
+    prefilter_t *pf, *base = NULL;
+    const char **literals;
+    int i, *lens, *base_map = NULL, num_base = 0, num_new = 0;
+
+    literals = calloc(rs->num_patterns ? rs->num_patterns : 1, sizeof(char *));
+    lens = calloc(rs->num_patterns ? rs->num_patterns : 1, sizeof(int));
+    if (!literals || !lens) {
+        free(literals);
+        free(lens);
+        return NULL;
+    }
+
+    if (live) {
+        base = live->base ? live->base : live;
+        base_map = malloc((base->num_patterns ? base->num_patterns : 1) * sizeof(int));
+        if (!base_map) {
+            free(literals);
+            free(lens);
+            return NULL;
+        }
+        for (i=0;i<base->num_patterns;i++) {
+            base_map[i] = live->base ? live->base_map[i] : i;
+            base_map[i] = (base_map[i] >= 0) ? live_map[base_map[i]] : -1;
+            if (base_map[i] >= 0) {
+                lens[base_map[i]] = -1;
+                num_base++;
+            }
+        }
+        num_new = rs->num_patterns - num_base;
+        if (num_new > rs->num_patterns / PREFILTER_DELTA_SHARE ||
+                base->num_patterns - num_base > base->num_patterns / PREFILTER_DELTA_SHARE) {
+            TM_PRINTF(rs->debug, "prefilter built whole, %d new patterns\n", num_new);
+            memset(lens, 0, rs->num_patterns * sizeof(int));
+            free(base_map);
+            base_map = NULL;
+            base = NULL;
+        }
+    }
+
+    for (i=0;i<rs->num_patterns;i++) {
+        if (rs->is_domain[i] || lens[i] < 0) {
+            lens[i] = -1;
+            continue;
+        }
+        literals[i] = longest_literal(rs, i, match_type, &lens[i]);
+        TM_PRINTF(rs->debug, "prefilter literal of %s: %.*s\n", url_arena_str(&rs->strings, rs->pattern_off[i]),
+                lens[i], literals[i] ? literals[i] : "");
+    }
+    pf = prefilter_build(literals, lens, rs->num_patterns);
+    if (pf && base) {
+        TM_PRINTF(rs->debug, "prefilter over its base, %d new patterns\n", num_new);
+        prefilter_set_base(pf, base, base_map);
+    } else {
+        free(base_map);
+    }
+
+    free(literals);
+    free(lens);
+    return pf;
+}
+
+/*! \struct _dfa_group_key_t
+ *  Sort key putting the patterns in DFA groups
+ */
+typedef struct _dfa_group_key_t {
+    const char *literal;
+    int len;
+    int id;
+} dfa_group_key_t;
+
+static int compare_group_keys(const void * a, const void * b)
+{
+    const dfa_group_key_t *x = a, *y = b;
+    int n = (x->len < y->len) ? x->len : y->len, ret;
+
+    /* patterns without a literal come first */
+    if (!x->literal || !y->literal) {
+        ret = (x->literal != NULL) - (y->literal != NULL);
+    } else if (!(ret = memcmp(x->literal, y->literal, n))) {
+        ret = x->len - y->len;
+    }
+    return ret ? ret : x->id - y->id;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to put the patterns in the groups of the DFA, by
+ * DFA_GROUP_PATTERNS in the order of their prefilter literal. A url runs
+ * the groups of its prefilter candidates, patterns sharing a literal are
+ * candidates together and sit in the same group. The patterns without a
+ * literal are candidates for every url and get groups of their own. A small
+ * ruleset is one group, run on every url without the prefilter.
+ * Domain rules are left out, the host trie matches them, a duplicate goes
+ * in the group of its first pattern.
+ *
+ * @Param rs
+ * @Param group_of - group of each pattern, -1 when in none
+ *
+ * @Returns  number of groups, -1 on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static int dfa_groups(const ruleset_t * rs, int * group_of)
+{
+    dfa_group_key_t *keys;
+    int i, n = 0, num_groups = 0, size = 0;
+    bool single;
+
+    keys = malloc((rs->num_patterns ? rs->num_patterns : 1) * sizeof(dfa_group_key_t));
+    if (NULL == keys) {
+        return -1;
+    }
+    for (i=0;i<rs->num_patterns;i++) {
+        group_of[i] = -1;
+        if (rs->pattern_canon[i] == i && !rs->is_domain[i]) {
+            keys[n].id = i;
+            keys[n].literal = longest_literal(rs, i, SELF, &keys[n].len);
+            n++;
+        }
+    }
+    qsort(keys, n, sizeof(dfa_group_key_t), compare_group_keys);
+
+    /* groups few enough to be run on every url scan it once as one */
+    single = (n <= DFA_GROUP_PATTERNS * DFA_UNGATED_GROUPS);
+    for (i=0;i<n;i++) {
+        if (!single && (size == DFA_GROUP_PATTERNS || (i && !keys[i-1].literal && keys[i].literal))) {
+            num_groups++;
+            size = 0;
+        }
+        group_of[keys[i].id] = num_groups;
+        size++;
+    }
+    for (i=0;i<rs->num_patterns;i++) {
+        if (rs->pattern_canon[i] != i && !rs->is_domain[i]) {
+            group_of[i] = group_of[rs->pattern_canon[i]];
+        }
+    }
+
+    free(keys);
+    return n ? num_groups + 1 : 0;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to hash a pattern as if its consecutive wildcards were
+ * removed
+ *
+ * @Param pattern
+ *
+ * @Returns   hash
+ */
+/* ----------------------------------------------------------------------------*/
+static unsigned int canonical_hash(const char * pattern)
+{
+    unsigned int h = 2166136261u;
+    const char *p;
+
+    for (p=pattern; *p; p++) {
+        if (*p == '*' && p > pattern && p[-1] == '*') {
+            continue;
+        }
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    }
+    return h;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to check if two patterns are the same once their
+ * consecutive wildcards are removed. Both algorithms only see that form, so
+ * such patterns match the same urls.
+ *
+ * @Param a
+ * @Param b
+ *
+ * @Returns   true or false
+ */
+/* ----------------------------------------------------------------------------*/
+static bool canonical_equal(const char * a, const char * b)
+{
+    while (*a && *a == *b) {
+        if (*a == '*') {
+            while (a[1] == '*') a++;
+            while (b[1] == '*') b++;
+        }
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to find the first pattern written the same way as a
+ * new one, in an open addressing table of the patterns compiled so far
+ *
+ * @Param rs
+ * @Param slots - pattern id, -1 when free
+ * @Param hashes - canonical_hash() of the pattern of the slot
+ * @Param mask - number of slots - 1, more slots than patterns
+ * @Param id - new pattern, added when there is none
+ *
+ * @Returns   first pattern, id when there is none
+ */
+/* ----------------------------------------------------------------------------*/
+static int canonical_add(const ruleset_t * rs, int * slots, unsigned int * hashes, unsigned int mask, int id)
+{
+    const char *pattern = url_arena_str(&rs->strings, rs->pattern_off[id]);
+    unsigned int h = canonical_hash(pattern), i;
+
+    for (i=h & mask; slots[i] >= 0; i=(i+1) & mask) {
+        if (hashes[i] == h && canonical_equal(pattern, url_arena_str(&rs->strings, rs->pattern_off[slots[i]]))) {
+            return slots[i];
+        }
+    }
+    slots[i] = id;
+    hashes[i] = h;
+    return id;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add bytes to a content hash, FNV-1a 64
+ *
+ * @Param data
+ * @Param len
+ * @Param h - CONTENT_HASH_INIT to start
+ *
+ * @Returns   hash
+ */
+/* ----------------------------------------------------------------------------*/
+static unsigned long long content_hash(const void * data, size_t len, unsigned long long h)
+{
+    const unsigned char *p = data;
+    size_t i;
+
+    for (i=0;i<len;i++) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+#define CONTENT_HASH_INIT   14695981039346656037ULL
+
+/*! \struct _reload_map_t
+ *  What a ruleset compiled over a live one takes from it
+ *  slots - live patterns by pattern_hash, open addressing, -1 when free
+ *  set_slots - live sets by set_hash, the same way
+ *  live_map - id in the new ruleset of each live pattern, -1 when none
+ *  live_first - first pattern of each live set, num_sets + 1 entries
+ *  set_twin - live set with the same patterns as each new set, -1 when none
+ */
+typedef struct _reload_map_t {
+    int *slots;
+    unsigned int mask;
+    int *set_slots;
+    unsigned int set_mask;
+    int *live_map;
+    int *live_first;
+    int *set_twin;
+} reload_map_t;
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the map
+ *
+ * @Param map
+ */
+/* ----------------------------------------------------------------------------*/
+static void reload_map_free(reload_map_t * map)
+{
+    free(map->slots);
+    free(map->set_slots);
+    free(map->live_map);
+    free(map->live_first);
+    free(map->set_twin);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to index the patterns and sets of the live ruleset
+ *
+ * @Param map
+ * @Param live
+ * @Param num_sets - sets of the new ruleset
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool reload_map_init(reload_map_t * map, const ruleset_t * live, int num_sets)
+{
+    unsigned int i;
+    int id, set;
+
+    memset(map, 0, sizeof(reload_map_t));
+    for (map->mask=15; map->mask < 2 * (unsigned int)live->num_patterns; map->mask = 2 * map->mask + 1);
+    for (map->set_mask=15; map->set_mask < 2 * (unsigned int)live->num_sets; map->set_mask = 2 * map->set_mask + 1);
+    map->slots = malloc((map->mask + 1) * sizeof(int));
+    map->set_slots = malloc((map->set_mask + 1) * sizeof(int));
+    map->live_map = malloc((live->num_patterns ? live->num_patterns : 1) * sizeof(int));
+    map->live_first = malloc((live->num_sets + 1) * sizeof(int));
+    map->set_twin = malloc((num_sets ? num_sets : 1) * sizeof(int));
+    if (!map->slots || !map->set_slots || !map->live_map || !map->live_first || !map->set_twin) {
+        reload_map_free(map);
+        return false;
+    }
+    memset(map->slots, -1, (map->mask + 1) * sizeof(int));
+    memset(map->set_slots, -1, (map->set_mask + 1) * sizeof(int));
+    memset(map->live_map, -1, (live->num_patterns ? live->num_patterns : 1) * sizeof(int));
+    memset(map->set_twin, -1, (num_sets ? num_sets : 1) * sizeof(int));
+
+    for (id=0, set=0; id<live->num_patterns; id++) {
+        for (i=live->pattern_hash[id] & map->mask; map->slots[i] >= 0; i=(i+1) & map->mask);
+        map->slots[i] = id;
+        while (set <= live->pattern_set[id]) {
+            map->live_first[set++] = id;
+        }
+    }
+    while (set <= live->num_sets) {
+        map->live_first[set++] = live->num_patterns;
+    }
+    for (set=0; set<live->num_sets; set++) {
+        for (i=live->set_hash[set] & map->set_mask; map->set_slots[i] >= 0; i=(i+1) & map->set_mask);
+        map->set_slots[i] = set;
+    }
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to find a live pattern written as a new one, not given
+ * to another new pattern yet
+ *
+ * @Param map
+ * @Param live
+ * @Param rs
+ * @Param id - new pattern, its pattern_hash set
+ *
+ * @Returns   live pattern, -1 when none
+ */
+/* ----------------------------------------------------------------------------*/
+static int reload_map_pattern(reload_map_t * map, const ruleset_t * live, const ruleset_t * rs, int id)
+{
+    unsigned long long h = rs->pattern_hash[id];
+    unsigned int i;
+    int other;
+
+    for (i=h & map->mask; map->slots[i] >= 0; i=(i+1) & map->mask) {
+        other = map->slots[i];
+        if (live->pattern_hash[other] == h && map->live_map[other] < 0 &&
+                live->pattern_len[other] == rs->pattern_len[id] &&
+                !memcmp(url_arena_str(&live->strings, live->pattern_off[other]),
+                    url_arena_str(&rs->strings, rs->pattern_off[id]), rs->pattern_len[id])) {
+            map->live_map[other] = id;
+            return other;
+        }
+    }
+    return -1;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to find the live set with the same patterns in the
+ * same order as each new set
+ *
+ * @Param map
+ * @Param live
+ * @Param rs - set_hash set
+ *
+ * @Returns   sets found
+ */
+/* ----------------------------------------------------------------------------*/
+static int reload_map_sets(reload_map_t * map, const ruleset_t * live, const ruleset_t * rs)
+{
+    int set, other, first, end, len, k, num_twins = 0;
+    unsigned int i;
+
+    for (set=0, first=0; set<rs->num_sets; set++, first=end) {
+        for (end=first; end<rs->num_patterns && rs->pattern_set[end] == set; end++);
+        len = end - first;
+        for (i=rs->set_hash[set] & map->set_mask; map->set_slots[i] >= 0; i=(i+1) & map->set_mask) {
+            other = map->set_slots[i];
+            if (live->set_hash[other] != rs->set_hash[set] ||
+                    map->live_first[other + 1] - map->live_first[other] != len) {
+                continue;
+            }
+            for (k=0; k<len; k++) {
+                if (live->pattern_len[map->live_first[other] + k] != rs->pattern_len[first + k] ||
+                        memcmp(url_arena_str(&live->strings, live->pattern_off[map->live_first[other] + k]),
+                            url_arena_str(&rs->strings, rs->pattern_off[first + k]), rs->pattern_len[first + k])) {
+                    break;
+                }
+            }
+            if (k == len) {
+                map->set_twin[set] = other;
+                num_twins++;
+                break;
+            }
+        }
+    }
+    return num_twins;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to give a new canonical pattern the regex a live
+ * pattern written the same way has compiled, shared by both rulesets
+ *
+ * @Param rs
+ * @Param id
+ * @Param live
+ * @Param live_id - canonical pattern of live
+ */
+/* ----------------------------------------------------------------------------*/
+static void regex_share(ruleset_t * rs, int id, const ruleset_t * live, int live_id)
+{
+    if (atomic_load_explicit(&live->regex_ready[live_id], memory_order_acquire)) {
+        __sync_add_and_fetch(&live->regex[live_id]->refs, 1);
+        rs->regex[id] = live->regex[live_id];
+        atomic_store_explicit(&rs->regex_ready[id], 1, memory_order_relaxed);
+    }
+}
+
+/* Sets up to this size are checked pattern against pattern for subsumed
+ * patterns, larger ones only against their '*' alone and the duplicates */
+#define SUBSUME_MAX_SET     512
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to check if a pattern q matches every url a pattern p
+ * matches and is checked before it. The SELF form of p is matched by q as if
+ * it was a url: '*' of q takes anything and '|' of q anything but a '/'
+ * (a '*' of p comes after its first '/', a '|' of q can't reach it), any url
+ * of p then matches q the same way.
+ *
+ * @Param rs
+ * @Param q
+ * @Param p
+ * @Param p_self - SELF form of p
+ * @Param p_self_len
+ *
+ * @Returns   true when p is subsumed by q
+ */
+/* ----------------------------------------------------------------------------*/
+static inline bool pattern_subsumes(const ruleset_t * rs, int q, int p, const char * p_self, size_t p_self_len)
+{
+    const char *q_self = url_arena_str(&rs->strings, rs->self_off[q]);
+    size_t q_self_len = rs->self_len[q];
+
+    if (q == p || pattern_rank(rs, q) >= pattern_rank(rs, p)) {
+        return false;
+    }
+    /* most pairs already differ on a literal first character */
+    if (*q_self != '*' && *q_self != '|' && *q_self != *p_self) {
+        return false;
+    }
+    return self_glob_match(p_self, p_self_len, q_self, q_self_len);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to find the patterns no mode but MATCH_ALL has to
+ * verify: a pattern of the same set ranked before matches every url they
+ * match, so that one is reported for the set. Patterns turning into regex
+ * operators are left alone, POSIX and SELF don't read them the same way.
+ * Only the patterns of the set decide it, a set found the same in the
+ * ruleset reloaded takes its patterns as they were.
+ *
+ * @Param rs
+ * @Param live - ruleset reloaded, NULL when none
+ * @Param set_twin - set of live with the same patterns, -1 when none
+ * @Param live_first - first pattern of each set of live
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool find_subsumed(ruleset_t * rs, const ruleset_t * live, const int * set_twin, const int * live_first)
+{
+    const char *p_self;
+    size_t p_self_len;
+    int *others, first, end, i, p, q, num_others;
+    bool subsumed;
+
+    others = malloc((rs->num_patterns ? rs->num_patterns : 1) * sizeof(int));
+    if (!others) {
+        return false;
+    }
+
+    for (first=0; first<rs->num_patterns; first=end) {
+        for (end=first; end<rs->num_patterns && rs->pattern_set[end] == rs->pattern_set[first]; end++);
+
+        if (live && set_twin[rs->pattern_set[first]] >= 0) {
+            for (p=first, q=live_first[set_twin[rs->pattern_set[first]]]; p<end; p++, q++) {
+                if (live->pattern_flags[q] & PATTERN_SUBSUMED) {
+                    rs->pattern_flags[p] |= PATTERN_SUBSUMED;
+                    rs->num_subsumed++;
+                }
+            }
+            continue;
+        }
+
+        /* without a wildcard a pattern only subsumes its duplicates */
+        for (i=first, num_others=0; i<end; i++) {
+            if ((rs->pattern_flags[i] & PATTERN_PLAIN) && strpbrk(url_arena_str(&rs->strings, rs->self_off[i]), "*|") &&
+                    (end - first <= SUBSUME_MAX_SET || (rs->pattern_flags[rs->pattern_canon[i]] & PATTERN_ANY_HOST))) {
+                others[num_others++] = i;
+            }
+        }
+
+        for (p=first; p<end; p++) {
+            if (!(rs->pattern_flags[p] & PATTERN_PLAIN)) {
+                continue;
+            }
+            p_self = url_arena_str(&rs->strings, rs->self_off[p]);
+            p_self_len = rs->self_len[p];
+            subsumed = false;
+            for (i=0;i<num_others;i++) {
+                q = others[i];
+                if ((subsumed = pattern_subsumes(rs, q, p, p_self, p_self_len))) {
+                    break;
+                }
+            }
+            for (q=rs->pattern_canon[p]; !subsumed && q>=0; q=rs->dup_next[q]) {
+                if ((subsumed = rs->pattern_set[q] == rs->pattern_set[p] &&
+                            pattern_subsumes(rs, q, p, p_self, p_self_len))) {
+                    break;
+                }
+            }
+            if (subsumed) {
+                rs->pattern_flags[p] |= PATTERN_SUBSUMED;
+                rs->num_subsumed++;
+                TM_PRINTF(rs->debug, "subsumed pattern %s by %s\n", url_arena_str(&rs->strings, rs->pattern_off[p]),
+                        url_arena_str(&rs->strings, rs->pattern_off[q]));
+            }
+        }
+    }
+
+    free(others);
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to compile every pattern of the sets once. The match
+ * path only reads the compiled form, which keeps its own copy of the pattern
+ * strings and set ids, the sets can be freed right after.
+ * The per pattern arrays are sized from the sets and the strings go to one
+ * arena sized for the patterns, there is no limit on the number or the
+ * length of the patterns.
+ *  1. SELF pattern - consecutive wildcards removed and '|' for the wildcard
+ *     before the first '/'. A pattern written the same way as an earlier
+ *     one, in any set, shares its SELF pattern and regex and is left out of
+ *     the DFA.
+ *  2. POSIX pattern - escaped, anchored and compiled with regcomp() when
+ *     first verified. A pattern turning into regex operators is compiled
+ *     right away, it may not be a valid regex and it has no literal for
+ *     the prefilter so it is verified for every url anyway.
+ *  3. DFA - all the SELF patterns combined into one automaton
+ *  4. Host trie - domain rules like *.yahoo.com or *.uk
+ *  5. Prefilter - Aho-Corasick automaton over the longest literal of each
+ *     other pattern, one for SELF and one for POSIX
+ *  6. Subsumed patterns - patterns that never decide the match of their set
+ *     past MATCH_ALL
+ * Compiled over the live ruleset of a reload, the sets and patterns are
+ * found in it by their content hash and what was compiled for them is
+ * taken over: the regexes are shared, the subsumed patterns of a set
+ * unchanged are copied and the prefilters are only built for the patterns
+ * that are new. The host trie and the DFA are built again, their build
+ * costs little next to the others.
+ *
+ * @Param sets
+ * @Param num_sets
+ * @Param live - ruleset in use, not changed, NULL to compile all of it
+ *
+ * @Returns  compiled ruleset, NULL on failure 
+ */
+/* ----------------------------------------------------------------------------*/
+ruleset_t * url_engine_recompile(const url_engine_set_t * sets, int num_sets, const ruleset_t * live)
+{
+    ruleset_t *rs;
+    const char **self_patterns, *pattern, *self_pattern, *host;
+    char *temp_pattern = NULL, *new_pattern = NULL;
+    size_t len, max_len = 0, strings_size = 0;
+    int i, j, id, canon, live_id, wildcard_index, host_len, flags, num_patterns=0, *canon_slots;
+    int *group_of, num_groups;
+    unsigned int *canon_hashes, canon_mask;
+    reload_map_t map;
+    bool ok = true;
+
+    /* a mapped image keeps no content hashes */
+    if (live && !live->set_hash) {
+        live = NULL;
+    }
+
+    for (i=0;i<num_sets;i++) {
+        num_patterns += sets[i].num_patterns;
+        for (j=0;j<sets[i].num_patterns;j++) {
+            len = strlen(sets[i].patterns[j]);
+            max_len = (len > max_len) ? len : max_len;
+            /* the pattern and its SELF form, which is never longer */
+            strings_size += 2 * (len + 1);
+        }
+    }
+
+    rs = calloc(1, sizeof(ruleset_t));
+    if (NULL == rs) {
+        return NULL;
+    }
+    pthread_mutex_init(&rs->regex_lock, NULL);
+    rs->generation = ruleset_new_generation();
+    rs->debug = live && live->debug;
+    rs->set_keys = calloc(num_sets ? num_sets : 1, sizeof(int));
+    rs->set_hash = calloc(num_sets ? num_sets : 1, sizeof(unsigned long long));
+    rs->pattern_set = calloc(num_patterns ? num_patterns : 1, sizeof(int));
+    rs->pattern_off = calloc(num_patterns ? num_patterns : 1, sizeof(size_t));
+    rs->pattern_len = calloc(num_patterns ? num_patterns : 1, sizeof(int));
+    rs->pattern_hash = calloc(num_patterns ? num_patterns : 1, sizeof(unsigned long long));
+    rs->self_off = calloc(num_patterns ? num_patterns : 1, sizeof(size_t));
+    rs->self_len = calloc(num_patterns ? num_patterns : 1, sizeof(int));
+    rs->self_host = calloc(num_patterns ? num_patterns : 1, sizeof(int));
+    rs->is_domain = calloc(num_patterns ? num_patterns : 1, sizeof(unsigned char));
+    rs->pattern_canon = calloc(num_patterns ? num_patterns : 1, sizeof(int));
+    rs->dup_next = calloc(num_patterns ? num_patterns : 1, sizeof(int));
+    rs->pattern_flags = calloc(num_patterns ? num_patterns : 1, sizeof(unsigned char));
+    rs->regex = calloc(num_patterns ? num_patterns : 1, sizeof(shared_regex_t *));
+    rs->regex_ready = calloc(num_patterns ? num_patterns : 1, sizeof(unsigned char));
+    rs->hosttrie = hosttrie_create();
+    temp_pattern = malloc(max_len + 1);
+    new_pattern = malloc(max_len + 1);
+    for (canon_mask=15; canon_mask < 2 * (unsigned int)num_patterns; canon_mask = 2 * canon_mask + 1);
+    canon_slots = malloc((canon_mask + 1) * sizeof(int));
+    canon_hashes = malloc((canon_mask + 1) * sizeof(unsigned int));
+    if (!rs->set_keys || !rs->set_hash || !rs->pattern_set || !rs->pattern_off || !rs->pattern_len ||
+            !rs->pattern_hash || !rs->self_off ||
+            !rs->self_len || !rs->self_host || !rs->is_domain || !rs->pattern_canon || !rs->dup_next || !rs->pattern_flags ||
+            !rs->regex || !rs->regex_ready || !rs->hosttrie || !temp_pattern || !new_pattern ||
+            !canon_slots || !canon_hashes || !url_arena_init(&rs->strings, strings_size)) {
+        free(temp_pattern);
+        free(new_pattern);
+        free(canon_slots);
+        free(canon_hashes);
+        url_engine_free(rs);
+        return NULL;
+    }
+    memset(canon_slots, -1, (canon_mask + 1) * sizeof(int));
+    if (live && !reload_map_init(&map, live, num_sets)) {
+        free(temp_pattern);
+        free(new_pattern);
+        free(canon_slots);
+        free(canon_hashes);
+        url_engine_free(rs);
+        return NULL;
+    }
+
+    for (i=0;ok && i<num_sets;i++) {
+        rs->set_keys[rs->num_sets++] = sets[i].key;
+        rs->set_hash[i] = content_hash(&sets[i].num_patterns, sizeof(int), CONTENT_HASH_INIT);
+        for (j=0;ok && j<sets[i].num_patterns;j++) {
+            id = rs->num_patterns;
+            pattern = sets[i].patterns[j];
+            len = strlen(pattern);
+            rs->pattern_set[id] = i;
+            rs->pattern_len[id] = len;
+            rs->pattern_off[id] = url_arena_add(&rs->strings, pattern, len);
+            if (URL_ARENA_FAIL == rs->pattern_off[id]) {
+                ok = false;
+                break;
+            }
+            rs->pattern_hash[id] = content_hash(pattern, len, CONTENT_HASH_INIT);
+            rs->set_hash[i] = content_hash(&rs->pattern_hash[id], sizeof(unsigned long long), rs->set_hash[i]);
+            live_id = live ? reload_map_pattern(&map, live, rs, id) : -1;
+
+            canon = canonical_add(rs, canon_slots, canon_hashes, canon_mask, id);
+            rs->pattern_canon[id] = canon;
+            rs->dup_next[id] = -1;
+            if (canon != id) {
+                rs->self_off[id] = rs->self_off[canon];
+                rs->dup_next[id] = rs->dup_next[canon];
+                rs->dup_next[canon] = id;
+                rs->pattern_flags[canon] |= PATTERN_SHARED;
+                rs->num_duplicates++;
+                TM_PRINTF(rs->debug, "duplicate pattern %s of %s\n", pattern, url_arena_str(&rs->strings, rs->pattern_off[canon]));
+            } else {
+                wildcard_index = -1;
+                create_new_pattern(pattern, temp_pattern, SELF);
+                strcpy(new_pattern, temp_pattern);
+                if (true == match_needs_pattern_change(temp_pattern, &wildcard_index, SELF)) {
+                    modify_self_pattern_string(temp_pattern, new_pattern, wildcard_index);
+                }
+                rs->self_off[id] = url_arena_add(&rs->strings, new_pattern, strlen(new_pattern));
+                if (URL_ARENA_FAIL == rs->self_off[id]) {
+                    ok = false;
+                    break;
+                }
+            }
+            self_pattern = url_arena_str(&rs->strings, rs->self_off[id]);
+            TM_PRINTF(rs->debug, "compiled pattern %s: self %s\n", pattern, self_pattern);
+            rs->num_patterns++;
+
+            rs->self_len[id] = strlen(self_pattern);
+            rs->self_host[id] = strcspn(self_pattern, "/");
+            if (!strchr(self_pattern + rs->self_host[id], '|')) {
+                rs->pattern_flags[id] |= PATTERN_SPLIT;
+            }
+            if (!strpbrk(pattern, REGEX_OPERATORS)) {
+                rs->pattern_flags[id] |= PATTERN_PLAIN;
+            }
+
+            if (canon == id && !strcmp(self_pattern, "|")) {
+                rs->pattern_flags[id] |= PATTERN_ANY_HOST;
+            }
+            if (canon == id && live_id >= 0) {
+                regex_share(rs, id, live, live->pattern_canon[live_id]);
+            }
+            if (canon == id && strpbrk(pattern, REGEX_OPERATORS) && !regex_prepare(rs, id)) {
+                ok = false;
+                break;
+            }
+
+            if (hosttrie_parse(self_pattern, &host, &host_len, &flags)) {
+                if (!hosttrie_add(rs->hosttrie, host, host_len, flags, id)) {
+                    ok = false;
+                    break;
+                }
+                rs->is_domain[id] = true;
+                TM_PRINTF(rs->debug, "domain rule %s: host %.*s flags %d\n", pattern, host_len, host, flags);
+            }
+        }
+    }
+    free(temp_pattern);
+    free(new_pattern);
+    free(canon_slots);
+    free(canon_hashes);
+    if (ok && live) {
+        i = reload_map_sets(&map, live, rs);
+        TM_PRINTF(rs->debug, "%d of %d sets unchanged\n", i, rs->num_sets);
+    }
+    if (!ok || !find_subsumed(rs, live, live ? map.set_twin : NULL, live ? map.live_first : NULL)) {
+        if (live) {
+            reload_map_free(&map);
+        }
+        url_engine_free(rs);
+        return NULL;
+    }
+    url_arena_shrink(&rs->strings);
+
+    self_patterns = calloc(num_patterns ? num_patterns : 1, sizeof(char *));
+    if (NULL == self_patterns) {
+        if (live) {
+            reload_map_free(&map);
+        }
+        url_engine_free(rs);
+        return NULL;
+    }
+    group_of = malloc((num_patterns ? num_patterns : 1) * sizeof(int));
+    num_groups = group_of ? dfa_groups(rs, group_of) : -1;
+    for (i=0;i<rs->num_patterns;i++) {
+        self_patterns[i] = (rs->pattern_canon[i] == i) ? url_arena_str(&rs->strings, rs->self_off[i]) : NULL;
+    }
+    rs->dfa = (num_groups >= 0) ? dfa_compile(self_patterns, rs->num_patterns, group_of, num_groups) : NULL;
+    free(self_patterns);
+    free(group_of);
+    if (rs->dfa) {
+        rs->self_prefilter = build_prefilter(rs, SELF, live ? live->self_prefilter : NULL, live ? map.live_map : NULL);
+        rs->posix_prefilter = build_prefilter(rs, POSIX, live ? live->posix_prefilter : NULL, live ? map.live_map : NULL);
+    }
+    if (live) {
+        reload_map_free(&map);
+    }
+    if (!rs->dfa || !rs->self_prefilter || !rs->posix_prefilter) {
+        url_engine_free(rs);
+        return NULL;
+    }
+
+    return rs;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to compile every pattern of the sets once, see
+ * url_engine_recompile()
+ *
+ * @Param sets
+ * @Param num_sets
+ *
+ * @Returns  compiled ruleset, NULL on failure 
+ */
+/* ----------------------------------------------------------------------------*/
+ruleset_t * url_engine_compile(const url_engine_set_t * sets, int num_sets)
+{
+    return url_engine_recompile(sets, num_sets, NULL);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get a generation for a new ruleset
+ *
+ * @Returns   generation, never 0
+ */
+/* ----------------------------------------------------------------------------*/
+unsigned int ruleset_new_generation()
+{
+    static unsigned int ruleset_generation = 0;
+
+    return __sync_add_and_fetch(&ruleset_generation, 1);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to read the config file and compile it into a new
+ * ruleset over the live one, see url_engine_recompile(). The sets read
+ * from the file are only kept while compiling. A ruleset image written by
+ * url_engine_save() is mapped instead.
+ *
+ * @Param config_file - config.xml or ruleset image
+ * @Param live - ruleset in use, NULL to compile all of it
+ *
+ * @Returns  compiled ruleset, NULL on failure 
+ */
+/* ----------------------------------------------------------------------------*/
+ruleset_t * url_engine_recompile_file(const char * config_file, const ruleset_t * live)
+{
+    xmlTextReaderPtr reader;
+    ruleset_t       *rs = NULL;
+    config_sets_t   config;
+    const char      **patterns = NULL;
+    int             i;
+    bool            ok;
+
+    if (url_image_is_image(config_file)) {
+        rs = url_image_load(config_file);
+        if (rs) {
+            rs->debug = live && live->debug;
+        }
+        return rs;
+    }
+
+    reader = xmlReaderForFile(config_file, NULL, 0);
+    if (NULL == reader) {
+        return NULL;
+    }
+    memset(&config, 0, sizeof(config));
+    config.debug = live && live->debug;
+    if (!url_arena_init(&config.strings, 4096)) {
+        xmlFreeTextReader(reader);
+        return NULL;
+    }
+
+    ok = construct_pattern_from_xml(reader, &config);
+    xmlFreeTextReader(reader);
+    if (ok && config.debug) {
+        print_xml_pattern(&config);
+    }
+
+    /* the arena won't move any more, the sets can point in it */
+    if (ok) {
+        patterns = malloc((config.num_patterns ? config.num_patterns : 1) * sizeof(char *));
+    }
+    if (patterns) {
+        for (i=0;i<config.num_patterns;i++) {
+            patterns[i] = url_arena_str(&config.strings, config.pattern_off[i]);
+        }
+        for (i=0;i<config.num_sets;i++) {
+            config.sets[i].patterns = patterns + config.set_first[i];
+        }
+        rs = url_engine_recompile(config.sets, config.num_sets, live);
+    } else if (ok) {
+        fprintf(stderr, "Config allocation failed\n");
+    }
+
+    free(patterns);
+    free_config(&config);
+    return rs;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to read the config file and compile it into a new
+ * ruleset, see url_engine_recompile_file()
+ *
+ * @Param config_file - config.xml or ruleset image
+ *
+ * @Returns  compiled ruleset, NULL on failure 
+ */
+/* ----------------------------------------------------------------------------*/
+ruleset_t * url_engine_compile_file(const char * config_file)
+{
+    return url_engine_recompile_file(config_file, NULL);
+}
+
+/*
+ ----------------------------------------------------------------------------
+|                                                                           |
+|                               LIBRARY API                                 |
+|                                                                           |
+|---------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the number of sets of the ruleset, the bits of
+ * the set bitmap
+ *
+ * @Param rs
+ *
+ * @Returns   number of sets
+ */
+/* ----------------------------------------------------------------------------*/
+int url_engine_num_sets(const ruleset_t * rs)
+{
+    return rs->num_sets;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the key of a set
+ *
+ * @Param rs
+ * @Param set - bit of the set bitmap
+ *
+ * @Returns   key from the config
+ */
+/* ----------------------------------------------------------------------------*/
+int url_engine_set_key(const ruleset_t * rs, int set)
+{
+    return rs->set_keys[set];
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the number of patterns of the ruleset
+ *
+ * @Param rs
+ *
+ * @Returns   number of patterns
+ */
+/* ----------------------------------------------------------------------------*/
+int url_engine_num_patterns(const ruleset_t * rs)
+{
+    return rs->num_patterns;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get a pattern given its id, as written in the config
+ *
+ * @Param rs
+ * @Param id - from url_engine_match_ids()
+ * @Param key - key of the set of the pattern
+ * @Param len - length of the pattern
+ *
+ * @Returns   pattern, owned by the ruleset
+ */
+/* ----------------------------------------------------------------------------*/
+const char * url_engine_pattern(const ruleset_t * rs, int id, int * key, int * len)
+{
+    *key = rs->set_keys[rs->pattern_set[id]];
+    *len = rs->pattern_len[id];
+    return url_arena_str(&rs->strings, rs->pattern_off[id]);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the number of patterns written the same way as
+ * an earlier one (consecutive wildcards aside), verified through that one
+ *
+ * @Param rs
+ *
+ * @Returns   number of duplicate patterns
+ */
+/* ----------------------------------------------------------------------------*/
+int url_engine_num_duplicates(const ruleset_t * rs)
+{
+    return rs->num_duplicates;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the number of patterns matching no url that a
+ * pattern of their set ranked before doesn't, only verified with MATCH_ALL
+ *
+ * @Param rs
+ *
+ * @Returns   number of subsumed patterns
+ */
+/* ----------------------------------------------------------------------------*/
+int url_engine_num_subsumed(const ruleset_t * rs)
+{
+    return rs->num_subsumed;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the generation of the ruleset, unique in the
+ * process. Results kept for an older generation are stale.
+ *
+ * @Param rs
+ *
+ * @Returns   generation
+ */
+/* ----------------------------------------------------------------------------*/
+unsigned int url_engine_generation(const ruleset_t * rs)
+{
+    return rs->generation;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to create the match state of one thread. It can be
+ * used with any ruleset, one at a time.
+ *
+ * @Param algo
+ *
+ * @Returns   scratch, NULL on failure
+ */
+/* ----------------------------------------------------------------------------*/
+url_engine_scratch_t * url_engine_scratch_create(MATCH_TYPE algo)
+{
+    url_engine_scratch_t *scratch;
+
+    scratch = calloc(1, sizeof(url_engine_scratch_t));
+    if (NULL == scratch) {
+        return NULL;
+    }
+    scratch->algo = algo;
+    scratch->dfa_cache = dfa_cache_create();
+    scratch->pf_scratch = prefilter_scratch_create();
+    if (!scratch->dfa_cache || !scratch->pf_scratch) {
+        url_engine_scratch_free(scratch);
+        return NULL;
+    }
+    return scratch;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the match state of a thread
+ *
+ * @Param scratch
+ */
+/* ----------------------------------------------------------------------------*/
+void url_engine_scratch_free(url_engine_scratch_t * scratch)
+{
+    if (!scratch) {
+        return;
+    }
+    dfa_cache_free(scratch->dfa_cache);
+    prefilter_scratch_free(scratch->pf_scratch);
+    free(scratch->hits);
+    free(scratch->ids);
+    free(scratch->order);
+    free(scratch->memo);
+    free(scratch->url_buf);
+    free(scratch->profile);
+    free(scratch);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to set how much of the match the scratch reports,
+ * MATCH_ALL when the scratch is created
+ *
+ * @Param scratch
+ * @Param mode
+ */
+/* ----------------------------------------------------------------------------*/
+void url_engine_scratch_set_mode(url_engine_scratch_t * scratch, MATCH_MODE mode)
+{
+    scratch->mode = mode;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to set the normalization of the urls the scratch
+ * matches, none when the scratch is created. The urls are normalized in a
+ * buffer of the scratch, the caller's urls are not changed.
+ *
+ * @Param scratch
+ * @Param flags - URL_NORMALIZE_*
+ */
+/* ----------------------------------------------------------------------------*/
+void url_engine_scratch_set_normalize(url_engine_scratch_t * scratch, int flags)
+{
+    scratch->normalize = flags;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to turn on or off the print of the result of each
+ * pattern the scratch verifies, off when the scratch is created
+ *
+ * @Param scratch
+ * @Param enable
+ */
+/* ----------------------------------------------------------------------------*/
+void url_engine_scratch_set_debug(url_engine_scratch_t * scratch, bool enable)
+{
+    scratch->debug = enable;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to turn the verifier profile of the scratch on or off,
+ * off when the scratch is created. Turning it on clears the counters. The
+ * DFA has no verifier, its patterns are not counted.
+ *
+ * @Param scratch
+ * @Param enable
+ */
+/* ----------------------------------------------------------------------------*/
+void url_engine_scratch_set_profile(url_engine_scratch_t * scratch, bool enable)
+{
+    scratch->profiling = enable;
+    free(scratch->profile);
+    scratch->profile = NULL;
+    scratch->profile_generation = 0;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add the verifier profile of a scratch to the stats
+ * of a ruleset. The scratch counts for the last ruleset it matched with,
+ * its counters start again with a new one. The caller keeps the thread of
+ * the scratch from matching meanwhile.
+ *
+ * @Param rs
+ * @Param scratch
+ * @Param stats - url_engine_num_patterns() entries, added to
+ *
+ * @Returns   number of patterns added, 0 when the scratch has no profile of
+ * the ruleset
+ */
+/* ----------------------------------------------------------------------------*/
+int url_engine_scratch_profile(const ruleset_t * rs, const url_engine_scratch_t * scratch,
+        url_engine_pattern_stats_t * stats)
+{
+    int id;
+
+    if (!scratch->profile || scratch->profile_generation != rs->generation) {
+        return 0;
+    }
+    for (id = 0; id < rs->num_patterns; id++) {
+        stats[id].evaluations += scratch->profile[id].evaluations;
+        stats[id].hits += scratch->profile[id].hits;
+        stats[id].cycles += scratch->profile[id].cycles;
+    }
+    return rs->num_patterns;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to start the profile of the scratch over for the
+ * ruleset, on its first match with it
+ *
+ * @Param rs
+ * @Param scratch
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool profile_reserve(const ruleset_t * rs, url_engine_scratch_t * scratch)
+{
+    free(scratch->profile);
+    scratch->profile = calloc(rs->num_patterns ? rs->num_patterns : 1, sizeof(url_engine_pattern_stats_t));
+    if (NULL == scratch->profile) {
+        fprintf(stderr, "Match scratch allocation failed\n");
+        return false;
+    }
+    scratch->profile_generation = rs->generation;
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to grow the id lists of the scratch to the patterns of
+ * the ruleset
+ *
+ * @Param rs
+ * @Param scratch
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool scratch_reserve(const ruleset_t * rs, url_engine_scratch_t * scratch)
+{
+    void *p, *q, *r, *m;
+
+    if (scratch->profiling && scratch->profile_generation != rs->generation &&
+            !profile_reserve(rs, scratch)) {
+        return false;
+    }
+    if (scratch->ids_size >= rs->num_patterns) {
+        return true;
+    }
+    /* the memo is only kept for the url being matched */
+    m = calloc(rs->num_patterns, sizeof(unsigned int));
+    if (m) {
+        free(scratch->memo);
+        scratch->memo = m;
+        scratch->memo_stamp = 0;
+    }
+    p = realloc(scratch->hits, rs->num_patterns * sizeof(int));
+    if (p) {
+        scratch->hits = p;
+    }
+    q = realloc(scratch->ids, rs->num_patterns * sizeof(int));
+    if (q) {
+        scratch->ids = q;
+    }
+    r = realloc(scratch->order, rs->num_patterns * sizeof(int));
+    if (r) {
+        scratch->order = r;
+    }
+    if (!p || !q || !r || !m) {
+        fprintf(stderr, "Match scratch allocation failed\n");
+        return false;
+    }
+    scratch->ids_size = rs->num_patterns;
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to match one url with the algorithm of the scratch,
+ * the scratch is already reserved
+ *
+ * @Param rs
+ * @Param scratch
+ * @Param mode
+ * @Param url
+ * @Param url_len
+ * @Param ids
+ *
+ * @Returns   number of matching patterns, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static inline int match_ids(const ruleset_t * rs, url_engine_scratch_t * scratch,
+        MATCH_MODE mode, const char * url, size_t url_len, const int ** ids)
+{
+    char *p;
+
+    if (scratch->normalize) {
+        if (url_len + 1 > scratch->url_buf_size) {
+            p = realloc(scratch->url_buf, url_len + 1);
+            if (NULL == p) {
+                fprintf(stderr, "Match scratch allocation failed\n");
+                return -1;
+            }
+            scratch->url_buf = p;
+            scratch->url_buf_size = url_len + 1;
+        }
+        url_len = url_normalize(url, url_len, scratch->url_buf, scratch->normalize);
+        scratch->url_buf[url_len] = '\0';
+        url = scratch->url_buf;
+    }
+
+    switch(scratch->algo) {
+        case POSIX:
+            if (MATCH_ALL != mode) {
+                return indexed_set_match(rs, scratch, rs->posix_prefilter, posix_verify, mode, url, url_len, ids);
+            }
+            return indexed_pattern_match(rs, scratch, rs->posix_prefilter, posix_verify, url, url_len, ids);
+
+        case SELF:
+            if (MATCH_ALL != mode) {
+                return indexed_set_match(rs, scratch, rs->self_prefilter, self_verify, mode, url, url_len, ids);
+            }
+            return indexed_pattern_match(rs, scratch, rs->self_prefilter, self_verify, url, url_len, ids);
+
+        case DFA:
+            return dfa_pattern_match(rs, scratch, mode, url, url_len, ids);
+
+        case NATIVE:
+            if (!rs->matcher_verify) {
+                fprintf(stderr, "No matcher loaded for the native algorithm\n");
+                return -1;
+            }
+            if (MATCH_ALL != mode) {
+                return indexed_set_match(rs, scratch, rs->self_prefilter, native_verify, mode, url, url_len, ids);
+            }
+            return indexed_pattern_match(rs, scratch, rs->self_prefilter, native_verify, url, url_len, ids);
+
+        default:
+            return -1;
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to match one url and get the matching patterns the
+ * match mode of the scratch asks for, every one with MATCH_ALL. Used when
+ * the patterns are printed, url_engine_pattern() gives them back.
+ *
+ * @Param rs
+ * @Param scratch - of the calling thread
+ * @Param url - not NUL terminated
+ * @Param url_len
+ * @Param ids - matching pattern ids in config order, valid till the next
+ * call with the scratch
+ *
+ * @Returns   number of matching patterns, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+int url_engine_match_ids(const ruleset_t * rs, url_engine_scratch_t * scratch,
+        const char * url, size_t url_len, const int ** ids)
+{
+    if (!scratch_reserve(rs, scratch)) {
+        return -1;
+    }
+    return match_ids(rs, scratch, scratch->mode, url, url_len, ids);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the mode of a match giving the set bitmap, one
+ * pattern per set is enough for it so MATCH_ALL becomes MATCH_ANY
+ *
+ * @Param scratch
+ *
+ * @Returns   mode
+ */
+/* ----------------------------------------------------------------------------*/
+static inline MATCH_MODE set_mode(const url_engine_scratch_t * scratch)
+{
+    return (MATCH_ALL == scratch->mode) ? MATCH_ANY : scratch->mode;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to set the bits of the sets having a matching pattern
+ *
+ * @Param rs
+ * @Param ids
+ * @Param num_ids
+ * @Param sets - bitmap of the url, cleared
+ *
+ * @Returns   number of matching sets
+ */
+/* ----------------------------------------------------------------------------*/
+static inline int ids_to_sets(const ruleset_t * rs, const int * ids, int num_ids, unsigned long long * sets)
+{
+    int i, set, num_matches = 0;
+
+    for (i=0;i<num_ids;i++) {
+        set = rs->pattern_set[ids[i]];
+        if (!(sets[set / 64] & (1ULL << (set % 64)))) {
+            sets[set / 64] |= 1ULL << (set % 64);
+            num_matches++;
+        }
+    }
+    return num_matches;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to match one url and get the sets having a matching
+ * pattern. Any number of threads can match with the ruleset, each with its
+ * own scratch.
+ *
+ * @Param rs
+ * @Param scratch - of the calling thread
+ * @Param url - not NUL terminated
+ * @Param url_len
+ * @Param sets - URL_ENGINE_BITMAP_WORDS(url_engine_num_sets()) words
+ *
+ * @Returns   number of matching sets, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+int url_engine_match(const ruleset_t * rs, url_engine_scratch_t * scratch,
+        const char * url, size_t url_len, unsigned long long * sets)
+{
+    const int *ids;
+    int num_ids;
+
+    memset(sets, 0, URL_ENGINE_BITMAP_WORDS(rs->num_sets) * sizeof(unsigned long long));
+    if (!scratch_reserve(rs, scratch)) {
+        return -1;
+    }
+    num_ids = match_ids(rs, scratch, set_mode(scratch), url, url_len, &ids);
+    if (num_ids < 0) {
+        return -1;
+    }
+    return ids_to_sets(rs, ids, num_ids, sets);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to match an array of urls. The scratch is sized and
+ * the bitmaps cleared once for the batch, then the urls are matched back to
+ * back with the same algorithm.
+ *
+ * @Param rs
+ * @Param scratch - of the calling thread
+ * @Param urls - not NUL terminated
+ * @Param url_lens
+ * @Param num_urls
+ * @Param sets - URL_ENGINE_BITMAP_WORDS(url_engine_num_sets()) words per url
+ *
+ * @Returns   number of urls having a match, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+int url_engine_match_batch(const ruleset_t * rs, url_engine_scratch_t * scratch,
+        const char * const * urls, const size_t * url_lens, int num_urls, unsigned long long * sets)
+{
+    int i, num_ids, num_matched = 0, words = URL_ENGINE_BITMAP_WORDS(rs->num_sets);
+    MATCH_MODE mode = set_mode(scratch);
+    const int *ids;
+
+    if (!scratch_reserve(rs, scratch)) {
+        return -1;
+    }
+    memset(sets, 0, (size_t)num_urls * words * sizeof(unsigned long long));
+
+    for (i=0;i<num_urls;i++) {
+        num_ids = match_ids(rs, scratch, mode, urls[i], url_lens[i], &ids);
+        if (num_ids < 0) {
+            return -1;
+        }
+        if (num_ids) {
+            ids_to_sets(rs, ids, num_ids, sets + (size_t)i * words);
+            num_matched++;
+        }
+    }
+    return num_matched;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write the compiled ruleset to an image file, which
+ * url_engine_compile_file() maps without parsing or compiling
+ *
+ * @Param rs
+ * @Param image_file
+ *
+ * @Returns   false on failure
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_engine_save(const ruleset_t * rs, const char * image_file)
+{
+    ruleset_t whole;
+    bool ok;
+
+    if (!rs->self_prefilter->base && !rs->posix_prefilter->base) {
+        return url_image_save(rs, image_file);
+    }
+    /* a reloaded ruleset is written with its prefilters built whole */
+    whole = *rs;
+    whole.self_prefilter = build_prefilter(rs, SELF, NULL, NULL);
+    whole.posix_prefilter = build_prefilter(rs, POSIX, NULL, NULL);
+    ok = whole.self_prefilter && whole.posix_prefilter && url_image_save(&whole, image_file);
+    prefilter_free(whole.self_prefilter);
+    prefilter_free(whole.posix_prefilter);
+    return ok;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to turn the debug prints of a ruleset on or off, off
+ * when it is compiled. A ruleset recompiled over it takes them over, with
+ * the config read and the patterns compiled. Set before the ruleset is
+ * matched with.
+ *
+ * @Param rs
+ * @Param enable
+ */
+/* ----------------------------------------------------------------------------*/
+void url_engine_set_debug(ruleset_t * rs, bool enable)
+{
+    rs->debug = enable;
+}
@@ -0,0 +1,120 @@
+#ifndef _URL_LIB_H_
+#define _URL_LIB_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * liburlengine - URL pattern matching library used by the url-engine CLI.
+ *
+ * A compiled ruleset (url_engine_t) is immutable, any number of threads can
+ * match with it at the same time. Each thread passes its own scratch
+ * (url_engine_scratch_t), which holds the lazily built DFA states and the
+ * candidate lists of the matcher. There is no other state, the debug prints
+ * are turned on per ruleset and per scratch.
+ *
+ * The match mode of the scratch says how much of the match is wanted. Past
+ * MATCH_ALL a set stops being checked at its first matching pattern and the
+ * patterns of a set are checked cheapest first: domain rules of the host
+ * trie, then the shorter patterns. The pattern reported for a set is the
+ * first of that order, the same with every algorithm.
+ *
+ * At compile, patterns written the same way once their consecutive wildcards
+ * are removed (*.aaa.com and ***.aaa.com), in any set, share one compiled
+ * pattern verified once per url. A pattern whose set has a pattern ranked
+ * before it that matches every url it matches is subsumed: it is still
+ * reported with MATCH_ALL but never verified past it.
+ *
+ * url_engine_recompile() compiles new sets over a ruleset in use and takes
+ * over what was compiled for the patterns left as they were. The ruleset in
+ * use is not changed, the two are freed in any order.
+ */
+
+typedef enum match_type{
+    POSIX=0,
+    SELF,
+    DFA,
+    NATIVE      /* SELF with the matcher of url_engine_load_matcher() */
+}MATCH_TYPE;
+
+/* What a match reports, set on the scratch */
+typedef enum match_mode{
+    MATCH_ALL=0,        /* every matching pattern */
+    MATCH_ANY,          /* one matching pattern of each matching set */
+    MATCH_FIRST_SET,    /* one matching pattern of the first matching set */
+    MATCH_BOOLEAN       /* one matching pattern, any */
+}MATCH_MODE;
+
+/* Normalization of the urls before the match, set on the scratch. The
+ * patterns are not changed, they are expected in the normalized form. */
+#define URL_NORMALIZE_LOWER_HOST    0x1     /* lowercase the host, before the first '/' */
+#define URL_NORMALIZE_LOWER         0x2     /* lowercase the whole url */
+#define URL_NORMALIZE_DECODE        0x4     /* decode %XX of unreserved characters */
+
+/*! \struct _url_engine_pattern_stats_t
+ *  Verifier profile of one pattern, url_engine_scratch_set_profile()
+ *  evaluations - urls the verifier was run for, a shared pattern counts on
+ *  its first pattern, once per url
+ *  hits - evaluations that matched
+ *  cycles - spent in the verifier, cpu cycles (ns where the cpu has no cycle
+ *  counter)
+ */
+typedef struct _url_engine_pattern_stats_t {
+    unsigned long long evaluations;
+    unsigned long long hits;
+    unsigned long long cycles;
+} url_engine_pattern_stats_t;
+
+/*! \struct _url_engine_set_t
+ *  One set of patterns given to url_engine_compile()
+ *  key - set id
+ *  patterns - num_patterns NUL terminated patterns
+ */
+typedef struct _url_engine_set_t {
+    int key;
+    int num_patterns;
+    const char * const * patterns;
+} url_engine_set_t;
+
+/* Opaque compiled ruleset and per thread match state */
+typedef struct _ruleset_t url_engine_t;
+typedef struct _url_engine_scratch_t url_engine_scratch_t;
+
+/* Words of the set bitmap of one url, bit i is the i-th set in config order */
+#define URL_ENGINE_BITMAP_WORDS(num_sets)   (((num_sets) + 63) / 64)
+
+url_engine_t * url_engine_compile(const url_engine_set_t * sets, int num_sets);
+url_engine_t * url_engine_compile_file(const char * config_file);
+url_engine_t * url_engine_recompile(const url_engine_set_t * sets, int num_sets, const url_engine_t * live);
+url_engine_t * url_engine_recompile_file(const char * config_file, const url_engine_t * live);
+bool url_engine_save(const url_engine_t * engine, const char * image_file);
+bool url_engine_codegen(const url_engine_t * engine, const char * c_file);
+bool url_engine_load_matcher(url_engine_t * engine, const char * so_file);
+void url_engine_set_debug(url_engine_t * engine, bool enable);
+void url_engine_free(url_engine_t * engine);
+
+int url_engine_num_sets(const url_engine_t * engine);
+int url_engine_set_key(const url_engine_t * engine, int set);
+int url_engine_num_patterns(const url_engine_t * engine);
+int url_engine_num_duplicates(const url_engine_t * engine);
+int url_engine_num_subsumed(const url_engine_t * engine);
+const char * url_engine_pattern(const url_engine_t * engine, int id, int * key, int * len);
+unsigned int url_engine_generation(const url_engine_t * engine);
+
+url_engine_scratch_t * url_engine_scratch_create(MATCH_TYPE algo);
+void url_engine_scratch_free(url_engine_scratch_t * scratch);
+void url_engine_scratch_set_mode(url_engine_scratch_t * scratch, MATCH_MODE mode);
+void url_engine_scratch_set_normalize(url_engine_scratch_t * scratch, int flags);
+void url_engine_scratch_set_profile(url_engine_scratch_t * scratch, bool enable);
+void url_engine_scratch_set_debug(url_engine_scratch_t * scratch, bool enable);
+int url_engine_scratch_profile(const url_engine_t * engine, const url_engine_scratch_t * scratch,
+        url_engine_pattern_stats_t * stats);
+
+int url_engine_match(const url_engine_t * engine, url_engine_scratch_t * scratch,
+        const char * url, size_t url_len, unsigned long long * sets);
+int url_engine_match_batch(const url_engine_t * engine, url_engine_scratch_t * scratch,
+        const char * const * urls, const size_t * url_lens, int num_urls, unsigned long long * sets);
+int url_engine_match_ids(const url_engine_t * engine, url_engine_scratch_t * scratch,
+        const char * url, size_t url_len, const int ** ids);
+
+#endif /* ifndef _URL_LIB_H_ */
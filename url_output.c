@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "url_output.h"
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to append a string to the buffer, growing it as needed
+ *
+ * @Param out
+ * @Param str
+ * @Param len
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+bool out_buf_append(out_buf_t * out, const char * str, size_t len)
+{
+    size_t cap;
+    char *data;
+
+    if (out->len + len > out->cap) {
+        cap = out->cap ? out->cap : 4096;
+        while (out->len + len > cap) {
+            cap *= 2;
+        }
+        data = realloc(out->data, cap);
+        if (NULL == data) {
+            return false;
+        }
+        out->data = data;
+        out->cap = cap;
+    }
+    memcpy(out->data + out->len, str, len);
+    out->len += len;
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to append an integer in decimal
+ *
+ * @Param out
+ * @Param value
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+bool out_buf_append_int(out_buf_t * out, int value)
+{
+    char digits[16], *p = digits + sizeof(digits);
+    unsigned int v = (value < 0) ? -(unsigned int)value : (unsigned int)value;
+
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (value < 0) {
+        *--p = '-';
+    }
+    return out_buf_append(out, p, digits + sizeof(digits) - p);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write the whole buffer to fd and empty it. stdout
+ * is flushed first so that the debug prints keep their place.
+ *
+ * @Param out
+ * @Param fd
+ *
+ * @Returns   false on write failure
+ */
+/* ----------------------------------------------------------------------------*/
+bool out_buf_write(out_buf_t * out, int fd)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    fflush(stdout);
+    while (done < out->len) {
+        n = write(fd, out->data + done, out->len - done);
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            perror("write");
+            return false;
+        }
+        done += n;
+    }
+    out->len = 0;
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the buffer memory
+ *
+ * @Param out
+ */
+/* ----------------------------------------------------------------------------*/
+void out_buf_free(out_buf_t * out)
+{
+    free(out->data);
+    out->data = NULL;
+    out->len = 0;
+    out->cap = 0;
+}
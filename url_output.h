@@ -0,0 +1,24 @@
+#ifndef _URL_OUTPUT_H_
+#define _URL_OUTPUT_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Size at which the writer hands its buffer to write() */
+#define OUTPUT_FLUSH_SIZE   (1024 * 1024)
+
+/*! \struct _out_buf_t
+ *  Growable buffer the match results are formatted into
+ */
+typedef struct _out_buf_t {
+    char *data;
+    size_t len;
+    size_t cap;
+} out_buf_t;
+
+bool out_buf_append(out_buf_t * out, const char * str, size_t len);
+bool out_buf_append_int(out_buf_t * out, int value);
+bool out_buf_write(out_buf_t * out, int fd);
+void out_buf_free(out_buf_t * out);
+
+#endif /* ifndef _URL_OUTPUT_H_ */
@@ -0,0 +1,82 @@
+#include <stdbool.h>
+#include "url_lib.h"
+#include "url_parse.h"
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to give the value of a hex digit
+ *
+ * @Param ch
+ *
+ * @Returns   0 to 15, -1 when not a hex digit
+ */
+/* ----------------------------------------------------------------------------*/
+static inline int hex_value(char ch)
+{
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to check if a character is unreserved (RFC 3986), the
+ * only ones whose percent-encoding can be decoded without changing the url
+ *
+ * @Param ch
+ *
+ * @Returns   true or false
+ */
+/* ----------------------------------------------------------------------------*/
+static inline bool unreserved(int ch)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') ||
+        ch == '-' || ch == '.' || ch == '_' || ch == '~';
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to normalize a url before it is matched
+ *  URL_NORMALIZE_DECODE - %XX of an unreserved character is decoded, the
+ *  others (%2F, %3F, ...) are kept so the host and path don't change
+ *  URL_NORMALIZE_LOWER_HOST - the host, before the first '/', is lowercased
+ *  URL_NORMALIZE_LOWER - the whole url is lowercased
+ *
+ * @Param url
+ * @Param url_len
+ * @Param out - url_len bytes, the url never gets longer
+ * @Param flags - URL_NORMALIZE_*
+ *
+ * @Returns   length of the normalized url
+ */
+/* ----------------------------------------------------------------------------*/
+size_t url_normalize(const char * url, size_t url_len, char * out, int flags)
+{
+    size_t i, len = 0;
+    bool in_host = true;
+    int ch, hi, lo;
+
+    for (i=0;i<url_len;i++) {
+        ch = (unsigned char)url[i];
+        if (ch == '%' && (flags & URL_NORMALIZE_DECODE) && i + 2 < url_len &&
+                (hi = hex_value(url[i+1])) >= 0 && (lo = hex_value(url[i+2])) >= 0 && unreserved(hi << 4 | lo)) {
+            ch = hi << 4 | lo;
+            i += 2;
+        } else if (ch == '/') {
+            in_host = false;
+        }
+        if (ch >= 'A' && ch <= 'Z' &&
+                ((flags & URL_NORMALIZE_LOWER) || (in_host && (flags & URL_NORMALIZE_LOWER_HOST)))) {
+            ch += 'a' - 'A';
+        }
+        out[len++] = ch;
+    }
+    return len;
+}
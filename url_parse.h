@@ -0,0 +1,40 @@
+#ifndef _URL_PARSE_H_
+#define _URL_PARSE_H_
+
+#include <stddef.h>
+#include <string.h>
+
+/*! \struct _url_parts_t
+ *  Url split once before it is matched
+ *  url, len - the url, not NUL terminated
+ *  host_len - bytes before the first '/', len when there is none. The path
+ *  is the rest, starting with the '/'.
+ */
+typedef struct _url_parts_t {
+    const char *url;
+    size_t len;
+    size_t host_len;
+} url_parts_t;
+
+size_t url_normalize(const char * url, size_t url_len, char * out, int flags);
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to split a url into its host and path, with one scan
+ * for the first '/': memchr of the libc, which is vectorized already.
+ *
+ * @Param parts
+ * @Param url
+ * @Param url_len
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void url_parse(url_parts_t * parts, const char * url, size_t url_len)
+{
+    const char *slash = memchr(url, '/', url_len);
+
+    parts->url = url;
+    parts->len = url_len;
+    parts->host_len = slash ? (size_t)(slash - url) : url_len;
+}
+
+#endif /* ifndef _URL_PARSE_H_ */
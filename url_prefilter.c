@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "url_prefilter.h"
+
+static unsigned int prefilter_generation = 0;
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to find the child of node on character ch
+ *
+ * @Param pf
+ * @Param node
+ * @Param ch
+ *
+ * @Returns   child node, -1 when none
+ */
+/* ----------------------------------------------------------------------------*/
+static inline int prefilter_child(const prefilter_t * pf, int node, unsigned char ch)
+{
+    int child;
+
+    if (0 == node) {
+        return pf->root_next[ch];
+    }
+    for (child = pf->first_child[node]; child >= 0; child = pf->next_sibling[child]) {
+        if (pf->label[child] == ch) {
+            return child;
+        }
+    }
+    return -1;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to drop one owner of the prefilter, freed with the
+ * last one
+ *
+ * @Param pf
+ */
+/* ----------------------------------------------------------------------------*/
+void prefilter_free(prefilter_t * pf)
+{
+    if (!pf || __sync_sub_and_fetch(&pf->refs, 1) > 0) {
+        return;
+    }
+    prefilter_free(pf->base);
+    free(pf->base_map);
+    free(pf->label);
+    free(pf->first_child);
+    free(pf->next_sibling);
+    free(pf->fail);
+    free(pf->out_first);
+    free(pf->out_link);
+    free(pf->out_pattern);
+    free(pf->out_next);
+    free(pf->always);
+    free(pf);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to build the Aho-Corasick automaton over the literals.
+ *  1. Trie of all the literals, the pattern id is added to the last node
+ *  2. Fail links computed in BFS order
+ *  3. out_link points to the nearest fail node having pattern ids
+ *
+ * @Param literals - mandatory literal of each pattern, NULL when none
+ * @Param lens - length of each literal, negative when the pattern is
+ *               matched elsewhere and is never a candidate
+ * @Param num_patterns
+ *
+ * @Returns   prefilter, NULL on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+prefilter_t * prefilter_build(const char * const * literals, const int * lens, int num_patterns)
+{
+    prefilter_t *pf;
+    int i, j, node, child, fail, max_nodes = 1, *queue, head = 0, tail = 0;
+
+    for (i=0;i<num_patterns;i++) {
+        if (literals[i] && lens[i] > 0) {
+            max_nodes += lens[i];
+        }
+    }
+
+    pf = calloc(1, sizeof(prefilter_t));
+    if (NULL == pf) {
+        return NULL;
+    }
+    pf->label = calloc(max_nodes, sizeof(unsigned char));
+    pf->first_child = malloc(max_nodes * sizeof(int));
+    pf->next_sibling = malloc(max_nodes * sizeof(int));
+    pf->fail = calloc(max_nodes, sizeof(int));
+    pf->out_first = malloc(max_nodes * sizeof(int));
+    pf->out_link = calloc(max_nodes, sizeof(int));
+    /* zeroed, the entries of patterns left out are written to the image too */
+    pf->out_pattern = calloc(num_patterns ? num_patterns : 1, sizeof(int));
+    pf->out_next = calloc(num_patterns ? num_patterns : 1, sizeof(int));
+    pf->always = malloc((num_patterns ? num_patterns : 1) * sizeof(int));
+    queue = malloc(max_nodes * sizeof(int));
+    if (!pf->label || !pf->first_child || !pf->next_sibling || !pf->fail ||
+            !pf->out_first || !pf->out_link || !pf->out_pattern ||
+            !pf->out_next || !pf->always || !queue) {
+        free(queue);
+        prefilter_free(pf);
+        return NULL;
+    }
+
+    memset(pf->root_next, 0xff, sizeof(pf->root_next));
+    pf->first_child[0] = -1;
+    pf->next_sibling[0] = -1;
+    pf->out_first[0] = -1;
+    pf->num_nodes = 1;
+
+    /* Trie of the literals */
+    for (i=0;i<num_patterns;i++) {
+        if (lens[i] < 0) {
+            continue;
+        }
+        if (!literals[i] || 0 == lens[i]) {
+            pf->always[pf->num_always++] = i;
+            continue;
+        }
+        node = 0;
+        for (j=0;j<lens[i];j++) {
+            child = prefilter_child(pf, node, literals[i][j]);
+            if (child < 0) {
+                child = pf->num_nodes++;
+                pf->label[child] = literals[i][j];
+                pf->first_child[child] = -1;
+                pf->out_first[child] = -1;
+                pf->next_sibling[child] = pf->first_child[node];
+                pf->first_child[node] = child;
+                if (0 == node) {
+                    pf->root_next[(unsigned char)literals[i][j]] = child;
+                }
+            }
+            node = child;
+        }
+        /* patterns sharing the same literal */
+        pf->out_pattern[i] = i;
+        pf->out_next[i] = pf->out_first[node];
+        pf->out_first[node] = i;
+    }
+
+    /* Fail and output links in BFS order */
+    for (child = pf->first_child[0]; child >= 0; child = pf->next_sibling[child]) {
+        queue[tail++] = child;
+    }
+    while (head < tail) {
+        node = queue[head++];
+        for (child = pf->first_child[node]; child >= 0; child = pf->next_sibling[child]) {
+            queue[tail++] = child;
+            fail = pf->fail[node];
+            while (fail && prefilter_child(pf, fail, pf->label[child]) < 0) {
+                fail = pf->fail[fail];
+            }
+            fail = prefilter_child(pf, fail, pf->label[child]);
+            pf->fail[child] = (fail > 0 && fail != child) ? fail : 0;
+            fail = pf->fail[child];
+            pf->out_link[child] = (pf->out_first[fail] >= 0) ? fail : pf->out_link[fail];
+        }
+    }
+    free(queue);
+
+    pf->num_patterns = num_patterns;
+    pf->generation = prefilter_new_generation();
+    pf->refs = 1;
+
+    return pf;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to scan a base prefilter along with pf, so that pf
+ * only needs the literals of the patterns the base doesn't have. The base
+ * is shared, not copied: it gets one more owner.
+ *
+ * @Param pf - built with a negative length for the patterns of the base
+ * @Param base - not itself on a base
+ * @Param base_map - id in pf of each pattern of the base, -1 when gone,
+ *                   freed with pf
+ */
+/* ----------------------------------------------------------------------------*/
+void prefilter_set_base(prefilter_t * pf, prefilter_t * base, int * base_map)
+{
+    __sync_add_and_fetch(&base->refs, 1);
+    pf->base = base;
+    pf->base_map = base_map;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get a generation for a new prefilter, also used for
+ * one read back from a ruleset image
+ *
+ * @Returns   generation, never 0
+ */
+/* ----------------------------------------------------------------------------*/
+unsigned int prefilter_new_generation()
+{
+    return __sync_add_and_fetch(&prefilter_generation, 1);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to create the per thread scratch of the prefilter
+ *
+ * @Returns   scratch, NULL on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+prefilter_scratch_t * prefilter_scratch_create()
+{
+    return calloc(1, sizeof(prefilter_scratch_t));
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the per thread scratch of the prefilter
+ *
+ * @Param scratch
+ */
+/* ----------------------------------------------------------------------------*/
+void prefilter_scratch_free(prefilter_scratch_t * scratch)
+{
+    if (!scratch) {
+        return;
+    }
+    free(scratch->mark);
+    free(scratch->candidates);
+    free(scratch);
+}
+
+static int compare_ids(const void * a, const void * b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to run the url through the automaton and add the
+ * patterns found to the candidates, each once
+ *
+ * @Param pf
+ * @Param map - id of each pattern of pf in the candidates, -1 to leave it
+ *              out, NULL when the same
+ * @Param scratch
+ * @Param url
+ * @Param len
+ * @Param n - candidates so far
+ *
+ * @Returns   candidates
+ */
+/* ----------------------------------------------------------------------------*/
+static int prefilter_hits(const prefilter_t * pf, const int * map, prefilter_scratch_t * scratch,
+        const char * url, size_t len, int n)
+{
+    int node = 0, next, out, id, hit;
+    size_t k;
+
+    for (k=0;k<len;k++) {
+        while ((next = prefilter_child(pf, node, url[k])) < 0 && node) {
+            node = pf->fail[node];
+        }
+        node = (next < 0) ? 0 : next;
+
+        for (out = (pf->out_first[node] >= 0) ? node : pf->out_link[node]; out; out = pf->out_link[out]) {
+            for (id = pf->out_first[out]; id >= 0; id = pf->out_next[id]) {
+                hit = map ? map[id] : id;
+                if (hit >= 0 && scratch->mark[hit] != scratch->stamp) {
+                    scratch->mark[hit] = scratch->stamp;
+                    scratch->candidates[n++] = hit;
+                }
+            }
+        }
+    }
+    return n;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to scan the url once and list the patterns whose
+ * literal is present along with the patterns without a literal
+ *
+ * @Param pf
+ * @Param scratch
+ * @Param url
+ * @Param len
+ * @Param num_hits - candidates found in the url, the others are always ones
+ *
+ * @Returns   number of candidates in no order, -1 on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static int prefilter_candidates(const prefilter_t * pf, prefilter_scratch_t * scratch, const char * url, size_t len,
+        int * num_hits)
+{
+    int i, n, id;
+    void *p;
+
+    if (scratch->generation != pf->generation) {
+        if (pf->num_patterns > scratch->size) {
+            if (NULL == (p = realloc(scratch->mark, pf->num_patterns * sizeof(unsigned int)))) return -1;
+            scratch->mark = p;
+            if (NULL == (p = realloc(scratch->candidates, pf->num_patterns * sizeof(int)))) return -1;
+            scratch->candidates = p;
+            scratch->size = pf->num_patterns;
+        }
+        memset(scratch->mark, 0, scratch->size * sizeof(unsigned int));
+        scratch->stamp = 0;
+        scratch->generation = pf->generation;
+    }
+    if (0 == ++scratch->stamp) {
+        memset(scratch->mark, 0, scratch->size * sizeof(unsigned int));
+        scratch->stamp = 1;
+    }
+
+    n = prefilter_hits(pf, NULL, scratch, url, len, 0);
+    if (pf->base) {
+        n = prefilter_hits(pf->base, pf->base_map, scratch, url, len, n);
+    }
+
+    *num_hits = n;
+    for (i=0;i<pf->num_always;i++) {
+        scratch->candidates[n++] = pf->always[i];
+    }
+    for (i=0;pf->base && i<pf->base->num_always;i++) {
+        if ((id = pf->base_map[pf->base->always[i]]) >= 0) {
+            scratch->candidates[n++] = id;
+        }
+    }
+    return n;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to scan the url once and list the patterns whose
+ * literal is present along with the patterns without a literal. Only these
+ * candidates need to be verified by the matcher.
+ *
+ * @Param pf
+ * @Param scratch - scratch of the calling thread
+ * @Param url
+ * @Param len
+ * @Param candidates - candidate pattern ids in increasing order, valid till
+ *                     the next call on the scratch
+ *
+ * @Returns   number of candidates, -1 on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+int prefilter_scan(const prefilter_t * pf, prefilter_scratch_t * scratch, const char * url, size_t len, const int ** candidates)
+{
+    int n, num_hits;
+
+    n = prefilter_candidates(pf, scratch, url, len, &num_hits);
+    if (n < 0) {
+        return -1;
+    }
+    /* Verify in config order */
+    if (num_hits || pf->base) {
+        qsort(scratch->candidates, n, sizeof(int), compare_ids);
+    }
+
+    *candidates = scratch->candidates;
+    return n;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to list the candidates like prefilter_scan() without
+ * putting them in order, for a matcher that only looks them up. The sort
+ * costs more than the scan once a url has a few hundred candidates.
+ *
+ * @Param pf
+ * @Param scratch - scratch of the calling thread
+ * @Param url
+ * @Param len
+ * @Param candidates - candidate pattern ids in no order, valid till the next
+ *                     call on the scratch
+ *
+ * @Returns   number of candidates, -1 on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+int prefilter_scan_unordered(const prefilter_t * pf, prefilter_scratch_t * scratch, const char * url, size_t len,
+        const int ** candidates)
+{
+    int n, num_hits;
+
+    n = prefilter_candidates(pf, scratch, url, len, &num_hits);
+    *candidates = scratch->candidates;
+    return n;
+}
@@ -0,0 +1,59 @@
+#ifndef _URL_PREFILTER_H_
+#define _URL_PREFILTER_H_
+
+#include <stddef.h>
+
+/*! \struct _prefilter_t
+ *  Aho-Corasick automaton over one mandatory literal of each pattern, shared
+ *  read only by the threads. Node 0 is the root, children of a node are kept
+ *  in a first_child/next_sibling list, the root also has a direct table.
+ *  out_first - first pattern id entry of the node, -1 when none
+ *  out_link  - nearest node on the fail chain having entries, 0 when none
+ *  always - sorted ids of the patterns without a literal, checked for every url
+ *  refs - owners of the prefilter, a later prefilter may share it as its base
+ *  base - prefilter of an earlier ruleset scanned along with this one, NULL
+ *  when none. Its pattern ids are turned into ids of this one by base_map,
+ *  -1 for a pattern gone since, this one only holds the other patterns.
+ */
+typedef struct _prefilter_t {
+    unsigned int generation;
+    int refs;
+    struct _prefilter_t *base;
+    int *base_map;
+    int num_patterns;
+    int num_nodes;
+    int root_next[256];
+    unsigned char *label;
+    int *first_child;
+    int *next_sibling;
+    int *fail;
+    int *out_first;
+    int *out_link;
+    int *out_pattern;
+    int *out_next;
+    int num_always;
+    int *always;
+} prefilter_t;
+
+/*! \struct _prefilter_scratch_t
+ *  Candidate list of the url being scanned, owned by one thread
+ */
+typedef struct _prefilter_scratch_t {
+    unsigned int generation;
+    unsigned int *mark;
+    unsigned int stamp;
+    int *candidates;
+    int size;
+} prefilter_scratch_t;
+
+prefilter_t * prefilter_build(const char * const * literals, const int * lens, int num_patterns);
+void prefilter_set_base(prefilter_t * pf, prefilter_t * base, int * base_map);
+void prefilter_free(prefilter_t * pf);
+unsigned int prefilter_new_generation();
+prefilter_scratch_t * prefilter_scratch_create();
+void prefilter_scratch_free(prefilter_scratch_t * scratch);
+int prefilter_scan(const prefilter_t * pf, prefilter_scratch_t * scratch, const char * url, size_t len, const int ** candidates);
+int prefilter_scan_unordered(const prefilter_t * pf, prefilter_scratch_t * scratch, const char * url, size_t len,
+        const int ** candidates);
+
+#endif /* ifndef _URL_PREFILTER_H_ */
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "url_queue.h"
+
+/* Rounds of pause, then of sched_yield(), before a waiter sleeps */
+#define URL_QUEUE_SPINS     64
+#define URL_QUEUE_YIELDS    64
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to create the queue
+ *
+ * @Param size - number of slots, a power of 2
+ *
+ * @Returns   queue, NULL on failure
+ */
+/* ----------------------------------------------------------------------------*/
+url_queue_t * url_queue_create(size_t size)
+{
+    url_queue_t *queue;
+    size_t i;
+
+    if (size < 2 || (size & (size - 1))) {
+        fprintf(stderr, "Queue size %zu is not a power of 2\n", size);
+        return NULL;
+    }
+
+    queue = aligned_alloc(CACHE_LINE_SIZE, sizeof(url_queue_t));
+    if (NULL == queue) {
+        return NULL;
+    }
+    queue->cells = aligned_alloc(CACHE_LINE_SIZE, size * sizeof(url_queue_cell_t));
+    if (NULL == queue->cells) {
+        free(queue);
+        return NULL;
+    }
+
+    for (i=0;i<size;i++) {
+        atomic_init(&queue->cells[i].seq, i);
+        queue->cells[i].data = NULL;
+    }
+    queue->mask = size - 1;
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    atomic_init(&queue->wake_seq, 0);
+    atomic_init(&queue->sleepers, 0);
+
+    return queue;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the queue
+ *
+ * @Param queue
+ */
+/* ----------------------------------------------------------------------------*/
+void url_queue_free(url_queue_t * queue)
+{
+    if (!queue) {
+        return;
+    }
+    free(queue->cells);
+    free(queue);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to wake all the waiters asleep on the queue, for a
+ * producer that set the done flag of url_queue_pop_wait()
+ *
+ * @Param queue
+ */
+/* ----------------------------------------------------------------------------*/
+void url_queue_wake(url_queue_t * queue)
+{
+    atomic_fetch_add(&queue->wake_seq, 1);
+    syscall(SYS_futex, &queue->wake_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to wake the sleepers after a push or a pop. sleepers
+ * is read with a read-modify-write, ordered with the one of
+ * url_queue_sleep(): either the sleeper sees the change or this sees the
+ * sleeper
+ *
+ * @Param queue
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void url_queue_wake_sleepers(url_queue_t * queue)
+{
+    if (atomic_fetch_add(&queue->sleepers, 0)) {
+        url_queue_wake(queue);
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add data at the tail of the queue. The producer
+ * claims a slot by moving enqueue_pos with a CAS, then publishes the data
+ * by moving the slot seq.
+ *
+ * @Param queue
+ * @Param data
+ *
+ * @Returns   false if the queue is full
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_queue_push(url_queue_t * queue, void * data)
+{
+    url_queue_cell_t *cell;
+    size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    intptr_t diff;
+
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        diff = (intptr_t)atomic_load_explicit(&cell->seq, memory_order_acquire) - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->data = data;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    url_queue_wake_sleepers(queue);
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to take data from the head of the queue
+ *
+ * @Param queue
+ * @Param data
+ *
+ * @Returns   false if the queue is empty
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_queue_pop(url_queue_t * queue, void ** data)
+{
+    url_queue_cell_t *cell;
+    size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    intptr_t diff;
+
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        diff = (intptr_t)atomic_load_explicit(&cell->seq, memory_order_acquire) - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    *data = cell->data;
+    /* slot is free again for the producer of the next lap */
+    atomic_store_explicit(&cell->seq, pos + queue->mask + 1, memory_order_release);
+    url_queue_wake_sleepers(queue);
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to back off while the queue is full or empty: spin for
+ * a while, then give the CPU away
+ *
+ * @Param spins
+ *
+ * @Returns   false once the waiter should sleep instead
+ */
+/* ----------------------------------------------------------------------------*/
+static inline bool url_queue_backoff(int * spins)
+{
+    if (++*spins < URL_QUEUE_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else if (*spins < URL_QUEUE_SPINS + URL_QUEUE_YIELDS) {
+        sched_yield();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to sleep until a push or a pop moves wake_seq. The
+ * waiter counts itself in sleepers before it tries again, so a change made
+ * after the try wakes it, one made before is seen by the try.
+ *
+ * @Param queue
+ * @Param ready - tries the operation once, true when done
+ * @Param arg - of ready
+ *
+ * @Returns   true when ready succeeded, false on a wake up
+ */
+/* ----------------------------------------------------------------------------*/
+static bool url_queue_sleep(url_queue_t * queue, bool (*ready)(url_queue_t *, void *), void * arg)
+{
+    unsigned int seq = atomic_load(&queue->wake_seq);
+    bool ok;
+
+    atomic_fetch_add(&queue->sleepers, 1);
+    ok = ready(queue, arg);
+    if (!ok) {
+        syscall(SYS_futex, &queue->wake_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+    }
+    atomic_fetch_sub(&queue->sleepers, 1);
+    return ok;
+}
+
+/* url_queue_sleep() tries of the waits */
+typedef struct _url_queue_try_t {
+    void *data;
+    void **out;
+    const atomic_bool *done;
+    bool end;
+} url_queue_try_t;
+
+static bool url_queue_try_push(url_queue_t * queue, void * arg)
+{
+    url_queue_try_t *t = arg;
+
+    return url_queue_push(queue, t->data);
+}
+
+static bool url_queue_try_pop(url_queue_t * queue, void * arg)
+{
+    url_queue_try_t *t = arg;
+
+    if (url_queue_pop(queue, t->out)) {
+        return true;
+    }
+    t->end = t->done && atomic_load_explicit(t->done, memory_order_acquire);
+    return t->end;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add data, waiting while the queue is full
+ *
+ * @Param queue
+ * @Param data
+ */
+/* ----------------------------------------------------------------------------*/
+void url_queue_push_wait(url_queue_t * queue, void * data)
+{
+    url_queue_try_t t = { data, NULL, NULL, false };
+    int spins = 0;
+
+    while (!url_queue_push(queue, data)) {
+        if (!url_queue_backoff(&spins) && url_queue_sleep(queue, url_queue_try_push, &t)) {
+            return;
+        }
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to take data, waiting while the queue is empty. Once
+ * done is set no more data is added, the queue is checked one last time.
+ * The producer calls url_queue_wake() after it sets done.
+ *
+ * @Param queue
+ * @Param data
+ * @Param done - set by the producer after its last push
+ *
+ * @Returns   false when the queue is drained and done
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_queue_pop_wait(url_queue_t * queue, void ** data, const atomic_bool * done)
+{
+    url_queue_try_t t = { NULL, data, done, false };
+    int spins = 0;
+
+    while (!url_queue_pop(queue, data)) {
+        if (done && atomic_load_explicit(done, memory_order_acquire)) {
+            return url_queue_pop(queue, data);
+        }
+        if (!url_queue_backoff(&spins) && url_queue_sleep(queue, url_queue_try_pop, &t)) {
+            return t.end ? url_queue_pop(queue, data) : true;
+        }
+    }
+    return true;
+}
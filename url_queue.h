@@ -0,0 +1,67 @@
+#ifndef _URL_QUEUE_H_
+#define _URL_QUEUE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "url_output.h"
+
+#define CACHE_LINE_SIZE 64
+/* URLs moved per queue operation */
+#define URL_BATCH_SIZE  64
+/* Bytes of URL data after which a batch is handed over */
+#define URL_BATCH_BYTES (16 * 1024)
+
+/*! \struct _url_batch_t
+ *  Batch of URLs handed from the file reader to the workers. The lines are
+ *  packed one after another in data, the i-th line is url_len[i] bytes at
+ *  url_off[i]. data grows when a line does not fit.
+ *  seq - input order of the batch
+ *  out - match results of the batch, formatted by the worker
+ */
+typedef struct _url_batch_t {
+    long seq;
+    int count;
+    size_t used;
+    size_t size;
+    char *data;
+    size_t url_off[URL_BATCH_SIZE];
+    size_t url_len[URL_BATCH_SIZE];
+    out_buf_t out;
+} url_batch_t;
+
+/*! \struct _url_queue_cell_t
+ *  Slot of the ring buffer, seq tells whether the slot is free for the
+ *  producer of lap seq or filled for the consumer of lap seq+1
+ */
+typedef struct _url_queue_cell_t {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t seq;
+    void *data;
+} url_queue_cell_t;
+
+/*! \struct _url_queue_t
+ *  Bounded lock-free multi producer multi consumer FIFO queue.
+ *  enqueue_pos and dequeue_pos are on their own cache lines so that the
+ *  producers and the consumers do not share a line.
+ *  wake_seq - futex word a waiter past its spins sleeps on, moved by a push
+ *             or a pop that finds sleepers
+ *  sleepers - waiters asleep or about to be
+ */
+typedef struct _url_queue_t {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_pos;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_pos;
+    _Alignas(CACHE_LINE_SIZE) atomic_uint wake_seq;
+    atomic_int sleepers;
+    _Alignas(CACHE_LINE_SIZE) size_t mask;
+    url_queue_cell_t *cells;
+} url_queue_t;
+
+url_queue_t * url_queue_create(size_t size);
+void url_queue_free(url_queue_t * queue);
+bool url_queue_push(url_queue_t * queue, void * data);
+bool url_queue_pop(url_queue_t * queue, void ** data);
+void url_queue_push_wait(url_queue_t * queue, void * data);
+bool url_queue_pop_wait(url_queue_t * queue, void ** data, const atomic_bool * done);
+void url_queue_wake(url_queue_t * queue);
+
+#endif /* ifndef _URL_QUEUE_H_ */
@@ -0,0 +1,878 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "url_engine.h"
+#include "url_serve.h"
+#include "url_queue.h"
+#include "url_cache.h"
+
+typedef struct _serve_request_t serve_request_t;
+
+/*! \struct _serve_conn_t
+ *  Client connection of the server
+ *  in - bytes read, the requests not yet handed to the workers start at
+ *  in_off
+ *  out - responses not yet sent, they start at out_off
+ *  head, tail - requests in flight in request order, a response is sent
+ *  once the ones before it are
+ *  eof - the client sent its last request, the connection closes once
+ *  every response is sent
+ *  fd - -1 once closed, it is freed when no request is left in flight
+ */
+typedef struct _serve_conn_t {
+    int fd;
+    int slot;
+    uint32_t events;
+    char *in;
+    size_t in_off;
+    size_t in_len;
+    size_t in_size;
+    out_buf_t out;
+    size_t out_off;
+    serve_request_t *head;
+    serve_request_t *tail;
+    int pending;
+    bool stalled;
+    bool eof;
+    struct _serve_conn_t *next_closed;
+} serve_conn_t;
+
+/*! \struct _serve_request_t
+ *  One request frame, matched by a worker as a whole
+ *  data - the frame after its length, len bytes
+ *  out - response frame formatted by the worker
+ */
+struct _serve_request_t {
+    serve_conn_t *conn;
+    char *data;
+    uint32_t len;
+    out_buf_t out;
+    bool done;
+    serve_request_t *next;
+};
+
+/*! \struct _serve_worker_t
+ *  Worker of the pool, shared by every connection
+ */
+typedef struct _serve_worker_t {
+    pthread_t thread_id;
+    int reader;
+    url_engine_scratch_t *scratch;
+    url_cache_t *url_cache;
+} serve_worker_t;
+
+static const url_serve_config_t *serve_config;
+static url_queue_t *serve_work_queue, *serve_done_queue;
+/* posted once per request in the work queue, the idle workers sleep on it */
+static sem_t serve_work_sem;
+/* written by the workers when a request is done and by url_serve_stop() */
+static int serve_event_fd = -1;
+static int serve_epoll_fd = -1;
+static atomic_bool serve_exit = false;
+static serve_conn_t **serve_conns;
+static int serve_num_conns, serve_max_conns;
+static serve_conn_t *serve_closed;
+static int serve_in_flight;
+static bool serve_any_stalled;
+/* epoll data of the listening socket and of the event fd */
+static char serve_listen_tag, serve_event_tag;
+
+/*
+ ----------------------------------------------------------------------------
+|                                                                           |
+|                               WORKERS                                     |
+|                                                                           |
+|---------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to check that the urls of a request add up to its
+ * length, the workers then read it without checking
+ *
+ * @Param data
+ * @Param len
+ *
+ * @Returns   false on a malformed request
+ */
+/* ----------------------------------------------------------------------------*/
+static bool serve_check_request(const char * data, uint32_t len)
+{
+    uint32_t num_urls, url_len, off = 4, i;
+
+    if (len < 4) {
+        return false;
+    }
+    num_urls = url_serve_get_u32(data);
+    for (i=0;i<num_urls;i++) {
+        if (len - off < 4) {
+            return false;
+        }
+        url_len = url_serve_get_u32(data + off);
+        off += 4;
+        if (len - off < url_len) {
+            return false;
+        }
+        off += url_len;
+    }
+    return off == len;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to match the urls of a request and format the response
+ * frame. The whole request is matched with the ruleset current when it
+ * started.
+ *
+ * @Param worker
+ * @Param req
+ */
+/* ----------------------------------------------------------------------------*/
+static void serve_match_request(serve_worker_t * worker, serve_request_t * req)
+{
+    const url_engine_t *rs;
+    const char *p = req->data + 4, *url, *pattern;
+    const int *ids;
+    uint32_t num_urls = url_serve_get_u32(req->data), url_len, i;
+    int j, num_ids, key, pattern_len;
+    unsigned long long hash = 0;
+    bool ok;
+
+    req->out.len = 0;
+    ok = url_serve_append_u32(&req->out, 0) && url_serve_append_u32(&req->out, num_urls);
+
+    epoch_enter(serve_config->epoch, worker->reader);
+    rs = atomic_load(serve_config->ruleset);
+    for (i=0; ok && i<num_urls; i++) {
+        url_len = url_serve_get_u32(p);
+        url = p + 4;
+        p = url + url_len;
+
+        num_ids = -1;
+        if (worker->url_cache) {
+            hash = url_cache_hash(url, url_len);
+            num_ids = url_cache_lookup(worker->url_cache, url_engine_generation(rs), url, url_len, hash, &ids);
+        }
+        if (num_ids < 0) {
+            num_ids = url_engine_match_ids(rs, worker->scratch, url, url_len, &ids);
+            if (num_ids < 0) {
+                fprintf(stderr, "URL match failed, worker %d\n", worker->reader);
+                exit(1);
+            }
+            if (worker->url_cache) {
+                url_cache_insert(worker->url_cache, url_engine_generation(rs), url, url_len, hash, ids, num_ids);
+            }
+        }
+
+        ok = url_serve_append_u32(&req->out, num_ids);
+        for (j=0; ok && j<num_ids; j++) {
+            pattern = url_engine_pattern(rs, ids[j], &key, &pattern_len);
+            ok = url_serve_append_u32(&req->out, key) && url_serve_append_u32(&req->out, pattern_len) &&
+                out_buf_append(&req->out, pattern, pattern_len);
+        }
+    }
+    epoch_exit(serve_config->epoch, worker->reader);
+
+    if (!ok) {
+        fprintf(stderr, "Output buffer allocation failed\n");
+        exit(1);
+    }
+    /* frame length goes in front once known */
+    num_urls = htonl(req->out.len - 4);
+    memcpy(req->out.data, &num_urls, 4);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  worker thread of the server. It sleeps till a request is in the
+ * work queue, matches it and hands it back to the event loop through the
+ * done queue and the event fd.
+ *
+ * @Param arg
+ *
+ * @Returns
+ */
+/* ----------------------------------------------------------------------------*/
+static void *serve_worker_thread(void * arg)
+{
+    serve_worker_t *worker = arg;
+    uint64_t one = 1;
+    void *data;
+
+    for (;;) {
+        while (sem_wait(&serve_work_sem) && EINTR == errno);
+        if (atomic_load(&serve_exit)) {
+            break;
+        }
+        if (!url_queue_pop(serve_work_queue, &data)) {
+            continue;
+        }
+        serve_match_request(worker, data);
+        /* never full, it holds every request in flight */
+        url_queue_push_wait(serve_done_queue, data);
+        while (write(serve_event_fd, &one, sizeof(one)) < 0 && EINTR == errno);
+    }
+
+    pthread_exit(0);
+}
+
+/*
+ ----------------------------------------------------------------------------
+|                                                                           |
+|                               CONNECTIONS                                 |
+|                                                                           |
+|---------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free a request
+ *
+ * @Param req
+ */
+/* ----------------------------------------------------------------------------*/
+static void serve_request_free(serve_request_t * req)
+{
+    free(req->data);
+    out_buf_free(&req->out);
+    free(req);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to close a connection. Its requests in flight are
+ * dropped when done, the connection is freed after the last one.
+ *
+ * @Param conn
+ */
+/* ----------------------------------------------------------------------------*/
+static void serve_close(serve_conn_t * conn)
+{
+    if (conn->fd < 0) {
+        return;
+    }
+    TM_PRINTF(serve_config->debug, "Close connection fd %d\n", conn->fd);
+    close(conn->fd);
+    conn->fd = -1;
+    serve_conns[conn->slot] = serve_conns[--serve_num_conns];
+    serve_conns[conn->slot]->slot = conn->slot;
+    conn->next_closed = serve_closed;
+    serve_closed = conn;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the closed connections without a request in
+ * flight, called between two rounds of events
+ */
+/* ----------------------------------------------------------------------------*/
+static void serve_free_closed()
+{
+    serve_conn_t **pos = &serve_closed, *conn;
+
+    while ((conn = *pos)) {
+        if (conn->pending) {
+            pos = &conn->next_closed;
+            continue;
+        }
+        *pos = conn->next_closed;
+        free(conn->in);
+        out_buf_free(&conn->out);
+        free(conn);
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to set the events the connection waits for: more
+ * requests unless it waits for room, and room to send when a response is
+ * left. A connection with nothing more to do is closed.
+ *
+ * @Param conn
+ */
+/* ----------------------------------------------------------------------------*/
+static void serve_update_events(serve_conn_t * conn)
+{
+    struct epoll_event ev;
+    uint32_t events = 0;
+
+    if (conn->fd < 0) {
+        return;
+    }
+    if (conn->eof && !conn->pending && !conn->stalled && conn->out_off == conn->out.len) {
+        serve_close(conn);
+        return;
+    }
+    if (!conn->stalled && !conn->eof) {
+        events |= EPOLLIN;
+    }
+    if (conn->out_off < conn->out.len) {
+        events |= EPOLLOUT;
+    }
+    if (events != conn->events) {
+        ev.events = events;
+        ev.data.ptr = conn;
+        if (epoll_ctl(serve_epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) < 0) {
+            perror("epoll_ctl");
+            serve_close(conn);
+            return;
+        }
+        conn->events = events;
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to send the responses of a connection, as much as the
+ * socket takes without waiting
+ *
+ * @Param conn
+ */
+/* ----------------------------------------------------------------------------*/
+static void serve_write(serve_conn_t * conn)
+{
+    ssize_t n;
+
+    while (conn->fd >= 0 && conn->out_off < conn->out.len) {
+        n = send(conn->fd, conn->out.data + conn->out_off, conn->out.len - conn->out_off, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->out_off += n;
+        } else if (n < 0 && EINTR == errno) {
+            continue;
+        } else if (n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+            break;
+        } else {
+            serve_close(conn);
+            return;
+        }
+    }
+    if (conn->out_off == conn->out.len) {
+        conn->out.len = conn->out_off = 0;
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to hand the complete requests read on a connection to
+ * the workers. When URL_SERVE_MAX_REQUESTS are in flight, or the client
+ * doesn't read its responses, the connection stalls: it is not read till
+ * some requests are done.
+ *
+ * @Param conn
+ */
+/* ----------------------------------------------------------------------------*/
+static void serve_dispatch(serve_conn_t * conn)
+{
+    serve_request_t *req;
+    uint32_t len;
+    size_t size;
+    char *in;
+
+    conn->stalled = false;
+    while (conn->fd >= 0 && conn->in_len - conn->in_off >= 4) {
+        len = url_serve_get_u32(conn->in + conn->in_off);
+        if (len > URL_SERVE_MAX_FRAME) {
+            fprintf(stderr, "Request of %u bytes, closing the connection\n", len);
+            serve_close(conn);
+            return;
+        }
+        if (conn->in_len - conn->in_off - 4 < len) {
+            /* room for the whole request */
+            if (conn->in_off) {
+                memmove(conn->in, conn->in + conn->in_off, conn->in_len - conn->in_off);
+                conn->in_len -= conn->in_off;
+                conn->in_off = 0;
+            }
+            if (conn->in_size < (size_t)len + 4) {
+                for (size = conn->in_size; size < (size_t)len + 4; size *= 2);
+                if (NULL == (in = realloc(conn->in, size))) {
+                    fprintf(stderr, "Request buffer allocation failed\n");
+                    serve_close(conn);
+                    return;
+                }
+                conn->in = in;
+                conn->in_size = size;
+            }
+            break;
+        }
+        if (URL_SERVE_MAX_REQUESTS == serve_in_flight || conn->out.len - conn->out_off > URL_SERVE_MAX_OUTPUT) {
+            conn->stalled = serve_any_stalled = true;
+            break;
+        }
+        if (!serve_check_request(conn->in + conn->in_off + 4, len)) {
+            fprintf(stderr, "Malformed request, closing the connection\n");
+            serve_close(conn);
+            return;
+        }
+
+        req = calloc(1, sizeof(serve_request_t));
+        if (req) {
+            /* NUL after the last url, as the urls of the file mode have */
+            req->data = malloc(len + 1);
+        }
+        if (!req || !req->data) {
+            fprintf(stderr, "Request allocation failed\n");
+            if (req) {
+                free(req);
+            }
+            serve_close(conn);
+            return;
+        }
+        memcpy(req->data, conn->in + conn->in_off + 4, len);
+        req->data[len] = '\0';
+        req->len = len;
+        req->conn = conn;
+        conn->in_off += 4 + len;
+
+        if (conn->tail) {
+            conn->tail->next = req;
+        } else {
+            conn->head = req;
+        }
+        conn->tail = req;
+        conn->pending++;
+        serve_in_flight++;
+        url_queue_push(serve_work_queue, req);
+        sem_post(&serve_work_sem);
+    }
+
+    if (conn->in_off == conn->in_len) {
+        conn->in_off = conn->in_len = 0;
+    }
+    serve_update_events(conn);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to read the requests of a connection
+ *
+ * @Param conn
+ */
+/* ----------------------------------------------------------------------------*/
+static void serve_read(serve_conn_t * conn)
+{
+    ssize_t n;
+
+    if (conn->in_len == conn->in_size && conn->in_off) {
+        memmove(conn->in, conn->in + conn->in_off, conn->in_len - conn->in_off);
+        conn->in_len -= conn->in_off;
+        conn->in_off = 0;
+    }
+    if (conn->in_len == conn->in_size) {
+        serve_dispatch(conn);
+        return;
+    }
+    do {
+        n = read(conn->fd, conn->in + conn->in_len, conn->in_size - conn->in_len);
+    } while (n < 0 && EINTR == errno);
+
+    if (n > 0) {
+        conn->in_len += n;
+    } else if (0 == n) {
+        conn->eof = true;
+    } else if (EAGAIN != errno && EWOULDBLOCK != errno) {
+        serve_close(conn);
+        return;
+    }
+    serve_dispatch(conn);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to accept the waiting connections
+ *
+ * @Param listen_fd
+ */
+/* ----------------------------------------------------------------------------*/
+static void serve_accept(int listen_fd)
+{
+    struct epoll_event ev;
+    serve_conn_t *conn, **conns;
+    int fd, max_conns;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+            close(fd);
+            continue;
+        }
+        if (serve_num_conns == serve_max_conns) {
+            max_conns = serve_max_conns ? 2 * serve_max_conns : 64;
+            conns = realloc(serve_conns, max_conns * sizeof(serve_conn_t *));
+            if (NULL == conns) {
+                close(fd);
+                continue;
+            }
+            serve_conns = conns;
+            serve_max_conns = max_conns;
+        }
+        conn = calloc(1, sizeof(serve_conn_t));
+        if (conn) {
+            conn->in_size = 64 * 1024;
+            conn->in = malloc(conn->in_size);
+        }
+        if (!conn || !conn->in) {
+            fprintf(stderr, "Connection allocation failed\n");
+            if (conn) {
+                free(conn);
+            }
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(serve_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            free(conn->in);
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->slot = serve_num_conns;
+        serve_conns[serve_num_conns++] = conn;
+        TM_PRINTF(serve_config->debug, "New connection fd %d\n", fd);
+    }
+    if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) {
+        perror("accept");
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to take the requests done by the workers. A response
+ * is queued on its connection once the requests before it are, then the
+ * stalled connections get another go.
+ */
+/* ----------------------------------------------------------------------------*/
+static void serve_complete()
+{
+    serve_request_t *req;
+    serve_conn_t *conn;
+    void *data;
+    int i;
+
+    while (url_queue_pop(serve_done_queue, &data)) {
+        req = data;
+        req->done = true;
+        serve_in_flight--;
+        conn = req->conn;
+
+        while ((req = conn->head) && req->done) {
+            conn->head = req->next;
+            if (NULL == conn->head) {
+                conn->tail = NULL;
+            }
+            conn->pending--;
+            if (conn->fd >= 0 && !out_buf_append(&conn->out, req->out.data, req->out.len)) {
+                fprintf(stderr, "Output buffer allocation failed\n");
+                serve_close(conn);
+            }
+            serve_request_free(req);
+        }
+        if (conn->fd >= 0) {
+            serve_write(conn);
+            serve_update_events(conn);
+        }
+    }
+
+    if (serve_any_stalled) {
+        serve_any_stalled = false;
+        for (i = serve_num_conns - 1; i >= 0; i--) {
+            if (serve_conns[i]->stalled) {
+                serve_dispatch(serve_conns[i]);
+            }
+        }
+    }
+}
+
+/*
+ ----------------------------------------------------------------------------
+|                                                                           |
+|                               SERVER                                      |
+|                                                                           |
+|---------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to connect to a url-engine serve socket
+ *
+ * @Param socket_path
+ *
+ * @Returns   connected socket, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+int url_serve_connect(const char * socket_path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long %s\n", socket_path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to listen on the socket path. A socket file left by a
+ * server that is gone is replaced, a live server is not.
+ *
+ * @Param socket_path
+ *
+ * @Returns   listening socket, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static int serve_listen(const char * socket_path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd, live;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long %s\n", socket_path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        if (EADDRINUSE != errno || stat(socket_path, &st) || !S_ISSOCK(st.st_mode)) {
+            perror("bind");
+            close(fd);
+            return -1;
+        }
+        live = url_serve_connect(socket_path);
+        if (live >= 0) {
+            close(live);
+            fprintf(stderr, "%s is served by another url-engine\n", socket_path);
+            close(fd);
+            return -1;
+        }
+        unlink(socket_path);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror("bind");
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to stop url_serve_run(), async signal safe
+ */
+/* ----------------------------------------------------------------------------*/
+void url_serve_stop()
+{
+    uint64_t one = 1;
+    ssize_t n;
+
+    atomic_store(&serve_exit, true);
+    if (serve_event_fd >= 0) {
+        n = write(serve_event_fd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to serve match requests on a Unix domain socket till
+ * url_serve_stop(). The calling thread runs the epoll event loop: it
+ * accepts the connections, reads the requests, hands them to the pool of
+ * workers and sends the responses back. The workers are shared by every
+ * connection. A reload swapping config->ruleset doesn't touch the
+ * connections, a request is matched with the ruleset current when it
+ * started.
+ *
+ * @Param config
+ *
+ * @Returns   false on failure to set up
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_serve_run(const url_serve_config_t * config)
+{
+    struct epoll_event ev, events[URL_SERVE_MAX_EVENTS];
+    serve_worker_t *workers;
+    serve_request_t *req;
+    serve_conn_t *conn;
+    uint64_t count;
+    void *data;
+    int listen_fd, i, n, num_workers = 0;
+    bool ok = false, sem_ok = false;
+
+    serve_config = config;
+    atomic_store(&serve_exit, false);
+    workers = calloc(config->num_threads, sizeof(serve_worker_t));
+    serve_work_queue = url_queue_create(URL_SERVE_MAX_REQUESTS);
+    serve_done_queue = url_queue_create(URL_SERVE_MAX_REQUESTS);
+    serve_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    serve_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    listen_fd = serve_listen(config->socket_path);
+    if (!workers || !serve_work_queue || !serve_done_queue || serve_event_fd < 0 ||
+            serve_epoll_fd < 0 || listen_fd < 0 || !(sem_ok = !sem_init(&serve_work_sem, 0, 0))) {
+        fprintf(stderr, "Could not set up the server\n");
+        goto out;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &serve_listen_tag;
+    ok = (0 == epoll_ctl(serve_epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev));
+    ev.data.ptr = &serve_event_tag;
+    ok = ok && (0 == epoll_ctl(serve_epoll_fd, EPOLL_CTL_ADD, serve_event_fd, &ev));
+
+    for (i = 0; ok && i < config->num_threads; i++) {
+        workers[i].reader = i;
+        workers[i].scratch = url_engine_scratch_create(config->algo);
+        workers[i].url_cache = config->url_cache_bytes ?
+            url_cache_create(config->url_cache_bytes / config->num_threads) : NULL;
+        if (!workers[i].scratch || (config->url_cache_bytes && !workers[i].url_cache)) {
+            fprintf(stderr,"calloc error\n");
+            ok = false;
+            break;
+        }
+        url_engine_scratch_set_mode(workers[i].scratch, config->mode);
+        url_engine_scratch_set_normalize(workers[i].scratch, config->normalize);
+        url_engine_scratch_set_debug(workers[i].scratch, config->debug);
+        if (pthread_create(&workers[i].thread_id, NULL, serve_worker_thread, &workers[i]) != 0) {
+            fprintf(stderr, "pthread_create failed!\n");
+            ok = false;
+            break;
+        }
+        num_workers++;
+    }
+
+    if (ok) {
+        fprintf(stderr, "Serving %s with %d threads\n", config->socket_path, config->num_threads);
+    }
+    while (ok && !atomic_load(&serve_exit)) {
+        n = epoll_wait(serve_epoll_fd, events, URL_SERVE_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            perror("epoll_wait");
+            ok = false;
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (&serve_listen_tag == events[i].data.ptr) {
+                serve_accept(listen_fd);
+            } else if (&serve_event_tag == events[i].data.ptr) {
+                while (read(serve_event_fd, &count, sizeof(count)) < 0 && EINTR == errno);
+                serve_complete();
+            } else {
+                conn = events[i].data.ptr;
+                /* the client is gone, its responses can't be sent */
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    serve_close(conn);
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    serve_write(conn);
+                    if (conn->stalled) {
+                        serve_dispatch(conn);
+                    } else {
+                        serve_update_events(conn);
+                    }
+                }
+                if (conn->fd >= 0 && (events[i].events & EPOLLIN)) {
+                    serve_read(conn);
+                }
+            }
+        }
+        serve_free_closed();
+    }
+
+out:
+    /* the workers leave with the requests still queued */
+    atomic_store(&serve_exit, true);
+    for (i = 0; i < num_workers; i++) {
+        sem_post(&serve_work_sem);
+    }
+    for (i = 0; i < num_workers; i++) {
+        pthread_join(workers[i].thread_id, NULL);
+    }
+    if (workers) {
+        for (i = 0; i < config->num_threads; i++) {
+            url_engine_scratch_free(workers[i].scratch);
+            url_cache_free(workers[i].url_cache);
+        }
+        free(workers);
+    }
+    while (serve_num_conns) {
+        serve_close(serve_conns[0]);
+    }
+    for (conn = serve_closed; conn; conn = conn->next_closed) {
+        while ((req = conn->head)) {
+            conn->head = req->next;
+            serve_request_free(req);
+        }
+        conn->pending = 0;
+    }
+    serve_free_closed();
+    free(serve_conns);
+    serve_conns = NULL;
+    serve_num_conns = serve_max_conns = 0;
+    serve_in_flight = 0;
+
+    if (serve_work_queue) {
+        while (url_queue_pop(serve_work_queue, &data));
+        url_queue_free(serve_work_queue);
+    }
+    if (serve_done_queue) {
+        url_queue_free(serve_done_queue);
+    }
+    serve_work_queue = serve_done_queue = NULL;
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(config->socket_path);
+    }
+    if (serve_epoll_fd >= 0) {
+        close(serve_epoll_fd);
+    }
+    if (serve_event_fd >= 0) {
+        close(serve_event_fd);
+    }
+    serve_epoll_fd = serve_event_fd = -1;
+    if (sem_ok) {
+        sem_destroy(&serve_work_sem);
+    }
+    return ok;
+}
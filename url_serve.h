@@ -0,0 +1,92 @@
+#ifndef _URL_SERVE_H_
+#define _URL_SERVE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include "url_lib.h"
+#include "url_epoch.h"
+#include "url_output.h"
+
+/*
+ * Protocol of url-engine serve on its Unix domain socket. Every number is
+ * 32 bits in network byte order. A client may send more requests before
+ * reading, the responses come back in request order.
+ *
+ * request:  frame length (bytes after it), number of urls,
+ *           then per url: url length, url
+ * response: frame length, number of urls,
+ *           then per url: number of matches,
+ *           then per match: set id, pattern length, pattern
+ *
+ * The matches are the ones of the match mode the server runs with. A
+ * request longer than URL_SERVE_MAX_FRAME or whose urls don't add up to its
+ * length closes the connection.
+ */
+#define URL_SERVE_MAX_FRAME     (16 * 1024 * 1024)
+/* Requests matched or waiting for a worker at a time, power of 2 */
+#define URL_SERVE_MAX_REQUESTS  1024
+/* Responses held for a slow client before its next requests wait */
+#define URL_SERVE_MAX_OUTPUT    (4 * 1024 * 1024)
+#define URL_SERVE_MAX_EVENTS    64
+
+/*! \struct _url_serve_config_t
+ *  What url_serve_run() serves with
+ *  ruleset - current ruleset, swapped by the reload of the caller
+ *  epoch - num_threads readers, one per worker
+ *  normalize - URL_NORMALIZE_* of the urls before the match
+ *  debug - print the connections and the result of each pattern verified
+ */
+typedef struct _url_serve_config_t {
+    const char *socket_path;
+    MATCH_TYPE algo;
+    MATCH_MODE mode;
+    int normalize;
+    int num_threads;
+    size_t url_cache_bytes;
+    _Atomic(url_engine_t *) *ruleset;
+    epoch_t *epoch;
+    bool debug;
+} url_serve_config_t;
+
+bool url_serve_run(const url_serve_config_t * config);
+void url_serve_stop();
+int url_serve_connect(const char * socket_path);
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add a protocol number to a frame
+ *
+ * @Param out
+ * @Param value
+ *
+ * @Returns   false on allocation failure
+ */
+/* ----------------------------------------------------------------------------*/
+static inline bool url_serve_append_u32(out_buf_t * out, uint32_t value)
+{
+    value = htonl(value);
+    return out_buf_append(out, (const char *)&value, sizeof(value));
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to read a protocol number of a frame
+ *
+ * @Param p - not aligned
+ *
+ * @Returns   value
+ */
+/* ----------------------------------------------------------------------------*/
+static inline uint32_t url_serve_get_u32(const char * p)
+{
+    uint32_t value;
+
+    memcpy(&value, p, sizeof(value));
+    return ntohl(value);
+}
+
+#endif /* ifndef _URL_SERVE_H_ */
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "url_simd.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define URL_SIMD_X86
+#endif
+
+static const char * find_select(const char * text, size_t text_len, const char * literal, size_t literal_len);
+
+_Atomic(url_find_fn) url_find_kernel = find_select;
+
+/*-----------------------------------------------------------------------------
+ |                          KERNELS                                         |
+ |                                                                          |
+ | All find the first place of a literal of at least 2 bytes, not longer    |
+ | than the text. The vector ones compare the first and the last byte of    |
+ | the literal at every place of a block of the text at once, only the      |
+ | places where both are equal are compared in full.                        |
+ |--------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Scalar kernel, also the tail of the vector ones: memchr to the
+ * next first byte, then the last byte, then the rest.
+ *
+ * @Param text
+ * @Param text_len
+ * @Param literal
+ * @Param literal_len
+ *
+ * @Returns   first byte of the literal in the text, NULL when not found
+ */
+/* ----------------------------------------------------------------------------*/
+static const char * find_scalar(const char * text, size_t text_len, const char * literal, size_t literal_len)
+{
+    const char *p = text, *last = text + text_len - literal_len;
+
+    while (p <= last && (p = memchr(p, literal[0], last - p + 1))) {
+        if (p[literal_len - 1] == literal[literal_len - 1] &&
+                !memcmp(p + 1, literal + 1, literal_len - 2)) {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+#ifdef URL_SIMD_X86
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  SSE2 kernel, 16 places a step
+ *
+ * @Param text
+ * @Param text_len
+ * @Param literal
+ * @Param literal_len
+ *
+ * @Returns   first byte of the literal in the text, NULL when not found
+ */
+/* ----------------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static const char * find_sse2(const char * text, size_t text_len, const char * literal, size_t literal_len)
+{
+    const __m128i first = _mm_set1_epi8(literal[0]);
+    const __m128i last = _mm_set1_epi8(literal[literal_len - 1]);
+    unsigned int mask;
+    size_t i;
+
+    for (i = 0; i + literal_len - 1 + 16 <= text_len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(text + i + literal_len - 1));
+
+        mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                    _mm_cmpeq_epi8(last, block_last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+
+            if (!memcmp(text + i + bit + 1, literal + 1, literal_len - 2)) {
+                return text + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return i + literal_len <= text_len ? find_scalar(text + i, text_len - i, literal, literal_len) : NULL;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  AVX2 kernel, 32 places a step
+ *
+ * @Param text
+ * @Param text_len
+ * @Param literal
+ * @Param literal_len
+ *
+ * @Returns   first byte of the literal in the text, NULL when not found
+ */
+/* ----------------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static const char * find_avx2(const char * text, size_t text_len, const char * literal, size_t literal_len)
+{
+    const __m256i first = _mm256_set1_epi8(literal[0]);
+    const __m256i last = _mm256_set1_epi8(literal[literal_len - 1]);
+    unsigned int mask;
+    size_t i;
+
+    for (i = 0; i + literal_len - 1 + 32 <= text_len; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(text + i + literal_len - 1));
+
+        mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                    _mm256_cmpeq_epi8(last, block_last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+
+            if (!memcmp(text + i + bit + 1, literal + 1, literal_len - 2)) {
+                return text + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    /* less than a block left, the sse2 kernel takes 16 of it */
+    return i + literal_len <= text_len ? find_sse2(text + i, text_len - i, literal, literal_len) : NULL;
+}
+
+#endif /* ifdef URL_SIMD_X86 */
+
+/*-----------------------------------------------------------------------------
+ |                          SELECTION                                       |
+ |                                                                          |
+ |                                                                          |
+ |--------------------------------------------------------------------------|
+*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to pick the kernel of the cpu and URL_ENGINE_SIMD, the
+ * same every time it is called
+ *
+ * @Param name - set to the name of the kernel
+ *
+ * @Returns   kernel
+ */
+/* ----------------------------------------------------------------------------*/
+static url_find_fn find_pick(const char ** name)
+{
+    const char *wanted = getenv("URL_ENGINE_SIMD");
+    url_find_fn kernel = find_scalar;
+
+    *name = "scalar";
+#ifdef URL_SIMD_X86
+    __builtin_cpu_init();
+    if (wanted && !strcmp(wanted, "scalar")) {
+        return kernel;
+    }
+    if ((!wanted || !strcmp(wanted, "avx2")) && __builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        kernel = find_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        *name = "sse2";
+        kernel = find_sse2;
+    }
+#endif
+    return kernel;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Kernel of the first search of the process: picks the kernel
+ * the next searches go to directly. Threads racing here pick the same one.
+ *
+ * @Param text
+ * @Param text_len
+ * @Param literal
+ * @Param literal_len
+ *
+ * @Returns   first byte of the literal in the text, NULL when not found
+ */
+/* ----------------------------------------------------------------------------*/
+static const char * find_select(const char * text, size_t text_len, const char * literal, size_t literal_len)
+{
+    const char *name, *wanted = getenv("URL_ENGINE_SIMD");
+    url_find_fn kernel = find_pick(&name);
+
+    if (wanted && strcmp(wanted, name)) {
+        fprintf(stderr, "URL_ENGINE_SIMD=%s not available, using %s\n", wanted, name);
+    }
+    atomic_store_explicit(&url_find_kernel, kernel, memory_order_relaxed);
+    return kernel(text, text_len, literal, literal_len);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to give the kernel of the searches
+ *
+ * @Returns   avx2, sse2 or scalar
+ */
+/* ----------------------------------------------------------------------------*/
+const char * url_simd_name()
+{
+    const char *name;
+
+    find_pick(&name);
+    return name;
+}
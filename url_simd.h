@@ -0,0 +1,59 @@
+#ifndef _URL_SIMD_H_
+#define _URL_SIMD_H_
+
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+/*
+ * Literal search of the SELF matcher: the next place of a literal segment of
+ * a pattern in the url. The kernel is picked once, at the first search, from
+ * the cpu features: avx2, sse2 or scalar. URL_ENGINE_SIMD in the environment
+ * (avx2, sse2 or scalar) forces one, never one the cpu lacks.
+ */
+
+/* Shorter texts, past the length of the literal, are searched inline */
+#define URL_SIMD_MIN_TEXT   16
+
+typedef const char * (*url_find_fn)(const char * text, size_t text_len, const char * literal, size_t literal_len);
+
+extern _Atomic(url_find_fn) url_find_kernel;
+
+const char * url_simd_name();
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to find the first place of a literal in a text
+ *
+ * @Param text
+ * @Param text_len
+ * @Param literal
+ * @Param literal_len - at least 1
+ *
+ * @Returns   first byte of the literal in the text, NULL when not found
+ */
+/* ----------------------------------------------------------------------------*/
+static inline const char * url_find(const char * text, size_t text_len, const char * literal, size_t literal_len)
+{
+    if (literal_len > text_len) {
+        return NULL;
+    }
+    if (literal_len == 1) {
+        return memchr(text, literal[0], text_len);
+    }
+    if (text_len < URL_SIMD_MIN_TEXT + literal_len) {
+        /* no full block, the host of most urls */
+        const char *last = text + text_len - literal_len;
+
+        for (; text <= last; text++) {
+            if (text[0] == literal[0] && text[literal_len - 1] == literal[literal_len - 1] &&
+                    !memcmp(text + 1, literal + 1, literal_len - 2)) {
+                return text;
+            }
+        }
+        return NULL;
+    }
+    return atomic_load_explicit(&url_find_kernel, memory_order_relaxed)(text, text_len, literal, literal_len);
+}
+
+#endif /* ifndef _URL_SIMD_H_ */
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "url_stats.h"
+
+/*! \struct _stats_rank_t
+ *  Pattern ranked by its cycles for the top of the stats
+ */
+typedef struct _stats_rank_t {
+    unsigned long long cycles;
+    int id;
+} stats_rank_t;
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  qsort comparator, most cycles first then config order
+ *
+ * @Param a
+ * @Param b
+ *
+ * @Returns   order
+ */
+/* ----------------------------------------------------------------------------*/
+static int rank_compare(const void * a, const void * b)
+{
+    const stats_rank_t *x = a, *y = b;
+
+    if (x->cycles != y->cycles) {
+        return (x->cycles < y->cycles) ? 1 : -1;
+    }
+    return x->id - y->id;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write a JSON string
+ *
+ * @Param fp
+ * @Param str - not NUL terminated
+ * @Param len
+ */
+/* ----------------------------------------------------------------------------*/
+static void json_string(FILE * fp, const char * str, int len)
+{
+    int i;
+
+    fputc('"', fp);
+    for (i = 0; i < len; i++) {
+        if ('"' == str[i] || '\\' == str[i]) {
+            fputc('\\', fp);
+            fputc(str[i], fp);
+        } else if ((unsigned char)str[i] < 0x20) {
+            fprintf(fp, "\\u%04x", (unsigned char)str[i]);
+        } else {
+            fputc(str[i], fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to write the stats of a run as one JSON object: the
+ * stage times, the verifier totals and the top costliest patterns. The file
+ * is written aside and renamed over stats_file, a reader never sees half of
+ * it.
+ *
+ * @Param stats_file
+ * @Param rs - ruleset of the pattern stats
+ * @Param patterns - url_engine_num_patterns() entries
+ * @Param stages
+ * @Param algo - name
+ * @Param num_threads
+ * @Param top - patterns listed
+ *
+ * @Returns   false on failure
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_stats_write(const char * stats_file, const url_engine_t * rs,
+        const url_engine_pattern_stats_t * patterns, const stage_stats_t * stages,
+        const char * algo, int num_threads, int top)
+{
+    int i, n, id, key, len, num_patterns = url_engine_num_patterns(rs);
+    unsigned long long evaluations = 0, hits = 0, cycles = 0;
+    const char *pattern;
+    stats_rank_t *rank;
+    char *tmp_file;
+    FILE *fp;
+    bool ok;
+
+    rank = malloc((num_patterns ? num_patterns : 1) * sizeof(stats_rank_t));
+    tmp_file = malloc(strlen(stats_file) + 5);
+    if (!rank || !tmp_file) {
+        fprintf(stderr, "Stats allocation failed\n");
+        free(rank);
+        free(tmp_file);
+        return false;
+    }
+    for (id = n = 0; id < num_patterns; id++) {
+        evaluations += patterns[id].evaluations;
+        hits += patterns[id].hits;
+        cycles += patterns[id].cycles;
+        if (patterns[id].evaluations) {
+            rank[n].cycles = patterns[id].cycles;
+            rank[n++].id = id;
+        }
+    }
+    qsort(rank, n, sizeof(stats_rank_t), rank_compare);
+
+    sprintf(tmp_file, "%s.tmp", stats_file);
+    fp = fopen(tmp_file, "w");
+    if (NULL == fp) {
+        fprintf(stderr, "Could not open file %s\n", tmp_file);
+        free(rank);
+        free(tmp_file);
+        return false;
+    }
+    fprintf(fp, "{\"algo\": \"%s\", \"threads\": %d, \"generation\": %u,\n", algo, num_threads,
+            url_engine_generation(rs));
+    fprintf(fp, " \"stages_ns\": {\"read\": %llu, \"queue\": %llu, \"match\": %llu, \"output\": %llu},\n",
+            atomic_load(&stages->read_ns), atomic_load(&stages->queue_ns),
+            atomic_load(&stages->match_ns), atomic_load(&stages->output_ns));
+    fprintf(fp, " \"urls\": %llu,\n", atomic_load(&stages->urls));
+    fprintf(fp, " \"patterns\": {\"count\": %d, \"evaluated\": %d, \"evaluations\": %llu, \"hits\": %llu, \"cycles\": %llu},\n",
+            num_patterns, n, evaluations, hits, cycles);
+    fprintf(fp, " \"top\": [");
+    for (i = 0; i < n && i < top; i++) {
+        id = rank[i].id;
+        pattern = url_engine_pattern(rs, id, &key, &len);
+        fprintf(fp, "%s\n  {\"id\": %d, \"set\": %d, \"pattern\": ", i ? "," : "", id, key);
+        json_string(fp, pattern, len);
+        fprintf(fp, ", \"evaluations\": %llu, \"hits\": %llu, \"cycles\": %llu, \"cycles_per_evaluation\": %llu}",
+                patterns[id].evaluations, patterns[id].hits, patterns[id].cycles,
+                patterns[id].cycles / patterns[id].evaluations);
+    }
+    fprintf(fp, "%s]}\n", n ? "\n " : "");
+
+    ok = !ferror(fp);
+    ok = !fclose(fp) && ok;
+    if (ok && rename(tmp_file, stats_file)) {
+        fprintf(stderr, "Could not rename %s to %s\n", tmp_file, stats_file);
+        ok = false;
+    }
+    free(rank);
+    free(tmp_file);
+    return ok;
+}
@@ -0,0 +1,45 @@
+#ifndef _URL_STATS_H_
+#define _URL_STATS_H_
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "url_lib.h"
+
+/* Costliest patterns listed in the stats by default, "stats_top" option */
+#define URL_STATS_TOP   20
+
+/*! \struct _stage_stats_t
+ *  Time of the stages of the file mode, added to by every thread and read
+ *  while they run
+ *  read_ns - reading the url file into batches, mapping it
+ *  queue_ns - waiting on the batch queues
+ *  match_ns - matching, the url cache included
+ *  output_ns - formatting and writing the results
+ *  urls - urls matched
+ */
+typedef struct _stage_stats_t {
+    atomic_ullong read_ns;
+    atomic_ullong queue_ns;
+    atomic_ullong match_ns;
+    atomic_ullong output_ns;
+    atomic_ullong urls;
+} stage_stats_t;
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to add to a counter of the stage stats
+ *
+ * @Param counter
+ * @Param value
+ */
+/* ----------------------------------------------------------------------------*/
+static inline void stage_stats_add(atomic_ullong * counter, unsigned long long value)
+{
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+bool url_stats_write(const char * stats_file, const url_engine_t * engine,
+        const url_engine_pattern_stats_t * patterns, const stage_stats_t * stages,
+        const char * algo, int num_threads, int top);
+
+#endif /* ifndef _URL_STATS_H_ */
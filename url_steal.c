@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "url_steal.h"
+
+#define RANGE_LO(r)         ((long)((r) & 0xffffffffULL))
+#define RANGE_HI(r)         ((long)((r) >> 32))
+#define RANGE(lo, hi)       ((unsigned long long)(lo) | ((unsigned long long)(hi) << 32))
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to create the pool, worker w starts with the w-th
+ * slice of the tasks so that the workers begin far apart in the input
+ *
+ * @Param num_tasks - below 2^32
+ * @Param num_workers
+ *
+ * @Returns   pool, NULL on failure
+ */
+/* ----------------------------------------------------------------------------*/
+steal_pool_t * steal_pool_create(long num_tasks, int num_workers)
+{
+    steal_pool_t *pool;
+    int w;
+
+    if (num_tasks < 0 || num_tasks > 0xffffffffL || num_workers < 1) {
+        fprintf(stderr, "Can't share %ld tasks among %d workers\n", num_tasks, num_workers);
+        return NULL;
+    }
+    pool = calloc(1, sizeof(steal_pool_t));
+    if (NULL == pool) {
+        return NULL;
+    }
+    pool->ranges = aligned_alloc(CACHE_LINE_SIZE, num_workers * sizeof(steal_range_t));
+    if (NULL == pool->ranges) {
+        free(pool);
+        return NULL;
+    }
+    pool->num_workers = num_workers;
+    for (w = 0; w < num_workers; w++) {
+        atomic_init(&pool->ranges[w].range,
+                RANGE(num_tasks * w / num_workers, num_tasks * (w + 1) / num_workers));
+    }
+    return pool;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the pool
+ *
+ * @Param pool
+ */
+/* ----------------------------------------------------------------------------*/
+void steal_pool_free(steal_pool_t * pool)
+{
+    if (!pool) {
+        return;
+    }
+    free(pool->ranges);
+    free(pool);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to give a worker its next task: the first one left in
+ * its own range, else it steals the upper half of the largest range left,
+ * runs the first task of it and keeps the rest as its own range.
+ * Only the owner stores into an empty range, a thief never touches one, so
+ * a range word never comes back to a value a thief has read: the tasks of a
+ * new range were never in the old one.
+ *
+ * @Param pool
+ * @Param worker - 0 .. num_workers-1
+ * @Param task - set to the task
+ *
+ * @Returns   false when no task is left
+ */
+/* ----------------------------------------------------------------------------*/
+bool steal_pool_next(steal_pool_t * pool, int worker, long * task)
+{
+    atomic_ullong *own = &pool->ranges[worker].range;
+    unsigned long long r, victim_r;
+    long lo, hi, left, most, take;
+    int w, victim;
+
+    r = atomic_load(own);
+    while (RANGE_LO(r) < RANGE_HI(r)) {
+        if (atomic_compare_exchange_weak(own, &r, RANGE(RANGE_LO(r) + 1, RANGE_HI(r)))) {
+            *task = RANGE_LO(r);
+            return true;
+        }
+    }
+
+    for (;;) {
+        most = 0;
+        victim = -1;
+        victim_r = 0;
+        for (w = 0; w < pool->num_workers; w++) {
+            r = atomic_load(&pool->ranges[w].range);
+            left = RANGE_HI(r) - RANGE_LO(r);
+            if (left > most) {
+                most = left;
+                victim = w;
+                victim_r = r;
+            }
+        }
+        if (victim < 0) {
+            return false;
+        }
+
+        lo = RANGE_LO(victim_r);
+        hi = RANGE_HI(victim_r);
+        take = (hi - lo + 1) / 2;
+        if (atomic_compare_exchange_strong(&pool->ranges[victim].range, &victim_r, RANGE(lo, hi - take))) {
+            *task = hi - take;
+            atomic_store(own, RANGE(hi - take + 1, hi));
+            return true;
+        }
+        /* the owner or another thief got there first, look again */
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef _URL_STEAL_H_
+#define _URL_STEAL_H_
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "url_queue.h"
+
+/*! \struct _steal_range_t
+ *  Tasks owned by one worker, lo in the low 32 bits and hi in the high 32
+ *  bits of one word: tasks lo .. hi-1 are left. The owner takes lo, a thief
+ *  takes the upper half, both with a compare and swap of the whole word.
+ */
+typedef struct _steal_range_t {
+    _Alignas(CACHE_LINE_SIZE) atomic_ullong range;
+} steal_range_t;
+
+/*! \struct _steal_pool_t
+ *  Tasks 0 .. num_tasks-1 split in equal consecutive ranges, one per worker
+ */
+typedef struct _steal_pool_t {
+    int num_workers;
+    steal_range_t *ranges;
+} steal_pool_t;
+
+steal_pool_t * steal_pool_create(long num_tasks, int num_workers);
+void steal_pool_free(steal_pool_t * pool);
+bool steal_pool_next(steal_pool_t * pool, int worker, long * task);
+
+#endif /* ifndef _URL_STEAL_H_ */
@@ -0,0 +1,545 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <zlib.h>
+#ifdef URL_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "url_stream.h"
+
+/* codec state of the reader thread, codec_state points to it */
+typedef struct _stream_codec_t {
+    z_stream z;
+#ifdef URL_HAVE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+    /* a gzip member or a zstd frame is started and not finished */
+    bool in_frame;
+    /* the last call filled the output, the decoder may hold more */
+    bool pending;
+} stream_codec_t;
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to find the codec from the first bytes of a source
+ *
+ * @Param p
+ * @Param len
+ *
+ * @Returns   codec, URL_STREAM_PLAIN when no magic matches
+ */
+/* ----------------------------------------------------------------------------*/
+static URL_STREAM_CODEC stream_codec(const unsigned char * p, size_t len)
+{
+    if (len >= 2 && 0x1f == p[0] && 0x8b == p[1]) {
+        return URL_STREAM_GZIP;
+    }
+    if (len >= 4 && 0x28 == p[0] && 0xb5 == p[1] && 0x2f == p[2] && 0xfd == p[3]) {
+        return URL_STREAM_ZSTD;
+    }
+    return URL_STREAM_PLAIN;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to tell if a regular file is compressed, without moving
+ * its offset. A pipe can't be looked at ahead, it is never reported.
+ *
+ * @Param fd
+ *
+ * @Returns   true when the file starts with a gzip or zstd magic
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_stream_is_compressed(int fd)
+{
+    unsigned char magic[4];
+    ssize_t n = pread(fd, magic, sizeof(magic), 0);
+
+    return n > 0 && URL_STREAM_PLAIN != stream_codec(magic, n);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to read the source once into the input buffer
+ *
+ * @Param s
+ * @Param at - bytes of the input buffer kept
+ *
+ * @Returns   bytes read, 0 at the end, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static ssize_t stream_read(url_stream_t * s, size_t at)
+{
+    ssize_t n;
+
+    do {
+        n = read(s->fd, s->in + at, URL_STREAM_READ_BYTES - at);
+    } while (n < 0 && EINTR == errno);
+    if (n < 0) {
+        fprintf(stderr, "URL stream read failed: %s\n", strerror(errno));
+        return -1;
+    }
+    s->in_pos = 0;
+    s->in_len = at + n;
+    return n;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to tell if the source has no byte to read right now,
+ * a read would block
+ *
+ * @Param s
+ *
+ * @Returns   true when idle
+ */
+/* ----------------------------------------------------------------------------*/
+static bool stream_idle(url_stream_t * s)
+{
+    stream_codec_t *c = s->codec_state;
+    struct pollfd p = { s->fd, POLLIN, 0 };
+
+    if (s->in_pos < s->in_len || (c && c->pending)) {
+        return false;
+    }
+    return 0 == poll(&p, 1, 0);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to set up the codec from the first bytes of the source
+ *
+ * @Param s
+ *
+ * @Returns   false on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static bool stream_detect(url_stream_t * s)
+{
+    stream_codec_t *c;
+    ssize_t n;
+
+    s->in_len = 0;
+    do {
+        if ((n = stream_read(s, s->in_len)) < 0) {
+            return false;
+        }
+    } while (n && s->in_len < 4);
+
+    s->codec = stream_codec((unsigned char *)s->in, s->in_len);
+    if (URL_STREAM_PLAIN == s->codec) {
+        return true;
+    }
+    c = calloc(1, sizeof(stream_codec_t));
+    if (NULL == c) {
+        fprintf(stderr, "URL stream allocation failed\n");
+        return false;
+    }
+    s->codec_state = c;
+    if (URL_STREAM_GZIP == s->codec) {
+        /* 16: gzip header and trailer */
+        if (Z_OK != inflateInit2(&c->z, 15 + 16)) {
+            fprintf(stderr, "URL stream inflateInit failed\n");
+            free(c);
+            s->codec_state = NULL;
+            return false;
+        }
+        return true;
+    }
+#ifdef URL_HAVE_ZSTD
+    c->zstd = ZSTD_createDStream();
+    if (NULL == c->zstd || ZSTD_isError(ZSTD_initDStream(c->zstd))) {
+        fprintf(stderr, "URL stream ZSTD_createDStream failed\n");
+        ZSTD_freeDStream(c->zstd);
+        free(c);
+        s->codec_state = NULL;
+        return false;
+    }
+    return true;
+#else
+    fprintf(stderr, "URL stream is zstd compressed, url-engine is built without libzstd\n");
+    free(c);
+    s->codec_state = NULL;
+    return false;
+#endif
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to free the codec state
+ *
+ * @Param s
+ */
+/* ----------------------------------------------------------------------------*/
+static void stream_codec_free(url_stream_t * s)
+{
+    stream_codec_t *c = s->codec_state;
+
+    if (!c) {
+        return;
+    }
+    if (URL_STREAM_GZIP == s->codec) {
+        inflateEnd(&c->z);
+    }
+#ifdef URL_HAVE_ZSTD
+    if (URL_STREAM_ZSTD == s->codec) {
+        ZSTD_freeDStream(c->zstd);
+    }
+#endif
+    free(c);
+    s->codec_state = NULL;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to decode input bytes into out, it reads the source
+ * once when all the input is used up and the decoder holds no more output
+ *
+ * @Param s
+ * @Param out
+ * @Param space - bytes free in out, above 0
+ * @Param at_end - set at the end of the source
+ *
+ * @Returns   bytes written to out, -1 on failure
+ */
+/* ----------------------------------------------------------------------------*/
+static ssize_t stream_decode(url_stream_t * s, char * out, size_t space, bool * at_end)
+{
+    stream_codec_t *c = s->codec_state;
+    ssize_t n;
+    size_t avail;
+    int ret;
+
+    if (URL_STREAM_PLAIN == s->codec) {
+        /* the bytes read to find the codec, then straight into out */
+        if (s->in_pos < s->in_len) {
+            n = (s->in_len - s->in_pos < space) ? s->in_len - s->in_pos : space;
+            memcpy(out, s->in + s->in_pos, n);
+            s->in_pos += n;
+            return n;
+        }
+        do {
+            n = read(s->fd, out, space);
+        } while (n < 0 && EINTR == errno);
+        if (n < 0) {
+            fprintf(stderr, "URL stream read failed: %s\n", strerror(errno));
+            return -1;
+        }
+        *at_end = (0 == n);
+        return n;
+    }
+
+    if (s->in_pos == s->in_len && !c->pending) {
+        if ((n = stream_read(s, 0)) < 0) {
+            return -1;
+        }
+        if (0 == n) {
+            if (c->in_frame) {
+                fprintf(stderr, "URL stream is truncated\n");
+                return -1;
+            }
+            *at_end = true;
+            return 0;
+        }
+    }
+
+    avail = s->in_len - s->in_pos;
+    if (URL_STREAM_GZIP == s->codec) {
+        c->z.next_in = (unsigned char *)s->in + s->in_pos;
+        c->z.avail_in = avail;
+        c->z.next_out = (unsigned char *)out;
+        c->z.avail_out = space;
+        if (avail) {
+            c->in_frame = true;
+        }
+        ret = inflate(&c->z, Z_NO_FLUSH);
+        s->in_pos = s->in_len - c->z.avail_in;
+        n = space - c->z.avail_out;
+        if (Z_STREAM_END == ret) {
+            /* a gzip file may hold members one after the other */
+            c->in_frame = false;
+            inflateReset(&c->z);
+        } else if (Z_OK != ret && Z_BUF_ERROR != ret) {
+            fprintf(stderr, "URL stream inflate failed: %s\n", c->z.msg ? c->z.msg : "error");
+            return -1;
+        }
+        c->pending = ((size_t)n == space);
+        return n;
+    }
+#ifdef URL_HAVE_ZSTD
+    {
+        ZSTD_inBuffer zin = { s->in + s->in_pos, avail, 0 };
+        ZSTD_outBuffer zout = { out, space, 0 };
+        size_t left = ZSTD_decompressStream(c->zstd, &zout, &zin);
+
+        if (ZSTD_isError(left)) {
+            fprintf(stderr, "URL stream zstd failed: %s\n", ZSTD_getErrorName(left));
+            return -1;
+        }
+        s->in_pos += zin.pos;
+        /* 0: the frame is done, the next input starts a new one */
+        c->in_frame = (0 != left);
+        c->pending = (zout.pos == space);
+        return zout.pos;
+    }
+#else
+    return -1;
+#endif
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Read ahead thread: it fills the free buffer with the decoded
+ * source and hands it over to the consumer
+ *
+ * @Param arg - the stream
+ *
+ * @Returns
+ */
+/* ----------------------------------------------------------------------------*/
+static void *stream_thread(void * arg)
+{
+    url_stream_t *s = arg;
+    bool at_end = false, ok;
+    size_t len;
+    ssize_t n;
+    char *out;
+
+    ok = stream_detect(s);
+    while (ok && !at_end) {
+        pthread_mutex_lock(&s->lock);
+        while (s->full[s->fill] && !s->closing) {
+            pthread_cond_wait(&s->cond, &s->lock);
+        }
+        if (s->closing) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        out = s->buf[s->fill];
+        pthread_mutex_unlock(&s->lock);
+
+        len = 0;
+        do {
+            if ((n = stream_decode(s, out + len, URL_STREAM_BUF_BYTES - len, &at_end)) < 0) {
+                ok = false;
+                break;
+            }
+            len += n;
+        } while (len < URL_STREAM_BUF_BYTES && !at_end &&
+                (0 == len || !(atomic_load(&s->waiting) || stream_idle(s))));
+
+        pthread_mutex_lock(&s->lock);
+        s->len[s->fill] = len;
+        s->full[s->fill] = true;
+        s->fill ^= 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->eof = true;
+    s->error = !ok;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to start reading a URL source ahead: a file, a pipe,
+ * plain, gzip or zstd compressed. The caller keeps the fd and closes it
+ * after url_stream_close().
+ *
+ * @Param fd
+ *
+ * @Returns   stream, NULL on failure
+ */
+/* ----------------------------------------------------------------------------*/
+url_stream_t * url_stream_open(int fd)
+{
+    url_stream_t *s = calloc(1, sizeof(url_stream_t));
+
+    if (NULL == s) {
+        return NULL;
+    }
+    s->fd = fd;
+    s->in = malloc(URL_STREAM_READ_BYTES);
+    s->buf[0] = malloc(URL_STREAM_BUF_BYTES);
+    s->buf[1] = malloc(URL_STREAM_BUF_BYTES);
+    if (!s->in || !s->buf[0] || !s->buf[1]) {
+        fprintf(stderr, "URL stream allocation failed\n");
+        free(s->in);
+        free(s->buf[0]);
+        free(s->buf[1]);
+        free(s);
+        return NULL;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    atomic_init(&s->waiting, false);
+    if (pthread_create(&s->thread, NULL, stream_thread, s) != 0) {
+        fprintf(stderr, "pthread_create failed stream thread!\n");
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->cond);
+        free(s->in);
+        free(s->buf[0]);
+        free(s->buf[1]);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to set what the consumer runs when the next line is
+ * not read yet and it is going to wait for the source, e.g. to write out
+ * the results of the lines it has so a live pipe is answered
+ *
+ * @Param stream
+ * @Param idle - NULL for none
+ * @Param arg - of idle
+ */
+/* ----------------------------------------------------------------------------*/
+void url_stream_set_idle(url_stream_t * stream, url_stream_idle_fn idle, void * arg)
+{
+    stream->idle = idle;
+    stream->idle_arg = arg;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to give the consumed buffer back to the reader and
+ * wait for the next one
+ *
+ * @Param s
+ *
+ * @Returns   false when the source is done
+ */
+/* ----------------------------------------------------------------------------*/
+static bool stream_take(url_stream_t * s)
+{
+    pthread_mutex_lock(&s->lock);
+    if (s->taken) {
+        s->full[s->take] = false;
+        s->take ^= 1;
+        s->taken = false;
+        pthread_cond_broadcast(&s->cond);
+    }
+    if (!s->full[s->take] && !s->eof && s->idle) {
+        pthread_mutex_unlock(&s->lock);
+        s->idle(s->idle_arg);
+        pthread_mutex_lock(&s->lock);
+    }
+    while (!s->full[s->take] && !s->eof) {
+        atomic_store(&s->waiting, true);
+        pthread_cond_wait(&s->cond, &s->lock);
+    }
+    atomic_store(&s->waiting, false);
+    if (!s->full[s->take]) {
+        pthread_mutex_unlock(&s->lock);
+        return false;
+    }
+    s->taken = true;
+    s->pos = s->buf[s->take];
+    s->end = s->pos + s->len[s->take];
+    pthread_mutex_unlock(&s->lock);
+    return true;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to get the next line of the stream, the line is not
+ * NUL terminated and does not include the '\n'. It stays valid until the
+ * next call.
+ *
+ * @Param stream
+ * @Param line - set to the start of the line
+ * @Param len - set to the length of the line
+ *
+ * @Returns   false at the end of the stream
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_stream_next_line(url_stream_t * stream, const char ** line, size_t * len)
+{
+    url_stream_t *s = stream;
+    size_t n, line_len = 0;
+    const char *nl;
+    char *p;
+
+    for (;;) {
+        if (s->pos < s->end) {
+            nl = memchr(s->pos, '\n', s->end - s->pos);
+            if (nl && 0 == line_len) {
+                *line = s->pos;
+                *len = nl - s->pos;
+                s->pos = nl + 1;
+                return true;
+            }
+            /* the line runs over the end of the buffer, it is copied */
+            n = (nl ? nl : s->end) - s->pos;
+            if (line_len + n > s->line_size) {
+                if (NULL == (p = realloc(s->line, 2 * (line_len + n)))) {
+                    fprintf(stderr, "URL stream allocation failed\n");
+                    exit(1);
+                }
+                s->line = p;
+                s->line_size = 2 * (line_len + n);
+            }
+            memcpy(s->line + line_len, s->pos, n);
+            line_len += n;
+            s->pos += n;
+            if (nl) {
+                s->pos++;
+                *line = s->line;
+                *len = line_len;
+                return true;
+            }
+        }
+        if (!stream_take(s)) {
+            /* the last line has no '\n' */
+            *line = s->line;
+            *len = line_len;
+            return 0 != line_len;
+        }
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @Synopsis  Function to stop the read ahead and free the stream
+ *
+ * @Param stream
+ *
+ * @Returns   false when the source could not be read or decoded
+ */
+/* ----------------------------------------------------------------------------*/
+bool url_stream_close(url_stream_t * stream)
+{
+    bool ok;
+
+    if (!stream) {
+        return true;
+    }
+    pthread_mutex_lock(&stream->lock);
+    stream->closing = true;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->thread, NULL);
+
+    ok = !stream->error;
+    stream_codec_free(stream);
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->cond);
+    free(stream->in);
+    free(stream->buf[0]);
+    free(stream->buf[1]);
+    free(stream->line);
+    free(stream);
+    return ok;
+}
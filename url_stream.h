@@ -0,0 +1,68 @@
+#ifndef _URL_STREAM_H_
+#define _URL_STREAM_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Bytes of one read-ahead buffer and of one read of the source */
+#define URL_STREAM_BUF_BYTES    (4 * 1024 * 1024)
+#define URL_STREAM_READ_BYTES   (1024 * 1024)
+
+/* called by the consumer right before it waits for the source */
+typedef void (*url_stream_idle_fn)(void * arg);
+
+typedef enum {
+    URL_STREAM_PLAIN,
+    URL_STREAM_GZIP,
+    URL_STREAM_ZSTD
+} URL_STREAM_CODEC;
+
+/*! \struct _url_stream_t
+ *  URL file read ahead by its own thread into two buffers: the reader fills
+ *  buf[fill] while the consumer takes lines from buf[take], so the reads and
+ *  the decompression overlap with the matching. A buffer is handed over when
+ *  it is full, or earlier when the consumer waits or the source has nothing
+ *  more to read right now, so lines of a live pipe are not held back.
+ *  The codec is found from the first bytes of the source.
+ *  line - a line that runs over the end of a buffer, copied
+ *  idle - run by the consumer before it waits, to hand over what it holds
+ */
+typedef struct _url_stream_t {
+    int fd;
+    URL_STREAM_CODEC codec;
+    void *codec_state;
+    char *in;
+    size_t in_len;
+    size_t in_pos;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *buf[2];
+    size_t len[2];
+    bool full[2];
+    int fill;
+    bool eof;
+    bool error;
+    atomic_bool waiting;
+    bool closing;
+
+    int take;
+    bool taken;
+    const char *pos;
+    const char *end;
+    char *line;
+    size_t line_size;
+    url_stream_idle_fn idle;
+    void *idle_arg;
+} url_stream_t;
+
+bool url_stream_is_compressed(int fd);
+url_stream_t * url_stream_open(int fd);
+void url_stream_set_idle(url_stream_t * stream, url_stream_idle_fn idle, void * arg);
+bool url_stream_next_line(url_stream_t * stream, const char ** line, size_t * len);
+bool url_stream_close(url_stream_t * stream);
+
+#endif /* ifndef _URL_STREAM_H_ */